@@ -0,0 +1,811 @@
+/**
+ *
+ * carith Archive Format API
+ * 2026/Oct/17 - Revision 0.80 alpha
+ *
+ * Created by: Stephen Sviatko
+ *
+ * (C) 2025 Good Neighbors LLC - All Rights Reserved, except where noted
+ *
+ * This file and any intellectual property (designs, algorithms, formulas,
+ * procedures, trademarks, and related documentation) contained herein are
+ * property of Good Neighbors, an Arizona Limited Liability Company.
+ *
+ * LICENSING INFORMATION
+ *
+ * This file may not be distributed in any modified form without expressed
+ * written permission of Good Neighbors LLC or its regents. Permission is
+ * granted to use this file in any non-commercial, non-governmental capacity
+ * (such as student projects, hobby projects, etc) without an official
+ * licensing agreement as long as the original author(s) are credited in any
+ * derivative work.
+ *
+ * Commercial licensing of this content is available, any agreement must
+ * include consulting services as part of a deployment strategy. For more
+ * information, please contact Stephen Sviatko at the following email address:
+ *
+ * ssviatko@gmail.com
+ *
+ * @file carchive.c
+ * @brief carith Archive Format API
+ *
+ * Reading and writing of the segment index trailer, and the random access
+ * reader.
+ *
+ */
+
+#include "carchive.h"
+
+const char *carchive_error_string[] = {
+    "none",
+    "memory allocation error",
+    "I/O error",
+    "archive has no index",
+    "archive is corrupt",
+    "not a carith archive",
+    "too big for a 32 bit archive header"
+}; ///< List of standard carchive error strings correlated to integer carchive error codes.
+
+static carchive_error_t pread_all(int a_fd, void *a_buff, size_t a_len, uint64_t a_offset)
+{
+    ssize_t res;
+    size_t l_done = 0;
+
+    while (l_done < a_len) {
+        res = pread(a_fd, (uint8_t *)a_buff + l_done, a_len - l_done, a_offset + l_done);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return CARCHIVE_ERR_IO;
+        }
+        if (res == 0)
+            return CARCHIVE_ERR_CORRUPT; // file ends before it should
+        l_done += res;
+    }
+    return CARCHIVE_ERR_NONE;
+}
+
+static carchive_error_t read_all(int a_fd, void *a_buff, size_t a_len)
+{
+    ssize_t res;
+    size_t l_done = 0;
+
+    while (l_done < a_len) {
+        res = read(a_fd, (uint8_t *)a_buff + l_done, a_len - l_done);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return CARCHIVE_ERR_IO;
+        }
+        if (res == 0)
+            return CARCHIVE_ERR_CORRUPT; // file ends before it should
+        l_done += res;
+    }
+    return CARCHIVE_ERR_NONE;
+}
+
+static carchive_error_t write_all(int a_fd, const void *a_buff, size_t a_len)
+{
+    ssize_t res;
+    size_t l_done = 0;
+
+    while (l_done < a_len) {
+        res = write(a_fd, (const uint8_t *)a_buff + l_done, a_len - l_done);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return CARCHIVE_ERR_IO;
+        }
+        if (res == 0)
+            return CARCHIVE_ERR_IO;
+        l_done += res;
+    }
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Returns a char pointer to an existing error string
+ *
+ * Works in exactly the same way as the strerror(errno) function works in the standard library
+ *
+ * @param[in] a_errno The numerical error returned by the function
+ * @return character pointer to error message
+ */
+
+const char *carchive_strerror(carchive_error_t a_errno)
+{
+    return carchive_error_string[a_errno];
+}
+
+/**
+ * @brief Write a file header at the file's current position
+ *
+ * a_hdr->cookie decides which variant goes to disk: carchive_cookie writes a
+ * file_header_t, carchive_cookie64 a file_header64_t, and carchive_cookie_shared
+ * a file_header64_t followed by the shared frequency table. Rewriting the header
+ * after compression has to use the same cookie as the first time around.
+ * The intermediate totals are only informational, so they saturate rather
+ * than fail in a 32 bit header.
+ *
+ * @param[in] a_hdr Pointer to the header, host byte order
+ * @param[in] a_fd File descriptor to write to
+ * @param[out] a_written Size of the header on disk
+ */
+
+carchive_error_t carchive_header_write(const carchive_header_t *a_hdr, int a_fd, size_t *a_written)
+{
+    int i;
+    uint8_t l_mtime[5];
+    time_t l_time = a_hdr->mtime;
+
+    for (i = 4; i >= 0; --i) {
+        l_mtime[i] = l_time & 0xff;
+        l_time >>= 8;
+    }
+    if ((a_hdr->cookie == carchive_cookie64) || (a_hdr->cookie == carchive_cookie_shared)) {
+        file_header64_t l_fh;
+        uint16_t l_table_len;
+        carchive_error_t err;
+
+        l_fh.cookie = htons(a_hdr->cookie);
+        l_fh.scheme = a_hdr->scheme;
+        l_fh.mode = htonl(a_hdr->mode);
+        memcpy(l_fh.mtime, l_mtime, sizeof(l_fh.mtime));
+        l_fh.plain_crc = htonl(a_hdr->plain_crc);
+        l_fh.total_plain_len = htobe64(a_hdr->total_plain_len);
+        l_fh.total_rle_len = htobe64(a_hdr->total_rle_len);
+        l_fh.total_lzss_len = htobe64(a_hdr->total_lzss_len);
+        l_fh.segsize = htonl(a_hdr->segsize);
+        *a_written = sizeof(l_fh);
+        err = write_all(a_fd, &l_fh, sizeof(l_fh));
+        if ((err != CARCHIVE_ERR_NONE) || (a_hdr->cookie != carchive_cookie_shared))
+            return err;
+        if ((a_hdr->shared_table_len == 0) || (a_hdr->shared_table_len > CARITH_SHARED_TABLE_MAX))
+            return CARCHIVE_ERR_CORRUPT;
+        l_table_len = htons(a_hdr->shared_table_len);
+        err = write_all(a_fd, &l_table_len, sizeof(l_table_len));
+        if (err == CARCHIVE_ERR_NONE)
+            err = write_all(a_fd, a_hdr->shared_table, a_hdr->shared_table_len);
+        *a_written += sizeof(l_table_len) + a_hdr->shared_table_len;
+        return err;
+    } else {
+        file_header_t l_fh;
+
+        if (a_hdr->total_plain_len > UINT32_MAX)
+            return CARCHIVE_ERR_TOOBIG;
+        // never carchive_cookie, the segments may use scaled AC counts or compact tables original readers don't know
+        l_fh.cookie = htons(carchive_cookie_ext);
+        l_fh.scheme = a_hdr->scheme;
+        l_fh.mode = htonl(a_hdr->mode);
+        memcpy(l_fh.mtime, l_mtime, sizeof(l_fh.mtime));
+        l_fh.plain_crc = htonl(a_hdr->plain_crc);
+        l_fh.total_plain_len = htonl(a_hdr->total_plain_len);
+        l_fh.total_rle_len = htonl((a_hdr->total_rle_len > UINT32_MAX) ? UINT32_MAX : a_hdr->total_rle_len);
+        l_fh.total_lzss_len = htonl((a_hdr->total_lzss_len > UINT32_MAX) ? UINT32_MAX : a_hdr->total_lzss_len);
+        l_fh.segsize = htonl(a_hdr->segsize);
+        *a_written = sizeof(l_fh);
+        return write_all(a_fd, &l_fh, sizeof(l_fh));
+    }
+}
+
+/**
+ * @brief Read a file header, either variant, from the file's current position
+ *
+ * Only reads forward, so this works on pipes.
+ *
+ * @param[out] a_hdr Header in host byte order
+ * @param[in] a_fd File descriptor to read from
+ * @param[out] a_read Size of the header on disk
+ * @return CARCHIVE_ERR_NOTARCHIVE if there's no cookie we know, or a carchive_cookie header carries file level scheme bits
+ */
+
+carchive_error_t carchive_header_read(carchive_header_t *a_hdr, int a_fd, size_t *a_read)
+{
+    int i;
+    carchive_error_t err;
+    file_header64_t l_fh; // the bigger of the two, the 32 bit one is read into it and then fixed up
+    uint16_t l_cookie;
+
+    err = read_all(a_fd, &l_fh.cookie, sizeof(l_fh.cookie));
+    if (err != CARCHIVE_ERR_NONE)
+        return (err == CARCHIVE_ERR_CORRUPT) ? CARCHIVE_ERR_NOTARCHIVE : err;
+    l_cookie = ntohs(l_fh.cookie);
+    a_hdr->shared_table_len = 0;
+    if ((l_cookie == carchive_cookie64) || (l_cookie == carchive_cookie_shared)) {
+        err = read_all(a_fd, (uint8_t *)&l_fh + sizeof(l_fh.cookie), sizeof(file_header64_t) - sizeof(l_fh.cookie));
+        if (err != CARCHIVE_ERR_NONE)
+            return (err == CARCHIVE_ERR_CORRUPT) ? CARCHIVE_ERR_NOTARCHIVE : err;
+        a_hdr->total_plain_len = be64toh(l_fh.total_plain_len);
+        a_hdr->total_rle_len = be64toh(l_fh.total_rle_len);
+        a_hdr->total_lzss_len = be64toh(l_fh.total_lzss_len);
+        a_hdr->segsize = ntohl(l_fh.segsize);
+        *a_read = sizeof(file_header64_t);
+        if (l_cookie == carchive_cookie_shared) {
+            uint16_t l_table_len;
+
+            err = read_all(a_fd, &l_table_len, sizeof(l_table_len));
+            if (err != CARCHIVE_ERR_NONE)
+                return err;
+            a_hdr->shared_table_len = ntohs(l_table_len);
+            if ((a_hdr->shared_table_len == 0) || (a_hdr->shared_table_len > CARITH_SHARED_TABLE_MAX))
+                return CARCHIVE_ERR_CORRUPT;
+            err = read_all(a_fd, a_hdr->shared_table, a_hdr->shared_table_len);
+            if (err != CARCHIVE_ERR_NONE)
+                return err;
+            *a_read += sizeof(l_table_len) + a_hdr->shared_table_len;
+        }
+    } else if ((l_cookie == carchive_cookie) || (l_cookie == carchive_cookie_ext)) {
+        file_header_t *l_fh32 = (file_header_t *)&l_fh;
+
+        err = read_all(a_fd, (uint8_t *)l_fh32 + sizeof(l_fh32->cookie), sizeof(file_header_t) - sizeof(l_fh32->cookie));
+        if (err != CARCHIVE_ERR_NONE)
+            return (err == CARCHIVE_ERR_CORRUPT) ? CARCHIVE_ERR_NOTARCHIVE : err;
+        // file level scheme bits only ever come with carchive_cookie_ext
+        if ((l_cookie == carchive_cookie) && (l_fh32->scheme & scheme_file_bits))
+            return CARCHIVE_ERR_NOTARCHIVE;
+        l_cookie = carchive_cookie;
+        a_hdr->total_plain_len = ntohl(l_fh32->total_plain_len);
+        a_hdr->total_rle_len = ntohl(l_fh32->total_rle_len);
+        a_hdr->total_lzss_len = ntohl(l_fh32->total_lzss_len);
+        a_hdr->segsize = ntohl(l_fh32->segsize);
+        *a_read = sizeof(file_header_t);
+    } else {
+        return CARCHIVE_ERR_NOTARCHIVE;
+    }
+    // everything up to and including plain_crc lines up in both variants
+    a_hdr->cookie = l_cookie;
+    a_hdr->scheme = l_fh.scheme;
+    a_hdr->mode = ntohl(l_fh.mode);
+    a_hdr->mtime = 0;
+    for (i = 0; i < 5; ++i) {
+        a_hdr->mtime <<= 8;
+        a_hdr->mtime |= l_fh.mtime[i];
+    }
+    a_hdr->plain_crc = ntohl(l_fh.plain_crc);
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Size of the header in front of each segment
+ *
+ * @param[in] a_file_scheme Scheme byte from the file header
+ * @return sizeof(segment_header_crc_t) if the file has per-segment CRCs, sizeof(segment_header_t) if not
+ */
+
+size_t carchive_segment_header_len(uint8_t a_file_scheme)
+{
+    if ((a_file_scheme & scheme_segcrc) == scheme_segcrc)
+        return sizeof(segment_header_crc_t);
+    return sizeof(segment_header_t);
+}
+
+/**
+ * @brief Initialize an empty segment index
+ *
+ * @param[in] a_idx Pointer to the index
+ * @param[in] a_file_scheme Scheme byte from the file header, tells us how big the segment headers are
+ */
+
+carchive_error_t carchive_index_init(carchive_index_t *a_idx, uint8_t a_file_scheme)
+{
+    a_idx->segs = NULL;
+    a_idx->count = 0;
+    a_idx->alloc = 0;
+    a_idx->plain_len = 0;
+    a_idx->hdr_len = carchive_segment_header_len(a_file_scheme);
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Free a segment index
+ *
+ * The index is left empty, ready to be added to again.
+ *
+ * @param[in] a_idx Pointer to the index
+ */
+
+carchive_error_t carchive_index_free(carchive_index_t *a_idx)
+{
+    free(a_idx->segs);
+    a_idx->segs = NULL;
+    a_idx->count = 0;
+    a_idx->alloc = 0;
+    a_idx->plain_len = 0;
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Append a segment to the index
+ *
+ * Segments must be added in file order. The plaintext offset of the segment
+ * is worked out from the segments added before it.
+ *
+ * @param[in] a_idx Pointer to the index
+ * @param[in] a_offset File offset of the segment header
+ * @param[in] a_total_compsize Segment's frequency table + token stream length
+ * @param[in] a_plain_len Segment's plaintext length
+ * @param[in] a_scheme Segment's scheme byte
+ */
+
+carchive_error_t carchive_index_add(carchive_index_t *a_idx, uint64_t a_offset, uint32_t a_total_compsize, uint32_t a_plain_len, uint8_t a_scheme)
+{
+    carchive_segment_t *l_seg;
+
+    if (a_idx->count == a_idx->alloc) {
+        uint32_t l_alloc = (a_idx->alloc == 0) ? 64 : a_idx->alloc * 2;
+        l_seg = realloc(a_idx->segs, l_alloc * sizeof(carchive_segment_t));
+        if (l_seg == NULL)
+            return CARCHIVE_ERR_MEMORY;
+        a_idx->segs = l_seg;
+        a_idx->alloc = l_alloc;
+    }
+    l_seg = &a_idx->segs[a_idx->count++];
+    l_seg->offset = a_offset;
+    l_seg->plain_offset = a_idx->plain_len;
+    l_seg->total_compsize = a_total_compsize;
+    l_seg->plain_len = a_plain_len;
+    l_seg->scheme = a_scheme;
+    a_idx->plain_len += a_plain_len;
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Write the index and its footer to a file
+ *
+ * The index is written at the file's current position, so this works on
+ * pipes too. The caller is responsible for setting scheme_indexed in the
+ * file header.
+ *
+ * @param[in] a_idx Pointer to the index
+ * @param[in] a_fd File descriptor to write to
+ * @param[in] a_offset File offset of the current position, normally right after the last segment
+ * @param[out] a_written Number of bytes written, including the footer
+ */
+
+carchive_error_t carchive_index_write(carchive_index_t *a_idx, int a_fd, uint64_t a_offset, uint64_t *a_written)
+{
+    size_t i;
+    carchive_error_t err;
+    carchive_index_entry_t *l_entries;
+    carchive_index_footer_t l_footer;
+    size_t l_entries_len = a_idx->count * sizeof(carchive_index_entry_t);
+
+    l_entries = malloc(l_entries_len + 1);
+    if (l_entries == NULL)
+        return CARCHIVE_ERR_MEMORY;
+    for (i = 0; i < a_idx->count; ++i) {
+        l_entries[i].offset = htobe64(a_idx->segs[i].offset);
+        l_entries[i].total_compsize = htonl(a_idx->segs[i].total_compsize);
+        l_entries[i].plain_len = htonl(a_idx->segs[i].plain_len);
+        l_entries[i].scheme = a_idx->segs[i].scheme;
+    }
+    l_footer.index_offset = htobe64(a_offset);
+    l_footer.seg_count = htonl(a_idx->count);
+    l_footer.index_crc = htonl(get_buffer_crc(0, (uint8_t *)l_entries, l_entries_len));
+    l_footer.magic = htonl(carchive_index_magic);
+
+    err = write_all(a_fd, l_entries, l_entries_len);
+    free(l_entries);
+    if (err != CARCHIVE_ERR_NONE)
+        return err;
+    err = write_all(a_fd, &l_footer, sizeof(l_footer));
+    if (err != CARCHIVE_ERR_NONE)
+        return err;
+    *a_written = l_entries_len + sizeof(l_footer);
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Load the index from the end of a file
+ *
+ * Only call this on files with scheme_indexed set in their header. The index
+ * is checked against its CRC and against the size of the file, and any
+ * previous contents of a_idx are discarded.
+ *
+ * @param[in] a_idx Pointer to an initialized index
+ * @param[in] a_fd File descriptor to read from
+ * @param[in] a_file_len Length of the file
+ */
+
+carchive_error_t carchive_index_read(carchive_index_t *a_idx, int a_fd, uint64_t a_file_len)
+{
+    size_t i;
+    carchive_error_t err;
+    carchive_index_entry_t *l_entries;
+    carchive_index_footer_t l_footer;
+    uint64_t l_index_offset;
+    uint32_t l_count;
+    size_t l_entries_len;
+
+    carchive_index_free(a_idx);
+    if (a_file_len < sizeof(file_header_t) + sizeof(l_footer))
+        return CARCHIVE_ERR_NOINDEX;
+    err = pread_all(a_fd, &l_footer, sizeof(l_footer), a_file_len - sizeof(l_footer));
+    if (err != CARCHIVE_ERR_NONE)
+        return err;
+    if (ntohl(l_footer.magic) != carchive_index_magic)
+        return CARCHIVE_ERR_NOINDEX;
+    l_index_offset = be64toh(l_footer.index_offset);
+    l_count = ntohl(l_footer.seg_count);
+    l_entries_len = (size_t)l_count * sizeof(carchive_index_entry_t);
+    if ((l_index_offset < sizeof(file_header_t)) || (l_index_offset + l_entries_len + sizeof(l_footer) != a_file_len))
+        return CARCHIVE_ERR_CORRUPT;
+
+    l_entries = malloc(l_entries_len + 1);
+    if (l_entries == NULL)
+        return CARCHIVE_ERR_MEMORY;
+    err = pread_all(a_fd, l_entries, l_entries_len, l_index_offset);
+    if (err != CARCHIVE_ERR_NONE) {
+        free(l_entries);
+        return err;
+    }
+    if (get_buffer_crc(0, (uint8_t *)l_entries, l_entries_len) != ntohl(l_footer.index_crc)) {
+        free(l_entries);
+        return CARCHIVE_ERR_CORRUPT;
+    }
+    for (i = 0; i < l_count; ++i) {
+        uint64_t l_offset = be64toh(l_entries[i].offset);
+        uint32_t l_total_compsize = ntohl(l_entries[i].total_compsize);
+        // every segment has to sit between the file header and the index
+        if ((l_offset < sizeof(file_header_t)) || (l_offset + a_idx->hdr_len + l_total_compsize > l_index_offset)) {
+            free(l_entries);
+            carchive_index_free(a_idx);
+            return CARCHIVE_ERR_CORRUPT;
+        }
+        err = carchive_index_add(a_idx, l_offset, l_total_compsize, ntohl(l_entries[i].plain_len), l_entries[i].scheme);
+        if (err != CARCHIVE_ERR_NONE) {
+            free(l_entries);
+            carchive_index_free(a_idx);
+            return err;
+        }
+    }
+    free(l_entries);
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Build an index by walking the segment headers
+ *
+ * For archives without an index, or with one we can't trust. The scan stops
+ * at a streamed file's end marker. Any previous contents of a_idx are
+ * discarded.
+ *
+ * @param[in] a_idx Pointer to an initialized index
+ * @param[in] a_fd File descriptor to read from
+ * @param[in] a_offset File offset of the first segment header
+ * @param[in] a_end File offset where the segments end
+ * @param[in] a_plain_len Stop once this much plaintext is accounted for
+ */
+
+carchive_error_t carchive_index_scan(carchive_index_t *a_idx, int a_fd, uint64_t a_offset, uint64_t a_end, uint64_t a_plain_len)
+{
+    carchive_error_t err;
+    segment_header_crc_t bh;
+
+    carchive_index_free(a_idx);
+    while ((a_offset < a_end) && (a_idx->plain_len < a_plain_len)) {
+        err = pread_all(a_fd, &bh, a_idx->hdr_len, a_offset);
+        if (err != CARCHIVE_ERR_NONE) {
+            carchive_index_free(a_idx);
+            return err;
+        }
+        if ((bh.plain_len == 0) && (bh.total_compsize == 0))
+            break; // end marker
+        if (a_offset + a_idx->hdr_len + ntohl(bh.total_compsize) > a_end) {
+            carchive_index_free(a_idx);
+            return CARCHIVE_ERR_CORRUPT;
+        }
+        err = carchive_index_add(a_idx, a_offset, ntohl(bh.total_compsize), ntohl(bh.plain_len), bh.scheme);
+        if (err != CARCHIVE_ERR_NONE) {
+            carchive_index_free(a_idx);
+            return err;
+        }
+        a_offset += a_idx->hdr_len + ntohl(bh.total_compsize);
+    }
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Convert a stream trailer to network byte order and stamp its magic
+ *
+ * @param[in] a_trailer Pointer to a trailer filled in in host byte order
+ */
+
+carchive_error_t carchive_trailer_encode(carchive_stream_trailer_t *a_trailer)
+{
+    a_trailer->plain_crc = htonl(a_trailer->plain_crc);
+    a_trailer->total_plain_len = htobe64(a_trailer->total_plain_len);
+    a_trailer->total_rle_len = htobe64(a_trailer->total_rle_len);
+    a_trailer->total_lzss_len = htobe64(a_trailer->total_lzss_len);
+    a_trailer->magic = htonl(carchive_trailer_magic);
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Convert a stream trailer as read from disk to host byte order
+ *
+ * @param[in] a_trailer Pointer to a trailer in network byte order
+ * @return CARCHIVE_ERR_CORRUPT if the magic is wrong
+ */
+
+carchive_error_t carchive_trailer_decode(carchive_stream_trailer_t *a_trailer)
+{
+    if (ntohl(a_trailer->magic) != carchive_trailer_magic)
+        return CARCHIVE_ERR_CORRUPT;
+    a_trailer->plain_crc = ntohl(a_trailer->plain_crc);
+    a_trailer->total_plain_len = be64toh(a_trailer->total_plain_len);
+    a_trailer->total_rle_len = be64toh(a_trailer->total_rle_len);
+    a_trailer->total_lzss_len = be64toh(a_trailer->total_lzss_len);
+    a_trailer->magic = carchive_trailer_magic;
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Read and decode a stream trailer from a seekable file
+ *
+ * @param[out] a_trailer Trailer in host byte order
+ * @param[in] a_fd File descriptor to read from
+ * @param[in] a_offset File offset of the trailer, see carchive_segments_end
+ */
+
+carchive_error_t carchive_trailer_read(carchive_stream_trailer_t *a_trailer, int a_fd, uint64_t a_offset)
+{
+    carchive_error_t err;
+
+    err = pread_all(a_fd, a_trailer, sizeof(carchive_stream_trailer_t), a_offset);
+    if (err != CARCHIVE_ERR_NONE)
+        return err;
+    return carchive_trailer_decode(a_trailer);
+}
+
+/**
+ * @brief Work out where the segments end
+ *
+ * In a streamed file, the end marker sits here and the trailer follows it.
+ *
+ * @param[in] a_idx Pointer to the file's index
+ * @param[in] a_segs_offset File offset of the first segment, right after the infotag
+ * @return File offset just past the last segment
+ */
+
+uint64_t carchive_segments_end(carchive_index_t *a_idx, uint64_t a_segs_offset)
+{
+    carchive_segment_t *l_last;
+
+    if (a_idx->count == 0)
+        return a_segs_offset;
+    l_last = &a_idx->segs[a_idx->count - 1];
+    return l_last->offset + a_idx->hdr_len + l_last->total_compsize;
+}
+
+/**
+ * @brief Open an archive for random access
+ *
+ * Uses the archive's index if it has a usable one, otherwise builds one by
+ * scanning the segment headers.
+ *
+ * @param[in] a_rd Pointer to a reader context
+ * @param[in] a_path Path to the archive
+ * @param[in] a_cache_segs Number of decoded segments to keep, 0 for CARCHIVE_DEFAULT_CACHE_SEGS
+ */
+
+carchive_error_t carchive_open(carchive_reader_t *a_rd, const char *a_path, uint32_t a_cache_segs)
+{
+    size_t i;
+    carchive_error_t err;
+    struct stat l_stat;
+    uint8_t l_infotag_len;
+    size_t l_header_len;
+    uint64_t l_segs_offset;
+
+    memset(a_rd, 0, sizeof(carchive_reader_t));
+    carchive_index_init(&a_rd->idx, 0);
+    a_rd->fd = open(a_path, O_RDONLY);
+    if (a_rd->fd < 0)
+        return CARCHIVE_ERR_IO;
+    if (fstat(a_rd->fd, &l_stat) < 0) {
+        close(a_rd->fd);
+        return CARCHIVE_ERR_IO;
+    }
+
+    // file header, then skip the infotag
+    err = carchive_header_read(&a_rd->fh, a_rd->fd, &l_header_len);
+    if (err == CARCHIVE_ERR_NONE)
+        err = pread_all(a_rd->fd, &l_infotag_len, sizeof(l_infotag_len), l_header_len);
+    if (err == CARCHIVE_ERR_CORRUPT)
+        err = CARCHIVE_ERR_NOTARCHIVE;
+    if (err != CARCHIVE_ERR_NONE) {
+        close(a_rd->fd);
+        return err;
+    }
+    l_segs_offset = l_header_len + sizeof(l_infotag_len) + l_infotag_len;
+    carchive_index_init(&a_rd->idx, a_rd->fh.scheme);
+
+    // find our segments
+    err = CARCHIVE_ERR_NOINDEX;
+    if ((a_rd->fh.scheme & scheme_indexed) == scheme_indexed)
+        err = carchive_index_read(&a_rd->idx, a_rd->fd, l_stat.st_size);
+    if ((err == CARCHIVE_ERR_NOINDEX) || (err == CARCHIVE_ERR_CORRUPT))
+        err = carchive_index_scan(&a_rd->idx, a_rd->fd, l_segs_offset, l_stat.st_size, ((a_rd->fh.scheme & scheme_streamed) == scheme_streamed) ? UINT64_MAX : a_rd->fh.total_plain_len);
+    if ((err == CARCHIVE_ERR_NONE) && ((a_rd->fh.scheme & scheme_streamed) == scheme_streamed)) {
+        // totals are in the trailer, past the end marker
+        carchive_stream_trailer_t l_trailer;
+        err = carchive_trailer_read(&l_trailer, a_rd->fd, carchive_segments_end(&a_rd->idx, l_segs_offset) + a_rd->idx.hdr_len);
+        a_rd->fh.plain_crc = l_trailer.plain_crc;
+        a_rd->fh.total_plain_len = l_trailer.total_plain_len;
+        a_rd->fh.total_rle_len = l_trailer.total_rle_len;
+        a_rd->fh.total_lzss_len = l_trailer.total_lzss_len;
+    }
+    if ((err == CARCHIVE_ERR_NONE) && (a_rd->idx.plain_len != a_rd->fh.total_plain_len))
+        err = CARCHIVE_ERR_CORRUPT;
+    for (i = 0; (err == CARCHIVE_ERR_NONE) && (i < a_rd->idx.count); ++i) {
+        // anything that won't fit in a context sized for segsize can't be decoded
+        if (a_rd->idx.segs[i].plain_len > a_rd->fh.segsize)
+            err = CARCHIVE_ERR_CORRUPT;
+    }
+    if (err != CARCHIVE_ERR_NONE) {
+        carchive_index_free(&a_rd->idx);
+        close(a_rd->fd);
+        return err;
+    }
+
+    if (carith_init_ctx(&a_rd->ctx, a_rd->fh.segsize) != CARITH_ERR_NONE) {
+        carchive_index_free(&a_rd->idx);
+        close(a_rd->fd);
+        return CARCHIVE_ERR_MEMORY;
+    }
+    if ((a_rd->fh.shared_table_len > 0) && (carith_shared_load(&a_rd->ctx, a_rd->fh.shared_table, a_rd->fh.shared_table_len) != CARITH_ERR_NONE)) {
+        carith_free_ctx(&a_rd->ctx);
+        carchive_index_free(&a_rd->idx);
+        close(a_rd->fd);
+        return CARCHIVE_ERR_CORRUPT;
+    }
+    a_rd->cache_count = (a_cache_segs > 0) ? a_cache_segs : CARCHIVE_DEFAULT_CACHE_SEGS;
+    a_rd->cache = calloc(a_rd->cache_count, sizeof(carchive_cache_slot_t));
+    if (a_rd->cache == NULL) {
+        carchive_close(a_rd);
+        return CARCHIVE_ERR_MEMORY;
+    }
+    for (i = 0; i < a_rd->cache_count; ++i) {
+        a_rd->cache[i].data = malloc(a_rd->fh.segsize);
+        if (a_rd->cache[i].data == NULL) {
+            carchive_close(a_rd);
+            return CARCHIVE_ERR_MEMORY;
+        }
+    }
+    return CARCHIVE_ERR_NONE;
+}
+
+static carchive_error_t fetch_segment(carchive_reader_t *a_rd, uint32_t a_seg, carchive_cache_slot_t **a_slot)
+{
+    size_t i;
+    carchive_error_t err;
+    segment_header_crc_t bh;
+    uint32_t l_hdr_len = a_rd->idx.hdr_len;
+    carchive_segment_t *l_seg = &a_rd->idx.segs[a_seg];
+    carchive_cache_slot_t *l_victim = &a_rd->cache[0];
+
+    // look in the cache first, keeping track of the least recently used slot as we go
+    a_rd->tick++;
+    for (i = 0; i < a_rd->cache_count; ++i) {
+        if ((a_rd->cache[i].last_used > 0) && (a_rd->cache[i].seg == a_seg)) {
+            a_rd->cache[i].last_used = a_rd->tick;
+            a_rd->hits++;
+            *a_slot = &a_rd->cache[i];
+            return CARCHIVE_ERR_NONE;
+        }
+        if (a_rd->cache[i].last_used < l_victim->last_used)
+            l_victim = &a_rd->cache[i];
+    }
+    a_rd->misses++;
+
+    // not there, decode it into the victim
+    err = pread_all(a_rd->fd, &bh, l_hdr_len, l_seg->offset);
+    if (err != CARCHIVE_ERR_NONE)
+        return err;
+    a_rd->ctx.freq_comp_len = ntohs(bh.freq_comp_len);
+    if ((bh.scheme != l_seg->scheme) || (ntohl(bh.total_compsize) != l_seg->total_compsize) || (ntohl(bh.plain_len) != l_seg->plain_len)
+        || (a_rd->ctx.freq_comp_len > sizeof(a_rd->ctx.freq_comp)) || (a_rd->ctx.freq_comp_len > l_seg->total_compsize)
+        || (l_seg->total_compsize - a_rd->ctx.freq_comp_len > a_rd->fh.segsize * 3 / 2))
+        return CARCHIVE_ERR_CORRUPT;
+    a_rd->ctx.scheme = bh.scheme;
+    a_rd->ctx.block_num = a_seg;
+    a_rd->ctx.plain_len = l_seg->plain_len;
+    a_rd->ctx.rle_intermediate = ntohl(bh.rle_intermediate);
+    a_rd->ctx.lzss_intermediate = ntohl(bh.lzss_intermediate);
+    a_rd->ctx.comp_len = l_seg->total_compsize - a_rd->ctx.freq_comp_len;
+    err = pread_all(a_rd->fd, a_rd->ctx.freq_comp, a_rd->ctx.freq_comp_len, l_seg->offset + l_hdr_len);
+    if (err != CARCHIVE_ERR_NONE)
+        return err;
+    err = pread_all(a_rd->fd, a_rd->ctx.comp, a_rd->ctx.comp_len, l_seg->offset + l_hdr_len + a_rd->ctx.freq_comp_len);
+    if (err != CARCHIVE_ERR_NONE)
+        return err;
+    if (carith_extract(&a_rd->ctx) != CARITH_ERR_NONE)
+        return CARCHIVE_ERR_CORRUPT;
+    if (a_rd->ctx.decomp_len != l_seg->plain_len)
+        return CARCHIVE_ERR_CORRUPT;
+    if (((a_rd->fh.scheme & scheme_segcrc) == scheme_segcrc) && (get_buffer_crc(0, a_rd->ctx.decomp, a_rd->ctx.decomp_len) != ntohl(bh.plain_crc)))
+        return CARCHIVE_ERR_CORRUPT;
+
+    memcpy(l_victim->data, a_rd->ctx.decomp, a_rd->ctx.decomp_len);
+    l_victim->len = a_rd->ctx.decomp_len;
+    l_victim->seg = a_seg;
+    l_victim->last_used = a_rd->tick;
+    *a_slot = l_victim;
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Read a range of the original file out of an archive
+ *
+ * Works like pread: reads up to a_len bytes of plaintext starting at
+ * a_offset, and comes up short only at the end of the original file.
+ *
+ * @param[in] a_rd Pointer to an open reader context
+ * @param[out] a_buff Buffer for the plaintext
+ * @param[in] a_len Number of bytes wanted
+ * @param[in] a_offset Offset into the original file
+ * @param[out] a_read Number of bytes actually read
+ */
+
+carchive_error_t carchive_read(carchive_reader_t *a_rd, void *a_buff, size_t a_len, uint64_t a_offset, size_t *a_read)
+{
+    carchive_error_t err;
+    carchive_cache_slot_t *l_slot;
+    uint32_t l_lo, l_hi, l_mid;
+    size_t l_chunk;
+
+    *a_read = 0;
+    if ((a_offset >= a_rd->idx.plain_len) || (a_len == 0))
+        return CARCHIVE_ERR_NONE;
+
+    // binary search for the segment containing a_offset
+    l_lo = 0;
+    l_hi = a_rd->idx.count - 1;
+    while (l_lo < l_hi) {
+        l_mid = l_lo + (l_hi - l_lo + 1) / 2;
+        if (a_rd->idx.segs[l_mid].plain_offset <= a_offset)
+            l_lo = l_mid;
+        else
+            l_hi = l_mid - 1;
+    }
+
+    // then walk forward a segment at a time
+    for (; (l_lo < a_rd->idx.count) && (*a_read < a_len); ++l_lo) {
+        uint64_t l_in_seg = a_offset + *a_read - a_rd->idx.segs[l_lo].plain_offset;
+
+        if (a_rd->idx.segs[l_lo].plain_len == 0)
+            continue;
+        err = fetch_segment(a_rd, l_lo, &l_slot);
+        if (err != CARCHIVE_ERR_NONE)
+            return err;
+        l_chunk = l_slot->len - l_in_seg;
+        if (l_chunk > a_len - *a_read)
+            l_chunk = a_len - *a_read;
+        memcpy((uint8_t *)a_buff + *a_read, l_slot->data + l_in_seg, l_chunk);
+        *a_read += l_chunk;
+    }
+    return CARCHIVE_ERR_NONE;
+}
+
+/**
+ * @brief Close a reader and release everything it allocated
+ *
+ * @param[in] a_rd Pointer to an open reader context
+ */
+
+carchive_error_t carchive_close(carchive_reader_t *a_rd)
+{
+    size_t i;
+
+    if (a_rd->cache != NULL) {
+        for (i = 0; i < a_rd->cache_count; ++i)
+            free(a_rd->cache[i].data);
+        free(a_rd->cache);
+        a_rd->cache = NULL;
+    }
+    carith_free_ctx(&a_rd->ctx);
+    carchive_index_free(&a_rd->idx);
+    close(a_rd->fd);
+    return CARCHIVE_ERR_NONE;
+}
@@ -0,0 +1,323 @@
+/**
+ *
+ * carith Archive Format API
+ * 2026/Oct/17 - Revision 0.80 alpha
+ *
+ * Created by: Stephen Sviatko
+ *
+ * (C) 2025 Good Neighbors LLC - All Rights Reserved, except where noted
+ *
+ * This file and any intellectual property (designs, algorithms, formulas,
+ * procedures, trademarks, and related documentation) contained herein are
+ * property of Good Neighbors, an Arizona Limited Liability Company.
+ *
+ * LICENSING INFORMATION
+ *
+ * This file may not be distributed in any modified form without expressed
+ * written permission of Good Neighbors LLC or its regents. Permission is
+ * granted to use this file in any non-commercial, non-governmental capacity
+ * (such as student projects, hobby projects, etc) without an official
+ * licensing agreement as long as the original author(s) are credited in any
+ * derivative work.
+ *
+ * Commercial licensing of this content is available, any agreement must
+ * include consulting services as part of a deployment strategy. For more
+ * information, please contact Stephen Sviatko at the following email address:
+ *
+ * ssviatko@gmail.com
+ *
+ * @file carchive.h
+ * @brief carith Archive Format API
+ *
+ * On-disk layout of a .carith file, the segment index that can follow the
+ * last segment, and a random access reader built on top of carith_extract.
+ *
+ * A .carith file is a file_header_t (or a file_header64_t, for inputs too big
+ * for 32 bit lengths, told apart by the cookie), an infotag (one length byte followed by
+ * that many bytes of text), then one segment_header_t + frequency table +
+ * token stream per segment. When scheme_segcrc is set in the file header, every
+ * segment gets a segment_header_crc_t instead, which carries the CRC of that
+ * segment's plaintext so a damaged segment can be named. When scheme_indexed is set in the file header,
+ * the segments are followed by an array of carchive_index_entry_t, one per
+ * segment, and a carchive_index_footer_t which is always the last thing in
+ * the file. All multi-byte fields on disk are in network byte order.
+ *
+ * A file with a shared frequency table (carchive_cookie_shared) has its
+ * file_header64_t followed by a 16 bit length and that many bytes of table,
+ * as written by carith_shared_build. Every decoder loads it with
+ * carith_shared_load before touching a segment, so segments that use it can
+ * still be decoded independently and in any order.
+ *
+ * A streamed file (scheme_streamed) is written front to back without ever
+ * seeking, so its file header carries no totals or CRC. Instead the last
+ * segment is followed by an all zero segment_header_t as an end marker, and
+ * then a carchive_stream_trailer_t with the totals and CRC. An index, if
+ * any, comes after the trailer.
+ *
+ */
+
+#ifndef CARCHIVE_H
+#define CARCHIVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <arpa/inet.h> // for htons/htonl
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "crc32.h"
+#include "carith.h"
+
+#define CARCHIVE_DEFAULT_CACHE_SEGS 8       ///< Decoded segments kept around by a reader unless told otherwise
+
+const static uint16_t carchive_cookie = 0xd5aa;              ///< First two bytes of an original format .carith file with a file_header_t, read but no longer written
+const static uint16_t carchive_cookie_ext = 0xd5ad;          ///< First two bytes of a .carith file with a file_header_t, which may carry file level scheme bits, scaled AC counts and compact tables
+const static uint16_t carchive_cookie64 = 0xd5ab;            ///< First two bytes of a .carith file with a file_header64_t
+const static uint16_t carchive_cookie_shared = 0xd5ac;       ///< First two bytes of a .carith file with a file_header64_t followed by a shared frequency table
+const static uint32_t carchive_index_magic = 0x43494458;     ///< "CIDX", last four bytes of an indexed .carith file
+const static uint32_t carchive_trailer_magic = 0x43454e44;   ///< "CEND", last four bytes of a stream trailer
+
+// file level scheme bits, never seen by carith_compress/carith_extract. Each of them changes the layout
+// of the file, so a file_header_t carrying any of them goes to disk with carchive_cookie_ext, which readers
+// that predate them refuse, and a carchive_cookie file carrying any of them is rejected.
+const static uint8_t scheme_segcrc = 0x02;
+const static uint8_t scheme_indexed = 0x04;
+const static uint8_t scheme_streamed = 0x08;
+const static uint8_t scheme_file_bits = 0x0e; // all of the above
+
+// everything that goes to disk as is gets packed, and nothing else
+#pragma pack(push, 1)
+
+/**
+ * @struct file_header_t
+ * @brief Header at the start of every .carith file
+ */
+
+typedef struct {
+    uint16_t cookie; ///< carchive_cookie
+    uint8_t scheme; ///< Compression chain requested by the user, plus file level scheme bits
+    mode_t mode; ///< Mode of original file
+    uint8_t mtime[5]; ///< Lower 5 bytes of mtime time_t
+    uint32_t plain_crc; ///< CRC of plain input file
+    uint32_t total_plain_len; ///< Length of plain input file
+    uint32_t total_rle_len; ///< Sum of RLE intermediate lengths over all segments
+    uint32_t total_lzss_len; ///< Sum of LZSS intermediate lengths over all segments
+    uint32_t segsize; ///< Segment size the file was compressed with
+} file_header_t;
+
+/**
+ * @struct file_header64_t
+ * @brief Header at the start of a .carith file whose lengths need 64 bits
+ */
+
+typedef struct {
+    uint16_t cookie; ///< carchive_cookie64
+    uint8_t scheme; ///< Compression chain requested by the user, plus file level scheme bits
+    mode_t mode; ///< Mode of original file
+    uint8_t mtime[5]; ///< Lower 5 bytes of mtime time_t
+    uint32_t plain_crc; ///< CRC of plain input file
+    uint64_t total_plain_len; ///< Length of plain input file
+    uint64_t total_rle_len; ///< Sum of RLE intermediate lengths over all segments
+    uint64_t total_lzss_len; ///< Sum of LZSS intermediate lengths over all segments
+    uint32_t segsize; ///< Segment size the file was compressed with
+} file_header64_t;
+
+/**
+ * @struct segment_header_t
+ * @brief Header in front of every segment
+ */
+
+typedef struct {
+    uint8_t scheme; ///< Compression chain used for this segment
+    uint32_t rle_intermediate; ///< Length after RLE
+    uint32_t lzss_intermediate; ///< Length after LZSS
+    uint32_t total_compsize; ///< comp_len + freq_comp_len
+    uint16_t freq_comp_len; ///< Length of frequency table
+    uint32_t plain_len; ///< Length of this segment's plaintext
+} segment_header_t;
+
+/**
+ * @struct segment_header_crc_t
+ * @brief Header in front of every segment of a file with scheme_segcrc set
+ *
+ * Starts out exactly like a segment_header_t, so code that only wants the
+ * common fields can read either one into this.
+ */
+
+typedef struct {
+    uint8_t scheme; ///< Compression chain used for this segment
+    uint32_t rle_intermediate; ///< Length after RLE
+    uint32_t lzss_intermediate; ///< Length after LZSS
+    uint32_t total_compsize; ///< comp_len + freq_comp_len
+    uint16_t freq_comp_len; ///< Length of frequency table
+    uint32_t plain_len; ///< Length of this segment's plaintext
+    uint32_t plain_crc; ///< CRC of this segment's plaintext
+} segment_header_crc_t;
+
+/**
+ * @struct carchive_index_entry_t
+ * @brief One segment's entry in the on-disk index
+ */
+
+typedef struct {
+    uint64_t offset; ///< File offset of the segment_header_t
+    uint32_t total_compsize; ///< Same as the segment header's, so the whole segment is offset + segment header + total_compsize
+    uint32_t plain_len; ///< Length of this segment's plaintext
+    uint8_t scheme; ///< Compression chain used for this segment
+} carchive_index_entry_t;
+
+/**
+ * @struct carchive_index_footer_t
+ * @brief Fixed size footer at the very end of an indexed file
+ */
+
+typedef struct {
+    uint64_t index_offset; ///< File offset of the first carchive_index_entry_t
+    uint32_t seg_count; ///< Number of index entries
+    uint32_t index_crc; ///< CRC of the index entries as they appear on disk
+    uint32_t magic; ///< carchive_index_magic
+} carchive_index_footer_t;
+
+/**
+ * @struct carchive_stream_trailer_t
+ * @brief Totals for a streamed file, following its end marker
+ */
+
+typedef struct {
+    uint32_t plain_crc; ///< CRC of plain input
+    uint64_t total_plain_len; ///< Length of plain input
+    uint64_t total_rle_len; ///< Sum of RLE intermediate lengths over all segments
+    uint64_t total_lzss_len; ///< Sum of LZSS intermediate lengths over all segments
+    uint32_t magic; ///< carchive_trailer_magic
+} carchive_stream_trailer_t;
+
+#pragma pack(pop)
+
+/**
+ * @struct carchive_header_t
+ * @brief In-memory file header, host byte order, whichever variant is on disk
+ */
+
+typedef struct {
+    uint16_t cookie; ///< carchive_cookie, carchive_cookie64 or carchive_cookie_shared, picks the variant written to disk (carchive_cookie_ext reads back as carchive_cookie)
+    uint8_t scheme; ///< Compression chain requested by the user, plus file level scheme bits
+    mode_t mode; ///< Mode of original file
+    time_t mtime; ///< mtime of original file, only the lower 5 bytes make it to disk
+    uint32_t plain_crc; ///< CRC of plain input file
+    uint64_t total_plain_len; ///< Length of plain input file
+    uint64_t total_rle_len; ///< Sum of RLE intermediate lengths over all segments
+    uint64_t total_lzss_len; ///< Sum of LZSS intermediate lengths over all segments
+    uint32_t segsize; ///< Segment size the file was compressed with
+    uint16_t shared_table_len; ///< Length of shared_table, 0 if the file has none
+    uint8_t shared_table[CARITH_SHARED_TABLE_MAX]; ///< Shared frequency table, carchive_cookie_shared only
+} carchive_header_t;
+
+/**
+ * @struct carchive_segment_t
+ * @brief In-memory index entry, host byte order
+ */
+
+typedef struct {
+    uint64_t offset; ///< File offset of the segment_header_t
+    uint64_t plain_offset; ///< Where this segment's plaintext starts in the original file
+    uint32_t total_compsize; ///< Frequency table + token stream length
+    uint32_t plain_len; ///< Length of this segment's plaintext
+    uint8_t scheme; ///< Compression chain used for this segment
+} carchive_segment_t;
+
+/**
+ * @struct carchive_index_t
+ * @brief In-memory segment index
+ */
+
+typedef struct {
+    carchive_segment_t *segs; ///< One entry per segment, in file order
+    uint32_t count; ///< Number of segments in the index
+    uint32_t alloc; ///< Number of entries allocated in segs
+    uint64_t plain_len; ///< Sum of plain_len over all segments
+    uint32_t hdr_len; ///< Size of each segment's header, see carchive_segment_header_len
+} carchive_index_t;
+
+/**
+ * @struct carchive_cache_slot_t
+ * @brief One decoded segment held by a reader
+ */
+
+typedef struct {
+    uint32_t seg; ///< Segment number held in this slot
+    uint64_t last_used; ///< Reader tick of the last hit, 0 if the slot is empty
+    uint8_t *data; ///< Decoded plaintext, segsize bytes
+    uint32_t len; ///< Length of decoded plaintext
+} carchive_cache_slot_t;
+
+/**
+ * @struct carchive_reader_t
+ * @brief Random access reader context
+ *
+ * Decodes only the segments covering a requested byte range of the original
+ * file, and keeps the most recently used ones so that nearby reads don't
+ * decode anything at all. A reader is not thread safe, give each thread its
+ * own.
+ */
+
+typedef struct {
+    int fd; ///< Archive file descriptor
+    carchive_header_t fh; ///< File header, with a streamed file's totals filled in from its trailer
+    carchive_index_t idx; ///< Segment index, loaded from the archive or built by scanning it
+    carith_comp_ctx ctx; ///< Context segments are decoded in
+    carchive_cache_slot_t *cache; ///< Decoded segment cache
+    uint32_t cache_count; ///< Number of slots in the cache
+    uint64_t tick; ///< Bumped on every cache lookup, for LRU replacement
+    uint64_t hits; ///< Lookups satisfied from the cache
+    uint64_t misses; ///< Lookups that had to decode a segment
+} carchive_reader_t;
+
+/**
+ * @enum carchive_error_t
+ * @brief An enumerated list of return error codes.
+ */
+
+typedef enum {
+    CARCHIVE_ERR_NONE,
+    CARCHIVE_ERR_MEMORY,
+    CARCHIVE_ERR_IO,
+    CARCHIVE_ERR_NOINDEX,
+    CARCHIVE_ERR_CORRUPT,
+    CARCHIVE_ERR_NOTARCHIVE,
+    CARCHIVE_ERR_TOOBIG
+} carchive_error_t;
+
+const char       *carchive_strerror       (carchive_error_t a_errno);
+carchive_error_t  carchive_header_write    (const carchive_header_t *a_hdr, int a_fd, size_t *a_written);
+carchive_error_t  carchive_header_read    (carchive_header_t *a_hdr, int a_fd, size_t *a_read);
+size_t            carchive_segment_header_len (uint8_t a_file_scheme);
+carchive_error_t  carchive_index_init     (carchive_index_t *a_idx, uint8_t a_file_scheme);
+carchive_error_t  carchive_index_free     (carchive_index_t *a_idx);
+carchive_error_t  carchive_index_add      (carchive_index_t *a_idx, uint64_t a_offset, uint32_t a_total_compsize, uint32_t a_plain_len, uint8_t a_scheme);
+carchive_error_t  carchive_index_write    (carchive_index_t *a_idx, int a_fd, uint64_t a_offset, uint64_t *a_written);
+carchive_error_t  carchive_index_read     (carchive_index_t *a_idx, int a_fd, uint64_t a_file_len);
+carchive_error_t  carchive_index_scan     (carchive_index_t *a_idx, int a_fd, uint64_t a_offset, uint64_t a_end, uint64_t a_plain_len);
+carchive_error_t  carchive_trailer_encode (carchive_stream_trailer_t *a_trailer);
+carchive_error_t  carchive_trailer_decode (carchive_stream_trailer_t *a_trailer);
+carchive_error_t  carchive_trailer_read   (carchive_stream_trailer_t *a_trailer, int a_fd, uint64_t a_offset);
+uint64_t          carchive_segments_end   (carchive_index_t *a_idx, uint64_t a_segs_offset);
+carchive_error_t  carchive_open           (carchive_reader_t *a_rd, const char *a_path, uint32_t a_cache_segs);
+carchive_error_t  carchive_read           (carchive_reader_t *a_rd, void *a_buff, size_t a_len, uint64_t a_offset, size_t *a_read);
+carchive_error_t  carchive_close          (carchive_reader_t *a_rd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CARCHIVE_H
@@ -37,85 +37,176 @@
 
 const char *carith_error_string[] = {
     "none",
-    "memory allocation error"
+    "memory allocation error",
+    "bad shared frequency table",
+    "damaged segment"
 }; ///< List of standard carith error strings correlated to integer carith error codes.
 
+const char *carith_coder_string[] = {
+    "ac",
+    "ac32",
+    "ac32x4",
+    "rans",
+    "huff",
+    "adaptive",
+    "cm",
+    "rc",
+    "auto"
+}; ///< Names of the entropy coders, correlated to carith_coder_t
+
 static void freq_count(carith_comp_ctx *ctx, uint8_t *a_buff, size_t a_source_size)
 {
     size_t i;
     uint64_t base_tab = 0;
 
     for (i = 0; i < 256; ++i) {
-        ctx->freq[i].count_base = 0;
-        ctx->freq[i].count = 0;
+        ctx->freq.count_base[i] = 0;
+        ctx->freq.count[i] = 0;
     }
     for (i = 0; i < a_source_size; ++i) {
-        ctx->freq[a_buff[i]].count++;
+        ctx->freq.count[a_buff[i]]++;
     }
     for (i = 0; i < 256; ++i) {
-        ctx->freq[i].count_base = base_tab;
-        base_tab += ctx->freq[i].count;
+        ctx->freq.count_base[i] = base_tab;
+        base_tab += ctx->freq.count[i];
+    }
+}
+
+static void recip_init(carith_recip_t *a_recip, uint64_t a_divisor)
+{
+    a_recip->divisor = a_divisor;
+    if (a_divisor == 0) {
+        // nothing to divide by, recip_muldiv falls through to the real division
+        a_recip->shift = 0;
+        a_recip->d = 0;
+        a_recip->v = 0;
+        return;
     }
+    a_recip->shift = __builtin_clzll(a_divisor);
+    a_recip->d = a_divisor << a_recip->shift;
+    // the one real division, once per segment
+    a_recip->v = (uint64_t)(~(__uint128_t)0 / a_recip->d);
 }
 
-static void retrieve_range(carith_comp_ctx *ctx, uint8_t a_token, uint64_t *a_start, uint64_t *a_end, size_t a_source_size)
+static inline __uint128_t recip_muldiv(const carith_recip_t *a_recip, uint64_t a_count, uint64_t a_range)
+{
+    uint64_t l_u1, l_u0, l_q1, l_q0, l_r, l_mask;
+    __uint128_t l_num, l_q;
+
+    // a count past the divisor only comes from a damaged frequency table
+    if ((a_count > a_recip->divisor) || (a_recip->divisor == 0))
+        return ((__uint128_t)a_count * a_range) / a_recip->divisor;
+
+    // a_count fits the divisor, so shifting it instead of the product normalizes for free
+    l_num = (__uint128_t)(a_count << a_recip->shift) * a_range;
+    l_u1 = l_num >> 64;
+    l_u0 = (uint64_t)l_num;
+    l_q = (__uint128_t)a_recip->v * l_u1 + l_num;
+    l_q1 = (l_q >> 64) + 1;
+    l_q0 = (uint64_t)l_q;
+    l_r = l_u0 - l_q1 * a_recip->d;
+    // the first correction goes either way about half the time, so keep it branch free
+    l_mask = -(uint64_t)(l_r > l_q0);
+    l_q1 += l_mask;
+    l_r += l_mask & a_recip->d;
+    l_q1 += (l_r >= a_recip->d);
+    return l_q1;
+}
+
+static void retrieve_range(carith_comp_ctx *ctx, uint8_t a_token, uint64_t *a_start, uint64_t *a_end)
 {
     uint64_t l_rangesize = *a_end - *a_start;
     uint64_t l_start_orig = *a_start;
 
     //	printf("rr: passed %016lX %016lX ", *a_start, *a_end);
-    *a_start = (__uint128_t)l_start_orig + ((__uint128_t)ctx->freq[a_token].count_base * (__uint128_t)l_rangesize) / (__uint128_t)a_source_size;
-    *a_end = (__uint128_t)l_start_orig + ((((__uint128_t)ctx->freq[a_token].count_base + (__uint128_t)ctx->freq[a_token].count) * (__uint128_t)l_rangesize) / (__uint128_t)a_source_size) - 1;
-    //	printf("assigned token %02X - %ld/%ld/%ld  %016lX %016lX\n", a_token, ctx->freq[a_token].count_base, ctx->freq[a_token].count, ctx->plain_len, *a_start, *a_end);
+    *a_start = (__uint128_t)l_start_orig + recip_muldiv(&ctx->recip, ctx->freq.count_base[a_token], l_rangesize);
+    *a_end = (__uint128_t)l_start_orig + recip_muldiv(&ctx->recip, ctx->freq.count_base[a_token] + ctx->freq.count[a_token], l_rangesize) - 1;
+    //	printf("assigned token %02X - %ld/%ld/%ld  %016lX %016lX\n", a_token, ctx->freq.count_base[a_token], ctx->freq.count[a_token], ctx->plain_len, *a_start, *a_end);
 }
 
-static uint8_t token_for_window(carith_comp_ctx *ctx, uint64_t a_window, uint64_t a_start, uint64_t a_end, size_t a_source_size)
+static void build_decode_table(carith_comp_ctx *ctx)
 {
+    carith_decode_table_t *l_dt = &ctx->dec;
     size_t i;
-    uint64_t l_rangesize = a_end - a_start;
-    uint64_t l_windowpos = a_window - a_start;
-    uint64_t l_countpos = ((__uint128_t)l_windowpos * (__uint128_t)a_source_size) / (__uint128_t)l_rangesize;
-    //	printf("l_rangesize %016lX l_windowpos %016lX l_countpos %ld plain_len %ld   ", l_rangesize, l_windowpos, l_countpos, ctx->plain_len);
+    uint64_t l_total;
+    uint32_t l_bucket, l_last;
+
+    // present symbols only, in the order their ranges sit in
+    l_dt->count = 0;
     for (i = 0; i < 256; ++i) {
-        //			printf("i %ld %ld %ld\n", i, ctx->freq[i].count_base, ctx->freq[i].count_base + ctx->freq[i].count);
-        if ((l_countpos >= ctx->freq[i].count_base) && (l_countpos < ctx->freq[i].count_base + ctx->freq[i].count))
-            break;
+        if (ctx->freq.count[i] > 0) {
+            l_dt->sym[l_dt->count] = i;
+            l_dt->start[l_dt->count] = ctx->freq.count_base[i];
+            l_dt->count++;
+        }
+    }
+    l_total = (l_dt->count > 0) ? ctx->freq.count_base[l_dt->sym[l_dt->count - 1]] + ctx->freq.count[l_dt->sym[l_dt->count - 1]] : 0;
+    l_dt->start[l_dt->count] = l_total;
+
+    // smallest bucket size that fits the whole count range into the table
+    l_dt->shift = 0;
+    while ((l_total >> l_dt->shift) >= (1 << CARITH_DECODE_LUT_BITS))
+        l_dt->shift++;
+
+    // each bucket gets the first symbol whose range reaches into it
+    l_bucket = 0;
+    for (i = 0; i < l_dt->count; ++i) {
+        if (l_dt->start[i + 1] <= l_dt->start[i])
+            continue; // only a damaged table does this, leave it to token_for_window to notice
+        l_last = (l_dt->start[i + 1] - 1) >> l_dt->shift;
+        while (l_bucket <= l_last)
+            l_dt->lut[l_bucket++] = i;
     }
+}
+
+static inline size_t decode_lookup(carith_comp_ctx *ctx, uint64_t a_countpos)
+{
+    carith_decode_table_t *l_dt = &ctx->dec;
+    uint32_t k;
+
+    if (a_countpos >= l_dt->start[l_dt->count])
+        return 256; // past the end of the table, same as not finding it
+    k = l_dt->lut[a_countpos >> l_dt->shift];
+    while (a_countpos >= l_dt->start[k + 1])
+        ++k;
+    return l_dt->sym[k];
+}
+
+// on return a_start and a_end have been narrowed to the found token's range, saving the caller working it out again.
+// 256 means the window fits no token, which only a damaged segment does
+static size_t token_for_window(carith_comp_ctx *ctx, uint64_t a_window, uint64_t *a_start, uint64_t *a_end, uint64_t a_total)
+{
+    size_t i;
+    uint64_t l_rangesize = *a_end - *a_start;
+    uint64_t l_windowpos = a_window - *a_start;
+    if (l_rangesize == 0)
+        return 256;
+    uint64_t l_countpos = ((__uint128_t)l_windowpos * (__uint128_t)a_total) / (__uint128_t)l_rangesize;
+    //	printf("l_rangesize %016lX l_windowpos %016lX l_countpos %ld plain_len %ld   ", l_rangesize, l_windowpos, l_countpos, ctx->plain_len);
+    i = decode_lookup(ctx, l_countpos);
     // check it to make sure, due to inaccuracies
-    uint64_t l_start = a_start;
-    uint64_t l_end = a_end;
-    retrieve_range(ctx, i, &l_start, &l_end, a_source_size);
+    uint64_t l_start = *a_start;
+    uint64_t l_end = *a_end;
+    retrieve_range(ctx, i, &l_start, &l_end);
     //	printf("checking range for %02lX: %016lX %016lX\n", i, l_start, l_end);
     if (a_window > l_end) {
         ++l_countpos;
-        size_t j;
-        for (j = 0; j < 256; ++j) {
-            //			printf("i %ld %ld %ld\n", i, ctx->freq[i].count_base, ctx->freq[i].count_base + ctx->freq[i].count);
-            if ((l_countpos >= ctx->freq[j].count_base) && (l_countpos < ctx->freq[j].count_base + ctx->freq[j].count))
-                break;
-        }
+        size_t j = decode_lookup(ctx, l_countpos);
         //		printf("found substitute %02lx\n", j);
-        if (j == 256) {
-            // fatal error
-            fprintf(stderr, "token_for_window: exhausted frequency table, couldn't find count position!\n");
-            fprintf(stderr, "this should never, ever happen! Please send a screen capture of this to ssviatko@gmail.com!\n");
-            exit(EXIT_FAILURE);
-        }
-        l_start = a_start;
-        l_end = a_end;
-        retrieve_range(ctx, j, &l_start, &l_end, a_source_size);
+        if (j == 256)
+            return 256; // exhausted frequency table, couldn't find count position
+        l_start = *a_start;
+        l_end = *a_end;
+        retrieve_range(ctx, j, &l_start, &l_end);
         //		printf("j range for %02lX: %016lX %016lX\n", j, l_start, l_end);
-        if ((a_window < l_start) || (a_window > l_end)) {
-            // fatal error
-            fprintf(stderr, "token_for_window: j range for %02lX: %016lX %016lX a_window %016lX\n", j, l_start, l_end, a_window);
-            fprintf(stderr, "token_for_window: attempt to adjust range failed!\n");
-            fprintf(stderr, "this should never, ever happen! Please send a screen capture of this to ssviatko@gmail.com!\n");
-            exit(EXIT_FAILURE);
-        }
+        if ((a_window < l_start) || (a_window > l_end))
+            return 256; // attempt to adjust range failed
         i = j;
     }
     // i should equal the token we are looking for
     //	printf("discovered window %016lX conforms to %02lX\n", a_window, i);
+    *a_start = l_start;
+    *a_end = l_end;
     return i;
 }
 
@@ -132,6 +223,49 @@ const char *carith_strerror(carith_error_t a_errno)
     return carith_error_string[a_errno];
 }
 
+/**
+ * @brief Return the name of an entropy coder
+ */
+
+const char *carith_coder_name(carith_coder_t a_coder)
+{
+    if (a_coder > CARITH_CODER_AUTO)
+        return "unknown";
+    return carith_coder_string[a_coder];
+}
+
+// 4096 / (1 + e^-(a_d / 256)), interpolated from 33 points, kept within 1 to 4095
+static inline int cm_squash(int a_d)
+{
+    static const int l_t[33] = {
+        1, 2, 3, 6, 10, 16, 27, 45, 73, 120, 194, 310, 488, 747, 1101, 1546, 2047,
+        2549, 2994, 3348, 3607, 3785, 3901, 3975, 4022, 4050, 4068, 4079, 4085, 4089, 4092, 4093, 4094
+    };
+    int l_w;
+
+    if (a_d > 2047)
+        return 4095;
+    if (a_d < -2047)
+        return 1;
+    l_w = a_d & 127;
+    a_d = (a_d >> 7) + 16;
+    return (l_t[a_d] * (128 - l_w) + l_t[a_d + 1] * l_w + 64) >> 7;
+}
+
+static void cm_init_stretch(carith_cm_t *a_cm)
+{
+    int x, i, l_prev = 0, l_v;
+
+    for (x = -2047; x <= 2047; ++x) {
+        l_v = cm_squash(x);
+        for (i = l_prev; i <= l_v; ++i)
+            a_cm->stretch[i] = x;
+        l_prev = l_v + 1;
+    }
+    for (i = l_prev; i < 4096; ++i)
+        a_cm->stretch[i] = 2047;
+}
+
 /**
  * @brief Initialize a carith context
  * Must be called before any other operations are attempted. This function
@@ -143,28 +277,34 @@ const char *carith_strerror(carith_error_t a_errno)
 
 carith_error_t carith_init_ctx(carith_comp_ctx *ctx, size_t a_worksize)
 {
-    ctx->plain = NULL;
-    ctx->plain = malloc(LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2));
-    if (ctx->plain == NULL) {
+    ctx->plain_buf = NULL;
+    ctx->plain_buf = malloc(LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2));
+    if (ctx->plain_buf == NULL) {
         return CARITH_ERR_MEMORY;
     }
+    ctx->plain = ctx->plain_buf;
+    ctx->coder = CARITH_CODER_AC;
+    ctx->auto_slack = CARITH_AUTO_SLACK;
+    ctx->shared_set = 0;
+    ctx->table_ref = 0;
     ctx->rleenc = NULL;
     ctx->rleenc = malloc(LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2)); // plain guard size 150%
     if (ctx->rleenc == NULL) {
-        free(ctx->plain);
+        free(ctx->plain_buf);
         return CARITH_ERR_MEMORY;
     }
     ctx->rledec = NULL;
     ctx->rledec = malloc(LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2)); // plain guard size 150%
     if (ctx->rledec == NULL) {
-        free(ctx->plain);
+        free(ctx->plain_buf);
         free(ctx->rleenc);
         return CARITH_ERR_MEMORY;
     }
     ctx->comp = NULL;
-    ctx->comp = malloc(LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2)); // comp guard size 150%
+    ctx->comp_size = LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2);
+    ctx->comp = malloc(ctx->comp_size); // comp guard size 150%
     if (ctx->comp == NULL) {
-        free(ctx->plain);
+        free(ctx->plain_buf);
         free(ctx->rleenc);
         free(ctx->rledec);
         return CARITH_ERR_MEMORY;
@@ -172,7 +312,7 @@ carith_error_t carith_init_ctx(carith_comp_ctx *ctx, size_t a_worksize)
     ctx->decomp = NULL;
     ctx->decomp = malloc(LZSS_WINDOW_SIZE + (a_worksize * 3 / 2));
     if (ctx->decomp == NULL) {
-        free(ctx->plain);
+        free(ctx->plain_buf);
         free(ctx->rleenc);
         free(ctx->rledec);
         free(ctx->comp);
@@ -182,7 +322,7 @@ carith_error_t carith_init_ctx(carith_comp_ctx *ctx, size_t a_worksize)
     ctx->lzssenc = NULL;
     ctx->lzssenc = malloc(LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2));
     if (ctx->lzssenc == NULL) {
-        free(ctx->plain);
+        free(ctx->plain_buf);
         free(ctx->rleenc);
         free(ctx->rledec);
         free(ctx->comp);
@@ -192,7 +332,7 @@ carith_error_t carith_init_ctx(carith_comp_ctx *ctx, size_t a_worksize)
     ctx->lzssdec = NULL;
     ctx->lzssdec = malloc(LZSS32_WINDOW_SIZE + (a_worksize * 3 / 2));
     if (ctx->lzssdec == NULL) {
-        free(ctx->plain);
+        free(ctx->plain_buf);
         free(ctx->rleenc);
         free(ctx->rledec);
         free(ctx->comp);
@@ -201,6 +341,20 @@ carith_error_t carith_init_ctx(carith_comp_ctx *ctx, size_t a_worksize)
         return CARITH_ERR_MEMORY;
     }
 
+    ctx->cm = NULL;
+    ctx->cm = malloc(sizeof(carith_cm_t));
+    if (ctx->cm == NULL) {
+        free(ctx->plain_buf);
+        free(ctx->rleenc);
+        free(ctx->rledec);
+        free(ctx->comp);
+        free(ctx->decomp);
+        free(ctx->lzssenc);
+        free(ctx->lzssdec);
+        return CARITH_ERR_MEMORY;
+    }
+    cm_init_stretch(ctx->cm);
+
     // init our LZSS contexts
     lzss4_error_t err;
     err = lzss4_init_context(&ctx->lzss4_context, a_worksize);
@@ -224,16 +378,251 @@ carith_error_t carith_free_ctx(carith_comp_ctx *ctx)
 {
     lzss4_free_context(&ctx->lzss4_context);
     lzss32_free_context(&ctx->lzss32_context);
-    free(ctx->plain);
+    free(ctx->plain_buf);
     free(ctx->rleenc);
     free(ctx->rledec);
     free(ctx->comp);
     free(ctx->decomp);
     free(ctx->lzssenc);
     free(ctx->lzssdec);
+    free(ctx->cm);
     return CARITH_ERR_NONE;
 }
 
+// Exp-Golomb, order a_k: (a_v >> a_k) + 1 in binary behind one less zero than it has bits,
+// then the low a_k bits of a_v. Values are under 2^32
+static inline int eg_bits(uint64_t a_v, int a_k)
+{
+    return 2 * (64 - __builtin_clzll((a_v >> a_k) + 1)) - 1 + a_k;
+}
+
+static inline void eg_put(cbit_cursor_t *a_cb, uint64_t a_v, int a_k)
+{
+    uint64_t l_q = (a_v >> a_k) + 1;
+    int l_w = 64 - __builtin_clzll(l_q);
+
+    cbit_write_many(a_cb, 0, l_w - 1);
+    cbit_write_many(a_cb, l_q, l_w);
+    cbit_write_many(a_cb, a_v, a_k);
+}
+
+static inline uint64_t eg_get(cbit_cursor_t *a_cb, int a_k)
+{
+    int l_w = 1;
+    uint64_t l_q;
+
+    while ((cbit_read(a_cb) == 0) && (l_w < 33))
+        ++l_w; // a damaged table mustn't keep us here, or shift past 64 bits
+    l_q = (1ULL << (l_w - 1)) | cbit_read_many(a_cb, l_w - 1);
+    return ((l_q - 1) << a_k) | cbit_read_many(a_cb, a_k);
+}
+
+// the order, 0 to 15, that codes a_v in the fewest bits, and how many that is
+static size_t eg_best(const uint64_t *a_v, size_t a_n, int *a_k)
+{
+    size_t i, l_bits, l_best_bits = SIZE_MAX;
+    int k;
+
+    *a_k = 0;
+    for (k = 0; k < 16; ++k) {
+        l_bits = 0;
+        for (i = 0; i < a_n; ++i)
+            l_bits += eg_bits(a_v[i], k);
+        if (l_bits < l_best_bits) {
+            l_best_bits = l_bits;
+            *a_k = k;
+        }
+    }
+    return l_best_bits;
+}
+
+// write ctx->freq.count out as whichever of the enumerated, full or compact tables is smallest.
+// a compact table is marked as an enumerated one with a countwidth of 0, which can't otherwise
+// happen. It has a precision, then a bitmap of the groups of 8 symbols with anything present, a
+// bitmap of the symbols present in each of those, the Exp-Golomb order, and every present
+// symbol's count less one. A precision of 0 means the counts are exact, otherwise they total
+// 2^precision and the last one is left for the reader to work out
+static void freq_table_write(carith_comp_ctx *ctx, uint8_t *a_out, uint16_t *a_out_len)
+{
+    uint64_t l_vals[256];
+    uint64_t l_total = 0, countmax = 0;
+    uint32_t l_groups = 0;
+    size_t i, l_entries = 0, l_nvals;
+    size_t l_enum_bits = SIZE_MAX, l_full_bits = SIZE_MAX, l_compact_bits;
+    int l_prec = 0, l_k, countwidth;
+    cbit_cursor_t bc = { 0, 7, a_out, 0 };
+
+    for (i = 0; i < 256; ++i) {
+        if (ctx->freq.count[i] == 0)
+            continue;
+        l_groups |= 0x80000000U >> (i >> 3);
+        l_vals[l_entries++] = ctx->freq.count[i] - 1;
+        l_total += ctx->freq.count[i];
+        if (ctx->freq.count[i] > countmax)
+            countmax = ctx->freq.count[i];
+    }
+    countwidth = (countmax > 0) ? 64 - __builtin_clzll(countmax) : 0;
+    l_nvals = l_entries;
+    if ((l_total > 1) && ((l_total & (l_total - 1)) == 0)) {
+        l_prec = __builtin_ctzll(l_total);
+        l_nvals--;
+    }
+    l_compact_bits = 1 + 5 + 5 + 32 + 8 * __builtin_popcount(l_groups) + 4 + eg_best(l_vals, l_nvals, &l_k);
+    if (countwidth > 0) {
+        l_enum_bits = 1 + 5 + 9 + l_entries * (8 + countwidth);
+        l_full_bits = 1 + 5 + 256 * countwidth;
+    }
+
+    if ((l_compact_bits < l_enum_bits) && (l_compact_bits < l_full_bits)) {
+        cbit_write(&bc, 1);
+        cbit_write_many(&bc, 0, 5);
+        cbit_write_many(&bc, l_prec, 5);
+        cbit_write_many(&bc, l_groups, 32);
+        for (i = 0; i < 256; i += 8) {
+            if ((l_groups & (0x80000000U >> (i >> 3))) == 0)
+                continue;
+            uint8_t l_mask = 0;
+            size_t j;
+            for (j = 0; j < 8; ++j)
+                l_mask |= (ctx->freq.count[i + j] > 0) << (7 - j);
+            cbit_write_many(&bc, l_mask, 8);
+        }
+        cbit_write_many(&bc, l_k, 4);
+        for (i = 0; i < l_nvals; ++i)
+            eg_put(&bc, l_vals[i], l_k);
+    } else if (l_enum_bits < l_full_bits) {
+        cbit_write(&bc, 1); // first bit true indicates it's enumerated
+        cbit_write_many(&bc, countwidth, 5); // value 1-31 for countwidth
+        cbit_write_many(&bc, l_entries, 9); // 0-256 number of active symbols
+        for (i = 0; i < 256; ++i) {
+            if (ctx->freq.count[i] > 0) {
+                cbit_write_many(&bc, i, 8);
+                cbit_write_many(&bc, ctx->freq.count[i], countwidth);
+            }
+        }
+    } else {
+        cbit_write(&bc, 0); // first bit false indicates it's full
+        cbit_write_many(&bc, countwidth, 5);
+        for (i = 0; i < 256; ++i)
+            cbit_write_many(&bc, ctx->freq.count[i], countwidth);
+    }
+    *a_out_len = cbit_pad(&bc);
+}
+
+// the reader's side of a compact table. Every present symbol comes back with a count of at
+// least 1, however damaged the table is, and the totals check after us catches the damage
+static uint64_t freq_compact_read(carith_comp_ctx *ctx, cbit_cursor_t *a_cb)
+{
+    uint8_t l_syms[256];
+    uint64_t l_base = 0, l_count, l_total;
+    uint32_t l_groups;
+    size_t i, j, l_n = 0;
+    int l_prec, l_k;
+
+    l_prec = cbit_read_many(a_cb, 5);
+    l_total = 1ULL << l_prec;
+    l_groups = cbit_read_many(a_cb, 32);
+    for (i = 0; i < 256; i += 8) {
+        if ((l_groups & (0x80000000U >> (i >> 3))) == 0)
+            continue;
+        uint8_t l_mask = cbit_read_many(a_cb, 8);
+        for (j = 0; j < 8; ++j) {
+            if (l_mask & (0x80 >> j))
+                l_syms[l_n++] = i + j;
+        }
+    }
+    l_k = cbit_read_many(a_cb, 4);
+    for (i = 0, j = 0; i < 256; ++i) {
+        ctx->freq.count_base[i] = l_base;
+        if ((j >= l_n) || (l_syms[j] != i))
+            continue;
+        if ((l_prec > 0) && (j == l_n - 1))
+            l_count = (l_base < l_total) ? l_total - l_base : 1;
+        else
+            l_count = eg_get(a_cb, l_k) + 1;
+        ctx->freq.count[i] = l_count;
+        l_base += l_count;
+        ++j;
+    }
+    return l_base;
+}
+
+// read a table written by freq_table_write back into ctx->freq, returning the total of its counts
+static uint64_t freq_table_read(carith_comp_ctx *ctx, uint8_t *a_in)
+{
+    cbit_cursor_t bc = { 0, 7, a_in, sizeof(ctx->freq_comp) - 1 };
+    size_t i;
+    int countwidth;
+    uint16_t ftbl_enum_entries;
+
+    // obliterate frequency table
+    for (i = 0; i < 256; ++i) {
+        ctx->freq.count[i] = 0;
+        ctx->freq.count_base[i] = 0;
+    }
+
+    // read compressed frequency table, never further than freq_comp goes
+    uint64_t base_tab = 0;
+    int ftbl_type = cbit_read(&bc);
+    countwidth = cbit_read_many(&bc, 5);
+    if ((ftbl_type == 1) && (countwidth == 0)) {
+        base_tab = freq_compact_read(ctx, &bc);
+    } else if (ftbl_type == 1) {
+        ftbl_enum_entries = cbit_read_many(&bc, 9);
+        for (i = 0; i < ftbl_enum_entries; ++i) {
+            uint8_t symbol = cbit_read_many(&bc, 8);
+            uint64_t symbol_count = cbit_read_many(&bc, countwidth);
+            ctx->freq.count_base[symbol] = base_tab;
+            ctx->freq.count[symbol] = symbol_count;
+            base_tab += symbol_count;
+        }
+    } else {
+        for (i = 0; i < 256; ++i) {
+            ctx->freq.count_base[i] = base_tab;
+            uint64_t symbol_count = cbit_read_many(&bc, countwidth);
+            ctx->freq.count[i] = symbol_count;
+            base_tab += symbol_count;
+        }
+    }
+    return base_tab;
+}
+
+// scale ctx->freq.count from a_total down (or up) to total exactly 2^a_bits,
+// keeping every symbol that occurs at a count of at least 1
+static void freq_normalize(carith_comp_ctx *ctx, uint64_t a_total, int a_bits)
+{
+    const uint64_t l_target = 1 << a_bits;
+    uint64_t l_sum = 0, l_base = 0;
+    size_t i, l_max = 0;
+
+    for (i = 0; i < 256; ++i) {
+        if (ctx->freq.count[i] == 0)
+            continue;
+        ctx->freq.count[i] = (ctx->freq.count[i] * l_target) / a_total;
+        if (ctx->freq.count[i] == 0)
+            ctx->freq.count[i] = 1;
+        l_sum += ctx->freq.count[i];
+        if (ctx->freq.count[i] > ctx->freq.count[l_max])
+            l_max = i;
+    }
+    // rounding down leaves us short, give it to the most frequent symbol
+    if (l_sum < l_target)
+        ctx->freq.count[l_max] += l_target - l_sum;
+    // the symbols bumped up to 1 can leave us over, take it back from whoever can spare it
+    while (l_sum > l_target) {
+        for (i = 0; (i < 256) && (l_sum > l_target); ++i) {
+            if (ctx->freq.count[i] > 1) {
+                ctx->freq.count[i]--;
+                l_sum--;
+            }
+        }
+    }
+    for (i = 0; i < 256; ++i) {
+        ctx->freq.count_base[i] = l_base;
+        l_base += ctx->freq.count[i];
+    }
+}
+
 static void compress_ac(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
 {
     size_t plain_ptr;
@@ -242,8 +631,15 @@ static void compress_ac(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
     uint8_t range_lo_hibyte, range_hi_hibyte; // bits 56-63 of the range
     size_t comp_ptr = 0;
     size_t i;
+    uint64_t l_total = a_in_len;
 
     freq_count(ctx, a_in, a_in_len);
+    // exact counts cost a lot of table for a long segment and buy almost nothing over scaled ones
+    if (a_in_len > (1 << CARITH_QUANT_BITS)) {
+        freq_normalize(ctx, a_in_len, CARITH_QUANT_BITS);
+        l_total = 1 << CARITH_QUANT_BITS;
+    }
+    recip_init(&ctx->recip, l_total);
 
     range_lo = 0;
     range_hi = ULLONG_MAX;
@@ -255,7 +651,7 @@ static void compress_ac(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
         cur_byte = a_in[plain_ptr];
         //		range_lo = ctx->freq[cur_byte].range_start;
         //		range_hi = ctx->freq[cur_byte].range_end;
-        retrieve_range(ctx, cur_byte, &range_lo, &range_hi, a_in_len);
+        retrieve_range(ctx, cur_byte, &range_lo, &range_hi);
         //		printf("pos %ld read %02X new range_lo %010lX range_hi %010lX\n", plain_ptr, cur_byte, range_lo, range_hi);
         range_lo_hibyte = (range_lo >> 56);
         range_hi_hibyte = (range_hi >> 56);
@@ -308,219 +704,1395 @@ static void compress_ac(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
         }
         //		assign_ranges(ctx, range_lo, range_hi);
     }
-    // output rest of range_lo in case decompressor needs it
-    for (i = 0; i < 8; ++i) {
-        range_lo_hibyte = (range_lo >> 56) & 0xff;
-        //		printf("comp pos %ld outputting final 5-byte word %02X\n", comp_ptr, range_lo_hibyte);
-        ctx->comp[comp_ptr++] = range_lo_hibyte;
-        range_lo <<= 8;
+    // output rest of range_lo in case decompressor needs it
+    for (i = 0; i < 8; ++i) {
+        range_lo_hibyte = (range_lo >> 56) & 0xff;
+        //		printf("comp pos %ld outputting final 5-byte word %02X\n", comp_ptr, range_lo_hibyte);
+        ctx->comp[comp_ptr++] = range_lo_hibyte;
+        // underflow bytes still pending belong right after the high byte, and we're on the low side
+        if (i == 0) {
+            while (underflow_ctr > 0) {
+                ctx->comp[comp_ptr++] = 0xff;
+                underflow_ctr--;
+            }
+        }
+        range_lo <<= 8;
+    }
+    ctx->comp_len = comp_ptr;
+
+    //    printf("process: compressed %ld bytes into %ld.\n", ctx->plain_len, ctx->comp_len);
+
+    freq_table_write(ctx, ctx->freq_comp, &ctx->freq_comp_len);
+}
+
+// a damaged stream mustn't walk us off the end of comp, read zeroes instead
+static inline uint8_t ac_next_byte(carith_comp_ctx *ctx, size_t *a_comp_ptr)
+{
+    return (*a_comp_ptr < ctx->comp_len) ? ctx->comp[(*a_comp_ptr)++] : 0;
+}
+
+static carith_error_t extract_ac(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    uint64_t range_lo, range_hi;
+    uint8_t range_lo_hibyte, range_hi_hibyte; // bits 32-40 of the range
+    size_t comp_ptr, decomp_ptr;
+    size_t i;
+    uint64_t window;
+    uint64_t l_total;
+//    uint8_t underflow_lo = 0;
+//    uint8_t underflow_hi = 0;
+
+    *a_out_len = 0;
+    if (a_source_size == 0)
+        return CARITH_ERR_NONE;
+    // the counts total the segment length, or 2^CARITH_QUANT_BITS if they were scaled. Original
+    // format files never scaled them, whatever the segment length
+    l_total = freq_table_read(ctx, ctx->freq_comp);
+    if ((l_total != a_source_size) && ((a_source_size <= (1 << CARITH_QUANT_BITS)) || (l_total != (1 << CARITH_QUANT_BITS))))
+        return CARITH_ERR_DAMAGED;
+
+    build_decode_table(ctx);
+    recip_init(&ctx->recip, l_total);
+
+    // change decomp to plain once this is debugged and tested
+    range_lo = 0;
+    range_hi = ULLONG_MAX;
+    //	assign_ranges(ctx, range_lo, range_hi);
+    comp_ptr = 0;
+    decomp_ptr = 0;
+    // prime the pump
+    window = 0;
+    for (i = 0; i < 8; ++i) {
+        window <<= 8;
+        window |= ac_next_byte(ctx, &comp_ptr);
+    }
+
+    while (1) {
+        //		assign_ranges(ctx, range_lo, range_hi);
+        //		found = 0; // keep track of whether or not we found the range. If we didn't find the range, this is a fatal error!
+        //		printf("comp_ptr %ld decomp_ptr %ld\n", comp_ptr, decomp_ptr);
+        // find which range window falls between
+        //		uint64_t l_rangesize = range_hi - range_lo;
+        //		uint64_t l_windowpos = window - range_lo;
+        //		uint64_t l_countpos = ((__uint128_t)l_windowpos * (__uint128_t)ctx->plain_len) / (__uint128_t)l_rangesize;
+        //		printf("l_rangesize %016lX l_windowpos %016lX l_countpos %ld plain_len %ld\n", l_rangesize, l_windowpos, (uint64_t)l_countpos, ctx->plain_len);
+        //		for (i = 0; i < 256; ++i) {
+        //			printf("i %ld %ld %ld\n", i, ctx->freq.count_base[i], ctx->freq.count_base[i] + ctx->freq.count[i]);
+        //			if ((l_countpos >= ctx->freq.count_base[i]) && (l_countpos < ctx->freq.count_base[i] + ctx->freq.count[i]))
+        //				break;
+        //		}
+        i = token_for_window(ctx, window, &range_lo, &range_hi, l_total);
+        if (i == 256)
+            return CARITH_ERR_DAMAGED;
+        // i should equal the token we are looking for
+        //		printf("discovered window %016lX conforms to %02lX\n", window, i);
+        //		printf("%ld\n", i);
+        // output i to decomp stream
+        //		printf("decomp_ptr %ld outputting %02lX\n", decomp_ptr, i);
+        a_out[decomp_ptr++] = i;
+        //		printf("new range %016lX %016lX\n", range_lo, range_hi);
+        //		found = 1;
+        //		range_lo = ctx->freq[i].range_start;
+        //		range_hi = ctx->freq[i].range_end;
+        range_lo_hibyte = (range_lo >> 56);
+        range_hi_hibyte = (range_hi >> 56);
+        // underflow detection
+        if ((range_hi_hibyte - range_lo_hibyte) == 1) {
+//            underflow_lo = range_lo_hibyte;
+//            underflow_hi = range_hi_hibyte;
+            uint8_t range_lo_2ndbyte = (range_lo >> 48) & 0xff;
+            uint8_t range_hi_2ndbyte = (range_hi >> 48) & 0xff;
+            if ((range_lo_2ndbyte == 0xff) && (range_hi_2ndbyte == 0x00)) {
+//                printf("underflow detected: %02X/%02X win %016lX\n", underflow_lo, underflow_hi, window);
+                // save the high byte of the ranges and the window
+                uint64_t range_lo_savetop = range_lo & 0xff00000000000000;
+                uint64_t range_hi_savetop = range_hi & 0xff00000000000000;
+                uint64_t window_savetop   =   window & 0xff00000000000000;
+                // slide everything over by one byte
+                range_lo <<= 8;
+                range_hi <<= 8;
+                window <<= 8;
+                // fix up the low byte: range_lo gets zeros courtesy of the shift, range_hi gets 0xff, window gets the next byte from the token stream
+                range_hi |= 0xff;
+                window |= ac_next_byte(ctx, &comp_ptr);
+                // mask off high byte and stick the saved top byte back on
+                range_lo &= 0x00ffffffffffffff;
+                range_lo |= range_lo_savetop;
+                range_hi &= 0x00ffffffffffffff;
+                range_hi |= range_hi_savetop;
+                window &=   0x00ffffffffffffff;
+                window |= window_savetop;
+            }
+        }
+        while (range_lo_hibyte == range_hi_hibyte) {
+            //			printf("hibyte equivalency %02X range_lo %010lX range_hi %010lx\n", range_lo_hibyte, range_lo, range_hi);
+            // scoot our ranges over by 8 bits
+            range_lo <<= 8;
+            range_hi <<= 8;
+            range_hi |= 0xff;
+            // slide our window over and read next compressed byte into the low position
+            window <<= 8;
+            window |= ac_next_byte(ctx, &comp_ptr);
+            // refresh our hibyte values for the next test at top of loop
+            range_lo_hibyte = (range_lo >> 56);
+            range_hi_hibyte = (range_hi >> 56);
+            //			printf("scoot     %016lX %016lX\n", range_lo, range_hi);
+        }
+        //			assign_ranges(ctx, range_lo, range_hi);
+        //		if (found == 0) {
+        //			printf("range not found! %010lX\n", window);
+        //			exit(EXIT_FAILURE);
+        //		}
+        if (decomp_ptr >= a_source_size)
+            break;
+    }
+    *a_out_len = decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+#define AC32_TOP (1U << 24) ///< Bytes go out once the top byte of low is settled
+#define AC32_BOT (1U << CARITH_NORM_BITS) ///< Smallest range allowed, so range >> CARITH_NORM_BITS never reaches zero
+#define AC32X_STATES 4 ///< Coders CARITH_CODER_AC32X interleaves
+
+/**
+ * @struct ac32_state_t
+ * @brief One 32-bit range coder, encoding into or decoding from its own stream
+ */
+
+typedef struct {
+    uint32_t low;
+    uint32_t range;
+    uint32_t code;     ///< Decoder only, the window of stream bytes
+    uint8_t *buf;      ///< Stream this coder writes or reads
+    size_t pos;        ///< Next byte in buf
+    size_t end;        ///< Decoder only, end of this coder's stream
+} ac32_state_t;
+
+static inline void ac32_encode_init(ac32_state_t *a_st, uint8_t *a_buf)
+{
+    a_st->low = 0;
+    a_st->range = UINT32_MAX;
+    a_st->buf = a_buf;
+    a_st->pos = 0;
+}
+
+// carryless: once the top byte can't change it goes out, and if the range gets
+// too small before that happens it's cut off at the next BOT boundary
+static inline void ac32_encode_renorm(ac32_state_t *a_st)
+{
+    while (((a_st->low ^ (a_st->low + a_st->range)) < AC32_TOP) || ((a_st->range < AC32_BOT) && ((a_st->range = -a_st->low & (AC32_BOT - 1)), 1))) {
+        a_st->buf[a_st->pos++] = a_st->low >> 24;
+        a_st->low <<= 8;
+        a_st->range <<= 8;
+    }
+}
+
+static inline void ac32_encode_symbol(carith_comp_ctx *ctx, ac32_state_t *a_st, uint8_t a_sym)
+{
+    // totals are a power of two, so subdividing the range is a shift and a multiply
+    a_st->range >>= CARITH_NORM_BITS;
+    a_st->low += (uint32_t)ctx->freq.count_base[a_sym] * a_st->range;
+    a_st->range *= (uint32_t)ctx->freq.count[a_sym];
+    ac32_encode_renorm(a_st);
+}
+
+static inline void ac32_encode_flush(ac32_state_t *a_st)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        a_st->buf[a_st->pos++] = a_st->low >> 24;
+        a_st->low <<= 8;
+    }
+}
+
+// a damaged stream mustn't walk us off the end of it, read zeroes instead
+static inline uint8_t ac32_next_byte(ac32_state_t *a_st)
+{
+    return (a_st->pos < a_st->end) ? a_st->buf[a_st->pos++] : 0;
+}
+
+static inline void ac32_decode_init(ac32_state_t *a_st, uint8_t *a_buf, size_t a_len)
+{
+    int i;
+
+    a_st->low = 0;
+    a_st->range = UINT32_MAX;
+    a_st->code = 0;
+    a_st->buf = a_buf;
+    a_st->pos = 0;
+    a_st->end = a_len;
+    for (i = 0; i < 4; ++i)
+        a_st->code = (a_st->code << 8) | ac32_next_byte(a_st);
+}
+
+// the decoder's side of ac32_encode_renorm, pulling in a byte for every one the encoder put out
+static inline void ac32_decode_renorm(ac32_state_t *a_st)
+{
+    while (((a_st->low ^ (a_st->low + a_st->range)) < AC32_TOP) || ((a_st->range < AC32_BOT) && ((a_st->range = -a_st->low & (AC32_BOT - 1)), 1))) {
+        a_st->code = (a_st->code << 8) | ac32_next_byte(a_st);
+        a_st->low <<= 8;
+        a_st->range <<= 8;
+    }
+}
+
+static inline uint8_t ac32_decode_symbol(const carith_decode_table_t *a_dt, ac32_state_t *a_st)
+{
+    uint32_t l_countpos, k;
+
+    a_st->range >>= CARITH_NORM_BITS;
+    l_countpos = (a_st->code - a_st->low) / a_st->range;
+    if (l_countpos >= (1 << CARITH_NORM_BITS))
+        l_countpos = (1 << CARITH_NORM_BITS) - 1; // damaged, the segment CRC will catch it
+    k = a_dt->lut[l_countpos >> a_dt->shift];
+    while (l_countpos >= a_dt->start[k + 1])
+        ++k;
+    a_st->low += (uint32_t)a_dt->start[k] * a_st->range;
+    a_st->range *= (uint32_t)(a_dt->start[k + 1] - a_dt->start[k]);
+    ac32_decode_renorm(a_st);
+    return a_dt->sym[k];
+}
+
+#define TABLE_OWN 0    ///< Segment sends its own table
+#define TABLE_SHARED 1 ///< Segment codes with the shared table as is
+#define TABLE_DELTA 2  ///< Segment sends its own table as differences from the shared one
+
+// log2(a_x) in 8.8 fixed point, linear between powers of two, which is plenty to compare table costs with
+static inline uint32_t log2_fix(uint64_t a_x)
+{
+    int l_bits = 63 - __builtin_clzll(a_x);
+
+    return (l_bits << 8) | ((uint32_t)((a_x << 8) >> l_bits) & 0xff);
+}
+
+// roughly how many bits (8.8 fixed point) coding a histogram with a table of a_q costs
+static uint64_t table_cost(const uint64_t *a_hist, const uint64_t *a_q)
+{
+    uint64_t l_cost = 0;
+    size_t i;
+
+    for (i = 0; i < 256; ++i) {
+        if (a_hist[i] > 0)
+            l_cost += a_hist[i] * ((CARITH_NORM_BITS << 8) - log2_fix(a_q[i]));
+    }
+    return l_cost;
+}
+
+// ctx->freq.count as differences from the shared table: a 1 bit, the Exp-Golomb
+// order in 4 bits, then each symbol's difference zigzagged and Exp-Golomb coded
+static uint16_t freq_delta_write(carith_comp_ctx *ctx, uint8_t *a_out)
+{
+    uint64_t l_zz[256];
+    size_t i, l_bits;
+    int l_k;
+    cbit_cursor_t bc = { 0, 7, a_out, 0 };
+
+    for (i = 0; i < 256; ++i) {
+        int64_t l_d = (int64_t)ctx->freq.count[i] - (int64_t)ctx->shared[i];
+        l_zz[i] = (l_d < 0) ? ((uint64_t)(-l_d) << 1) - 1 : (uint64_t)l_d << 1;
+    }
+    l_bits = eg_best(l_zz, 256, &l_k);
+    // it has to fit after the coder byte in freq_comp
+    if ((l_bits + 5 + 7) / 8 > sizeof(ctx->freq_comp) - 1)
+        return UINT16_MAX;
+
+    cbit_write(&bc, 1);
+    cbit_write_many(&bc, l_k, 4);
+    for (i = 0; i < 256; ++i)
+        eg_put(&bc, l_zz[i], l_k);
+    return cbit_pad(&bc);
+}
+
+// histogram a_in and scale it for the 32-bit coders. If there's a shared table,
+// work out whether using it as is, or sending only differences from it, beats
+// sending our own table
+static void ac32_prepare_table(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    uint64_t l_hist[256], l_shared[256];
+    uint8_t l_scratch[CARITH_SHARED_TABLE_MAX];
+    uint64_t l_own_cost, l_shared_cost, l_base = 0;
+    uint16_t l_own_len, l_delta_len;
+    size_t i;
+
+    ctx->table_ref = TABLE_OWN;
+    freq_count(ctx, a_in, a_in_len);
+    if (a_in_len == 0)
+        return;
+    memcpy(l_hist, ctx->freq.count, sizeof(l_hist));
+    freq_normalize(ctx, a_in_len, CARITH_NORM_BITS);
+    if (!ctx->shared_set)
+        return;
+
+    freq_table_write(ctx, l_scratch, &l_own_len);
+    l_delta_len = freq_delta_write(ctx, l_scratch);
+    if (l_delta_len < l_own_len) {
+        ctx->table_ref = TABLE_DELTA;
+        l_own_len = l_delta_len;
+    }
+    // table bytes are 8 bits, 2^11 in 8.8
+    l_own_cost = table_cost(l_hist, ctx->freq.count) + ((uint64_t)l_own_len << 11);
+    for (i = 0; i < 256; ++i)
+        l_shared[i] = ctx->shared[i];
+    l_shared_cost = table_cost(l_hist, l_shared) + (1 << 11);
+    if (l_shared_cost < l_own_cost) {
+        ctx->table_ref = TABLE_SHARED;
+        for (i = 0; i < 256; ++i) {
+            ctx->freq.count[i] = ctx->shared[i];
+            ctx->freq.count_base[i] = l_base;
+            l_base += ctx->shared[i];
+        }
+    }
+}
+
+static void ac32_write_table(carith_comp_ctx *ctx, carith_coder_t a_coder)
+{
+    uint16_t l_table_len;
+
+    switch (ctx->table_ref) {
+    case TABLE_SHARED:
+        // a lone 0 bit, take the shared table as it is
+        ctx->freq_comp[0] = a_coder | CARITH_CODER_SHARED;
+        ctx->freq_comp[1] = 0;
+        ctx->freq_comp_len = 2;
+        break;
+    case TABLE_DELTA:
+        ctx->freq_comp[0] = a_coder | CARITH_CODER_SHARED;
+        l_table_len = freq_delta_write(ctx, ctx->freq_comp + 1);
+        ctx->freq_comp_len = l_table_len + 1;
+        break;
+    default:
+        ctx->freq_comp[0] = a_coder;
+        freq_table_write(ctx, ctx->freq_comp + 1, &l_table_len);
+        ctx->freq_comp_len = l_table_len + 1;
+        break;
+    }
+}
+
+// the decoder's side of ac32_write_table's TABLE_SHARED and TABLE_DELTA. A segment
+// that refers to a shared table the file doesn't have gets a total of 0
+static uint64_t freq_shared_read(carith_comp_ctx *ctx, uint8_t *a_in)
+{
+    cbit_cursor_t bc = { 0, 7, a_in, sizeof(ctx->freq_comp) - 1 };
+    uint64_t l_base = 0, l_zz;
+    size_t i;
+    int l_k = 0;
+
+    if (!ctx->shared_set)
+        return 0;
+    int l_delta = cbit_read(&bc);
+    if (l_delta)
+        l_k = cbit_read_many(&bc, 4);
+    for (i = 0; i < 256; ++i) {
+        int64_t l_count = ctx->shared[i];
+        if (l_delta) {
+            l_zz = eg_get(&bc, l_k);
+            l_count += (l_zz & 1) ? -(int64_t)((l_zz + 1) >> 1) : (int64_t)(l_zz >> 1);
+            if ((l_count < 0) || (l_count > (1 << CARITH_NORM_BITS)))
+                l_count = 0; // damaged, the total check will catch it
+        }
+        ctx->freq.count_base[i] = l_base;
+        ctx->freq.count[i] = l_count;
+        l_base += l_count;
+    }
+    return l_base;
+}
+
+static carith_error_t ac32_read_table(carith_comp_ctx *ctx, size_t a_source_size)
+{
+    uint64_t l_total;
+
+    if (ctx->freq_comp[0] & CARITH_CODER_SHARED)
+        l_total = freq_shared_read(ctx, ctx->freq_comp + 1);
+    else
+        l_total = freq_table_read(ctx, ctx->freq_comp + 1);
+    build_decode_table(ctx);
+    if ((l_total != (1 << CARITH_NORM_BITS)) && (a_source_size > 0))
+        return CARITH_ERR_DAMAGED;
+    return CARITH_ERR_NONE;
+}
+
+static void compress_ac32(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    ac32_state_t l_st;
+    size_t l_plain_ptr;
+
+    ac32_prepare_table(ctx, a_in, a_in_len);
+    ac32_encode_init(&l_st, ctx->comp);
+    for (l_plain_ptr = 0; l_plain_ptr < a_in_len; ++l_plain_ptr)
+        ac32_encode_symbol(ctx, &l_st, a_in[l_plain_ptr]);
+    ac32_encode_flush(&l_st);
+    ctx->comp_len = l_st.pos;
+    ac32_write_table(ctx, CARITH_CODER_AC32);
+}
+
+static carith_error_t extract_ac32(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    ac32_state_t l_st;
+    size_t l_decomp_ptr;
+
+    if (ac32_read_table(ctx, a_source_size) != CARITH_ERR_NONE)
+        return CARITH_ERR_DAMAGED;
+    ac32_decode_init(&l_st, ctx->comp, ctx->comp_len);
+    for (l_decomp_ptr = 0; l_decomp_ptr < a_source_size; ++l_decomp_ptr)
+        a_out[l_decomp_ptr] = ac32_decode_symbol(&ctx->dec, &l_st);
+    *a_out_len = l_decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+/*
+ * Range coder with carry propagation, LZMA style. low is kept to 33 bits, and
+ * a carry out of the bottom 32 lands in bit 32 instead of being headed off
+ * the way the original coder's underflow checks and the carryless coder's
+ * range cut do. Its top byte waits in cache, along with a count of 0xff bytes
+ * behind it, until it's known whether the carry has to ripple through them.
+ * Renormalizing is then just a loop on range < RC_TOP, with no look at the
+ * bytes themselves. Tables are the same power of two ones CARITH_CODER_AC32
+ * uses, so the two compress alike and differ only in how they handle carries.
+ */
+
+#define RC_TOP (1U << 24) ///< Renormalize when range drops below this
+
+/**
+ * @struct rc_state_t
+ * @brief One carry propagating range coder
+ */
+
+typedef struct {
+    uint64_t low;        ///< Encoder only, 33 bits, bit 32 is a pending carry
+    uint32_t range;
+    uint32_t code;       ///< Decoder only, stream window less low
+    uint8_t cache;       ///< Encoder only, the byte that a carry would still change
+    uint64_t cache_size; ///< Encoder only, cache plus the 0xff bytes after it
+    uint8_t *buf;
+    size_t pos;
+    size_t end;          ///< Decoder only
+} rc_state_t;
+
+static inline void rc_shift_low(rc_state_t *a_st)
+{
+    // the top byte's settled unless it's 0xff with no carry yet, the cache and the run behind it go out carried or not
+    if (((uint32_t)a_st->low < 0xff000000U) || ((a_st->low >> 32) != 0)) {
+        uint8_t l_carry = a_st->low >> 32;
+        uint8_t l_temp = a_st->cache;
+        do {
+            a_st->buf[a_st->pos++] = l_temp + l_carry;
+            l_temp = 0xff;
+        } while (--a_st->cache_size != 0);
+        a_st->cache = (a_st->low >> 24) & 0xff;
+    }
+    a_st->cache_size++;
+    a_st->low = (a_st->low & 0x00ffffff) << 8;
+}
+
+static void compress_rc(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    rc_state_t l_st;
+    size_t l_plain_ptr;
+    uint32_t l_r;
+    int i;
+
+    ac32_prepare_table(ctx, a_in, a_in_len);
+    l_st.low = 0;
+    l_st.range = UINT32_MAX;
+    l_st.cache = 0;
+    l_st.cache_size = 1;
+    l_st.buf = ctx->comp;
+    l_st.pos = 0;
+    for (l_plain_ptr = 0; l_plain_ptr < a_in_len; ++l_plain_ptr) {
+        uint8_t l_sym = a_in[l_plain_ptr];
+        l_r = l_st.range >> CARITH_NORM_BITS;
+        l_st.low += (uint64_t)ctx->freq.count_base[l_sym] * l_r;
+        l_st.range = (uint32_t)ctx->freq.count[l_sym] * l_r;
+        while (l_st.range < RC_TOP) {
+            l_st.range <<= 8;
+            rc_shift_low(&l_st);
+        }
+    }
+    for (i = 0; i < 5; ++i)
+        rc_shift_low(&l_st);
+    ctx->comp_len = l_st.pos;
+    ac32_write_table(ctx, CARITH_CODER_RC);
+}
+
+static carith_error_t extract_rc(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    const carith_decode_table_t *l_dt = &ctx->dec;
+    rc_state_t l_st;
+    size_t l_decomp_ptr;
+    uint32_t l_r, l_countpos, k;
+    int i;
+
+    if (ac32_read_table(ctx, a_source_size) != CARITH_ERR_NONE)
+        return CARITH_ERR_DAMAGED;
+    l_st.range = UINT32_MAX;
+    l_st.code = 0;
+    l_st.buf = ctx->comp;
+    l_st.pos = 0;
+    l_st.end = ctx->comp_len;
+    // the first byte is the encoder's empty cache, always 0, and shifts straight back out
+#define RC_NEXT_BYTE() ((l_st.pos < l_st.end) ? l_st.buf[l_st.pos++] : 0)
+    for (i = 0; i < 5; ++i)
+        l_st.code = (l_st.code << 8) | RC_NEXT_BYTE();
+    for (l_decomp_ptr = 0; l_decomp_ptr < a_source_size; ++l_decomp_ptr) {
+        l_r = l_st.range >> CARITH_NORM_BITS;
+        l_countpos = l_st.code / l_r;
+        if (l_countpos >= (1 << CARITH_NORM_BITS))
+            l_countpos = (1 << CARITH_NORM_BITS) - 1; // damaged, the segment CRC will catch it
+        k = l_dt->lut[l_countpos >> l_dt->shift];
+        while (l_countpos >= l_dt->start[k + 1])
+            ++k;
+        l_st.code -= (uint32_t)l_dt->start[k] * l_r;
+        l_st.range = (uint32_t)(l_dt->start[k + 1] - l_dt->start[k]) * l_r;
+        while (l_st.range < RC_TOP) {
+            l_st.code = (l_st.code << 8) | RC_NEXT_BYTE();
+            l_st.range <<= 8;
+        }
+        a_out[l_decomp_ptr] = l_dt->sym[k];
+    }
+#undef RC_NEXT_BYTE
+    *a_out_len = l_decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+/*
+ * Interleaved: byte i of the segment goes to coder i % AC32X_STATES, and each
+ * coder has its own stream. The streams sit back to back in comp, after the
+ * lengths of all but the last as 32-bit big endian values. Each coder's work
+ * is a long chain of dependent steps, but the chains don't depend on each other,
+ * so the decoder runs them side by side and the CPU overlaps them.
+ */
+
+static void compress_ac32x(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    ac32_state_t l_st;
+    size_t l_plain_ptr, l_comp_ptr = (AC32X_STATES - 1) * 4;
+    int i;
+
+    ac32_prepare_table(ctx, a_in, a_in_len);
+    // the coders don't share anything but the table, so each one's stream is simply written out in turn
+    for (i = 0; i < AC32X_STATES; ++i) {
+        ac32_encode_init(&l_st, ctx->comp + l_comp_ptr);
+        for (l_plain_ptr = i; l_plain_ptr < a_in_len; l_plain_ptr += AC32X_STATES)
+            ac32_encode_symbol(ctx, &l_st, a_in[l_plain_ptr]);
+        ac32_encode_flush(&l_st);
+        if (i < AC32X_STATES - 1) {
+            ctx->comp[i * 4] = l_st.pos >> 24;
+            ctx->comp[i * 4 + 1] = l_st.pos >> 16;
+            ctx->comp[i * 4 + 2] = l_st.pos >> 8;
+            ctx->comp[i * 4 + 3] = l_st.pos;
+        }
+        l_comp_ptr += l_st.pos;
+    }
+    ctx->comp_len = l_comp_ptr;
+    ac32_write_table(ctx, CARITH_CODER_AC32X);
+}
+
+static carith_error_t extract_ac32x(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    ac32_state_t l_st[AC32X_STATES];
+    size_t l_decomp_ptr, l_comp_ptr = (AC32X_STATES - 1) * 4, l_len;
+    int i;
+
+    if (ac32_read_table(ctx, a_source_size) != CARITH_ERR_NONE)
+        return CARITH_ERR_DAMAGED;
+    for (i = 0; i < AC32X_STATES; ++i) {
+        // a damaged length can't point a coder outside comp
+        if (l_comp_ptr > ctx->comp_len)
+            l_comp_ptr = ctx->comp_len;
+        if (i < AC32X_STATES - 1)
+            l_len = ((size_t)ctx->comp[i * 4] << 24) | ((size_t)ctx->comp[i * 4 + 1] << 16) | ((size_t)ctx->comp[i * 4 + 2] << 8) | ctx->comp[i * 4 + 3];
+        else
+            l_len = ctx->comp_len - l_comp_ptr;
+        if (l_len > ctx->comp_len - l_comp_ptr)
+            l_len = ctx->comp_len - l_comp_ptr;
+        ac32_decode_init(&l_st[i], ctx->comp + l_comp_ptr, l_len);
+        l_comp_ptr += l_len;
+    }
+    for (l_decomp_ptr = 0; l_decomp_ptr + AC32X_STATES <= a_source_size; l_decomp_ptr += AC32X_STATES) {
+        uint32_t l_countpos[AC32X_STATES], k;
+        // do the divides for every coder first so they're all in flight at once
+        for (i = 0; i < AC32X_STATES; ++i) {
+            l_st[i].range >>= CARITH_NORM_BITS;
+            l_countpos[i] = (l_st[i].code - l_st[i].low) / l_st[i].range;
+        }
+        for (i = 0; i < AC32X_STATES; ++i) {
+            if (l_countpos[i] >= (1 << CARITH_NORM_BITS))
+                l_countpos[i] = (1 << CARITH_NORM_BITS) - 1;
+            k = ctx->dec.lut[l_countpos[i] >> ctx->dec.shift];
+            while (l_countpos[i] >= ctx->dec.start[k + 1])
+                ++k;
+            a_out[l_decomp_ptr + i] = ctx->dec.sym[k];
+            l_st[i].low += (uint32_t)ctx->dec.start[k] * l_st[i].range;
+            l_st[i].range *= (uint32_t)(ctx->dec.start[k + 1] - ctx->dec.start[k]);
+            while (((l_st[i].low ^ (l_st[i].low + l_st[i].range)) < AC32_TOP) || ((l_st[i].range < AC32_BOT) && ((l_st[i].range = -l_st[i].low & (AC32_BOT - 1)), 1))) {
+                l_st[i].code = (l_st[i].code << 8) | ac32_next_byte(&l_st[i]);
+                l_st[i].low <<= 8;
+                l_st[i].range <<= 8;
+            }
+        }
+    }
+    for (i = 0; l_decomp_ptr < a_source_size; ++i, ++l_decomp_ptr)
+        a_out[l_decomp_ptr] = ac32_decode_symbol(&ctx->dec, &l_st[i]);
+    *a_out_len = l_decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+/*
+ * rANS, four states interleaved into one stream. Tables are scaled to
+ * 2^CARITH_RANS_BITS, small enough that the decoder's slot table stays in L1:
+ * one lookup there gives the symbol and everything needed to step the state,
+ * so decoding has no division and no search. The encoder works from the end
+ * of the segment back to the front, writing its stream backwards, so that the
+ * decoder reads it forwards.
+ */
+
+#define RANS_L (1U << 23) ///< States are kept in [RANS_L, RANS_L << 8)
+#define RANS_STATES 4     ///< Interleaved states, byte i of the segment belongs to state i % RANS_STATES
+
+/**
+ * @struct rans_enc_symbol_t
+ * @brief Per-symbol constants that let the encoder divide by the symbol's count with a multiply
+ */
+
+typedef struct {
+    uint32_t x_max;     ///< Renormalize the state until it's below this
+    uint32_t rcp_freq;  ///< Fixed point reciprocal of the count
+    uint32_t bias;      ///< Added to the state, the symbol's start (and a fixup for counts of 1)
+    uint16_t cmpl_freq; ///< 2^CARITH_RANS_BITS - count
+    uint16_t rcp_shift; ///< Shift after multiplying by rcp_freq
+} rans_enc_symbol_t;
+
+static void rans_enc_symbol_init(rans_enc_symbol_t *a_sym, uint32_t a_start, uint32_t a_freq)
+{
+    uint32_t l_shift = 0;
+
+    a_sym->x_max = ((RANS_L >> CARITH_RANS_BITS) << 8) * a_freq;
+    a_sym->cmpl_freq = (1 << CARITH_RANS_BITS) - a_freq;
+    if (a_freq < 2) {
+        // x / 1 is x, which a 32-bit reciprocal can't quite express, so fold it into the bias instead
+        a_sym->rcp_freq = UINT32_MAX;
+        a_sym->rcp_shift = 0;
+        a_sym->bias = a_start + (1 << CARITH_RANS_BITS) - 1;
+    } else {
+        while (a_freq > (1U << l_shift))
+            l_shift++;
+        a_sym->rcp_freq = (uint32_t)(((1ULL << (l_shift + 31)) + a_freq - 1) / a_freq);
+        a_sym->rcp_shift = l_shift - 1;
+        a_sym->bias = a_start;
+    }
+}
+
+static void compress_rans(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    rans_enc_symbol_t l_syms[256];
+    uint32_t l_x[RANS_STATES];
+    uint8_t *l_end = ctx->comp + ctx->comp_size;
+    uint8_t *l_ptr = l_end;
+    size_t i;
+    int j;
+
+    freq_count(ctx, a_in, a_in_len);
+    if (a_in_len > 0)
+        freq_normalize(ctx, a_in_len, CARITH_RANS_BITS);
+    for (i = 0; i < 256; ++i)
+        rans_enc_symbol_init(&l_syms[i], ctx->freq.count_base[i], ctx->freq.count[i]);
+
+    for (j = 0; j < RANS_STATES; ++j)
+        l_x[j] = RANS_L;
+    for (i = a_in_len; i > 0; --i) {
+        rans_enc_symbol_t *l_sym = &l_syms[a_in[i - 1]];
+        uint32_t *l_xs = &l_x[(i - 1) % RANS_STATES];
+        uint32_t q;
+        while (*l_xs >= l_sym->x_max) {
+            *--l_ptr = *l_xs & 0xff;
+            *l_xs >>= 8;
+        }
+        q = (uint32_t)(((uint64_t)*l_xs * l_sym->rcp_freq) >> 32) >> l_sym->rcp_shift;
+        *l_xs += l_sym->bias + q * l_sym->cmpl_freq;
+    }
+    // last state out is the first one the decoder reads back
+    for (j = RANS_STATES - 1; j >= 0; --j) {
+        l_ptr -= 4;
+        l_ptr[0] = l_x[j];
+        l_ptr[1] = l_x[j] >> 8;
+        l_ptr[2] = l_x[j] >> 16;
+        l_ptr[3] = l_x[j] >> 24;
+    }
+    ctx->comp_len = l_end - l_ptr;
+    memmove(ctx->comp, l_ptr, ctx->comp_len);
+
+    ctx->freq_comp[0] = CARITH_CODER_RANS;
+    freq_table_write(ctx, ctx->freq_comp + 1, &ctx->freq_comp_len);
+    ctx->freq_comp_len++;
+}
+
+static carith_error_t extract_rans(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    uint32_t *l_slot = ctx->rans_slot;
+    uint32_t l_x[RANS_STATES];
+    size_t l_ptr = 0, l_decomp_ptr;
+    uint64_t l_total;
+    size_t i, k;
+    int j;
+
+    l_total = freq_table_read(ctx, ctx->freq_comp + 1);
+    if ((l_total != (1 << CARITH_RANS_BITS)) && (a_source_size > 0))
+        return CARITH_ERR_DAMAGED;
+    // every slot: symbol in the low byte, count - 1 in the next 12 bits, and how far into the symbol's range the slot is in the top 12
+    for (i = 0; i < 256; ++i) {
+        for (k = 0; k < ctx->freq.count[i]; ++k)
+            l_slot[ctx->freq.count_base[i] + k] = i | ((ctx->freq.count[i] - 1) << 8) | (k << 20);
+    }
+
+    // a damaged stream mustn't walk us off the end of comp, read zeroes instead
+#define RANS_NEXT_BYTE() ((l_ptr < ctx->comp_len) ? ctx->comp[l_ptr++] : 0)
+    for (j = 0; j < RANS_STATES; ++j) {
+        l_x[j] = RANS_NEXT_BYTE();
+        l_x[j] |= RANS_NEXT_BYTE() << 8;
+        l_x[j] |= RANS_NEXT_BYTE() << 16;
+        l_x[j] |= (uint32_t)RANS_NEXT_BYTE() << 24;
+    }
+    for (l_decomp_ptr = 0; l_decomp_ptr < a_source_size; ++l_decomp_ptr) {
+        uint32_t *l_xs = &l_x[l_decomp_ptr % RANS_STATES];
+        uint32_t l_e = l_slot[*l_xs & ((1 << CARITH_RANS_BITS) - 1)];
+        a_out[l_decomp_ptr] = l_e;
+        *l_xs = (((l_e >> 8) & 0xfff) + 1) * (*l_xs >> CARITH_RANS_BITS) + (l_e >> 20);
+        while (*l_xs < RANS_L)
+            *l_xs = (*l_xs << 8) | RANS_NEXT_BYTE();
+    }
+#undef RANS_NEXT_BYTE
+    *a_out_len = l_decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+/*
+ * Adaptive order 0: every count starts at 1 and grows as its symbol turns up,
+ * so the decoder follows along with no table sent at all. The counts live in
+ * a Fenwick tree, which finds a symbol's start, or the symbol under a count
+ * position, in 8 steps, and takes an update in 8 more. Totals are kept within
+ * AC32_BOT by halving everything, which also lets the model forget old data.
+ */
+
+#define ADAPT_INC 32                          ///< Added to a symbol's count each time it's coded
+#define ADAPT_LIMIT (1U << CARITH_NORM_BITS)  ///< Halve the counts before the total gets past this
+
+/**
+ * @struct adapt_model_t
+ * @brief Adaptive order 0 counts, with a Fenwick tree over them for cumulative counts
+ */
+
+typedef struct {
+    uint32_t tree[257]; ///< Fenwick tree, 1 based, tree[i] sums the counts of symbols i - (i & -i) to i - 1
+    uint32_t count[256];
+    uint32_t total;
+} adapt_model_t;
+
+static void adapt_build(adapt_model_t *a_m)
+{
+    uint32_t i, j;
+
+    memset(a_m->tree, 0, sizeof(a_m->tree));
+    a_m->total = 0;
+    for (i = 1; i <= 256; ++i) {
+        a_m->tree[i] += a_m->count[i - 1];
+        a_m->total += a_m->count[i - 1];
+        j = i + (i & -i);
+        if (j <= 256)
+            a_m->tree[j] += a_m->tree[i];
+    }
+}
+
+static void adapt_init(adapt_model_t *a_m)
+{
+    int i;
+
+    for (i = 0; i < 256; ++i)
+        a_m->count[i] = 1;
+    adapt_build(a_m);
+}
+
+// total count of the symbols before a_sym
+static inline uint32_t adapt_start(const adapt_model_t *a_m, uint32_t a_sym)
+{
+    uint32_t l_sum = 0;
+
+    for (; a_sym > 0; a_sym -= a_sym & -a_sym)
+        l_sum += a_m->tree[a_sym];
+    return l_sum;
+}
+
+// symbol whose range holds a_countpos, and where that range starts
+static inline uint32_t adapt_find(const adapt_model_t *a_m, uint32_t a_countpos, uint32_t *a_start)
+{
+    uint32_t l_pos = 0, l_sum = 0, l_step;
+
+    for (l_step = 256; l_step > 0; l_step >>= 1) {
+        if ((l_pos + l_step <= 256) && (l_sum + a_m->tree[l_pos + l_step] <= a_countpos)) {
+            l_pos += l_step;
+            l_sum += a_m->tree[l_pos];
+        }
+    }
+    *a_start = l_sum;
+    return l_pos;
+}
+
+static inline void adapt_update(adapt_model_t *a_m, uint32_t a_sym)
+{
+    uint32_t i;
+
+    a_m->count[a_sym] += ADAPT_INC;
+    a_m->total += ADAPT_INC;
+    if (a_m->total > ADAPT_LIMIT - ADAPT_INC) {
+        for (i = 0; i < 256; ++i)
+            a_m->count[i] = (a_m->count[i] + 1) >> 1;
+        adapt_build(a_m);
+        return;
+    }
+    for (i = a_sym + 1; i <= 256; i += i & -i)
+        a_m->tree[i] += ADAPT_INC;
+}
+
+static void compress_adapt(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    adapt_model_t l_m;
+    ac32_state_t l_st;
+    size_t l_plain_ptr;
+    uint32_t l_r;
+
+    adapt_init(&l_m);
+    ac32_encode_init(&l_st, ctx->comp);
+    for (l_plain_ptr = 0; l_plain_ptr < a_in_len; ++l_plain_ptr) {
+        uint8_t l_sym = a_in[l_plain_ptr];
+        l_r = l_st.range / l_m.total;
+        l_st.low += adapt_start(&l_m, l_sym) * l_r;
+        l_st.range = l_m.count[l_sym] * l_r;
+        ac32_encode_renorm(&l_st);
+        adapt_update(&l_m, l_sym);
+    }
+    ac32_encode_flush(&l_st);
+    ctx->comp_len = l_st.pos;
+    // nothing to send but which coder this is
+    ctx->freq_comp[0] = CARITH_CODER_ADAPT;
+    ctx->freq_comp_len = 1;
+}
+
+static carith_error_t extract_adapt(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    adapt_model_t l_m;
+    ac32_state_t l_st;
+    size_t l_decomp_ptr;
+    uint32_t l_r, l_countpos, l_start, l_sym;
+
+    adapt_init(&l_m);
+    ac32_decode_init(&l_st, ctx->comp, ctx->comp_len);
+    for (l_decomp_ptr = 0; l_decomp_ptr < a_source_size; ++l_decomp_ptr) {
+        l_r = l_st.range / l_m.total;
+        l_countpos = (l_st.code - l_st.low) / l_r;
+        if (l_countpos >= l_m.total)
+            l_countpos = l_m.total - 1; // damaged, the segment CRC will catch it
+        l_sym = adapt_find(&l_m, l_countpos, &l_start);
+        l_st.low += l_start * l_r;
+        l_st.range = l_m.count[l_sym] * l_r;
+        ac32_decode_renorm(&l_st);
+        adapt_update(&l_m, l_sym);
+        a_out[l_decomp_ptr] = l_sym;
+    }
+    *a_out_len = l_decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+/*
+ * Context mixing: each byte goes a bit at a time, top bit first. Order 0, 1
+ * and 2 models each give the probability the next bit is a 1, a mixer picked
+ * by the bits of the byte so far weighs them together in the logistic domain,
+ * and everything learns from the bit as soon as it's coded. The bits go
+ * through the 32-bit range coder with a 12 bit probability, and with only two
+ * outcomes, the decoder just compares against the split instead of dividing.
+ */
+
+#define CM_RATE 4    ///< Counters move 1/2^CM_RATE of the way toward each bit
+#define CM_LR 10     ///< Mixer learning rate, as a shift, smaller learns faster
+#define CM_WMAX (1 << 18) ///< Largest mixer weight, 4.0
+
+static void cm_reset(carith_cm_t *a_cm)
+{
+    int i;
+
+    for (i = 0; i < 256; ++i)
+        a_cm->o0[i] = 32768;
+    for (i = 0; i < 65536; ++i)
+        a_cm->o1[i] = 32768;
+    for (i = 0; i < (1 << CARITH_CM_O2_BITS); ++i)
+        a_cm->o2[i] = 32768;
+    for (i = 0; i < 256; ++i) {
+        a_cm->mix[i][0] = 1 << 14;
+        a_cm->mix[i][1] = 1 << 15;
+        a_cm->mix[i][2] = 1 << 15;
+    }
+}
+
+// where byte a_c1 after a_c2 sits in the order 2 table, the bits so far get XORed in
+static inline uint32_t cm_o2_hash(uint32_t a_c2, uint32_t a_c1)
+{
+    return ((((a_c2 << 8) | a_c1) * 0x9E3779B1U) >> (32 - CARITH_CM_O2_BITS)) & ~0xffU;
+}
+
+/**
+ * @struct cm_bit_t
+ * @brief Everything one bit's prediction touched, so the update after coding doesn't look it all up again
+ */
+
+typedef struct {
+    uint16_t *p[3]; ///< The three counters
+    int st[3];      ///< Their probabilities, stretched
+    int32_t *w;     ///< The mixer weights used
+    int pr;         ///< Mixed probability of a 1, 12 bit
+} cm_bit_t;
+
+static inline void cm_predict(carith_cm_t *a_cm, cm_bit_t *a_b, uint32_t a_c0, uint32_t a_c1, uint32_t a_h2)
+{
+    int i, l_dot = 0;
+
+    a_b->p[0] = &a_cm->o0[a_c0];
+    a_b->p[1] = &a_cm->o1[(a_c1 << 8) | a_c0];
+    a_b->p[2] = &a_cm->o2[a_h2 ^ a_c0];
+    a_b->w = a_cm->mix[a_c0];
+    for (i = 0; i < 3; ++i) {
+        a_b->st[i] = a_cm->stretch[*a_b->p[i] >> 4];
+        l_dot += a_b->w[i] * a_b->st[i];
+    }
+    a_b->pr = cm_squash(l_dot >> 16);
+}
+
+static inline void cm_update(cm_bit_t *a_b, int a_bit)
+{
+    int i, l_err = ((a_bit << 12) - a_b->pr);
+
+    for (i = 0; i < 3; ++i) {
+        a_b->w[i] += (a_b->st[i] * l_err) >> CM_LR;
+        // keep them where the dot product can't overflow
+        if (a_b->w[i] > CM_WMAX)
+            a_b->w[i] = CM_WMAX;
+        else if (a_b->w[i] < -CM_WMAX)
+            a_b->w[i] = -CM_WMAX;
+        if (a_bit)
+            *a_b->p[i] += (65535 - *a_b->p[i]) >> CM_RATE;
+        else
+            *a_b->p[i] -= *a_b->p[i] >> CM_RATE;
     }
-    ctx->comp_len = comp_ptr;
+}
 
-    //    printf("process: compressed %ld bytes into %ld.\n", ctx->plain_len, ctx->comp_len);
+static void compress_cm(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    carith_cm_t *l_cm = ctx->cm;
+    ac32_state_t l_st;
+    cm_bit_t l_b;
+    uint32_t l_c1 = 0, l_c2 = 0, l_h2, l_c0, l_bound;
+    size_t l_plain_ptr;
+    int j, l_bit;
 
-    uint8_t ftbl_enum[1024];
-    memset(ftbl_enum, 0, 1024);
-    uint16_t ftbl_enum_len;
-    uint16_t ftbl_enum_entries = 0;
-    uint8_t ftbl_full[1024];
-    memset(ftbl_full, 0, 1024);
-    uint16_t ftbl_full_len;
-    uint64_t countmax = 0;
-    for (i = 0; i < 256; ++i) {
-        if (ctx->freq[i].count > countmax)
-            countmax = ctx->freq[i].count;
-    }
-    uint16_t countwidth = cbit_bit_width(countmax);
-    cbit_cursor_t bc;
-
-    // construct enumerated frequency table
-    bc.byte = 0;
-    bc.bit = 7;
-    bc.buffer = ftbl_enum;
-    cbit_write(&bc, 1); // first bit true indicates it's enumerated
-    cbit_write_many(&bc, countwidth, 5); // value 0-31 for countwidth
-    for (i = 0; i < 256; ++i) {
-        if (ctx->freq[i].count > 0)
-            ftbl_enum_entries++;
+    cm_reset(l_cm);
+    ac32_encode_init(&l_st, ctx->comp);
+    for (l_plain_ptr = 0; l_plain_ptr < a_in_len; ++l_plain_ptr) {
+        l_h2 = cm_o2_hash(l_c2, l_c1);
+        l_c0 = 1;
+        for (j = 7; j >= 0; --j) {
+            l_bit = (a_in[l_plain_ptr] >> j) & 1;
+            cm_predict(l_cm, &l_b, l_c0, l_c1, l_h2);
+            // a 1 gets the bottom of the range
+            l_bound = (l_st.range >> 12) * l_b.pr;
+            if (l_bit) {
+                l_st.range = l_bound;
+            } else {
+                l_st.low += l_bound;
+                l_st.range -= l_bound;
+            }
+            ac32_encode_renorm(&l_st);
+            cm_update(&l_b, l_bit);
+            l_c0 = (l_c0 << 1) | l_bit;
+        }
+        l_c2 = l_c1;
+        l_c1 = a_in[l_plain_ptr];
     }
-    cbit_write_many(&bc, ftbl_enum_entries, 9); // 0-256 number of active symbols
-    for (i = 0; i < 256; ++i) {
-        if (ctx->freq[i].count > 0) {
-            cbit_write_many(&bc, i, 8);
-            cbit_write_many(&bc, ctx->freq[i].count, countwidth);
+    ac32_encode_flush(&l_st);
+    ctx->comp_len = l_st.pos;
+    ctx->freq_comp[0] = CARITH_CODER_CM;
+    ctx->freq_comp_len = 1;
+}
+
+static carith_error_t extract_cm(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    carith_cm_t *l_cm = ctx->cm;
+    ac32_state_t l_st;
+    cm_bit_t l_b;
+    uint32_t l_c1 = 0, l_c2 = 0, l_h2, l_c0, l_bound;
+    size_t l_decomp_ptr;
+    int j, l_bit;
+
+    cm_reset(l_cm);
+    ac32_decode_init(&l_st, ctx->comp, ctx->comp_len);
+    for (l_decomp_ptr = 0; l_decomp_ptr < a_source_size; ++l_decomp_ptr) {
+        l_h2 = cm_o2_hash(l_c2, l_c1);
+        l_c0 = 1;
+        for (j = 0; j < 8; ++j) {
+            cm_predict(l_cm, &l_b, l_c0, l_c1, l_h2);
+            l_bound = (l_st.range >> 12) * l_b.pr;
+            l_bit = (l_st.code - l_st.low) < l_bound;
+            if (l_bit) {
+                l_st.range = l_bound;
+            } else {
+                l_st.low += l_bound;
+                l_st.range -= l_bound;
+            }
+            ac32_decode_renorm(&l_st);
+            cm_update(&l_b, l_bit);
+            l_c0 = (l_c0 << 1) | l_bit;
         }
+        l_c2 = l_c1;
+        l_c1 = l_c0 & 0xff;
+        a_out[l_decomp_ptr] = l_c1;
     }
-    if (bc.bit < 7) {
-        bc.byte++;
-        bc.bit = 7;
+    *a_out_len = l_decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+/*
+ * Canonical Huffman. Code lengths are capped at CARITH_HUFF_BITS, so a
+ * single CARITH_HUFF_BITS peek always holds at least one whole code, and the
+ * decoder's table gives every symbol that fits completely in the peek, up to
+ * HUFF_MAX_SYMS of them, along with how many bits they take up together. The
+ * lengths are all the decoder needs; they go out through freq_table_write as
+ * if they were counts.
+ */
+
+#define HUFF_MAX_SYMS 3 ///< Most symbols one decode table entry gives
+#define HUFF_LOOKUPS ((64 - 7) / CARITH_HUFF_BITS) ///< Lookups one 64-bit load is always good for, it may start up to 7 bits into its first byte
+
+// Huffman code lengths for ctx->freq.count, none longer than CARITH_HUFF_BITS
+static void huff_lengths(carith_comp_ctx *ctx, uint8_t *a_len)
+{
+    uint64_t l_count[256];
+    uint64_t l_weight[511];
+    uint16_t l_parent[511];
+    uint8_t l_depth[511];
+    uint8_t l_leaf[256];
+    int l_leaves, l_maxlen;
+    int i, j, l_next, l_li, l_ni;
+
+    memset(a_len, 0, 256);
+    for (i = 0; i < 256; ++i)
+        l_count[i] = ctx->freq.count[i];
+    for (;;) {
+        // present symbols, least frequent first
+        l_leaves = 0;
+        for (i = 0; i < 256; ++i) {
+            if (l_count[i] == 0)
+                continue;
+            for (j = l_leaves; (j > 0) && (l_count[l_leaf[j - 1]] > l_count[i]); --j)
+                l_leaf[j] = l_leaf[j - 1];
+            l_leaf[j] = i;
+            l_leaves++;
+        }
+        if (l_leaves == 0)
+            return;
+        if (l_leaves == 1) {
+            a_len[l_leaf[0]] = 1;
+            return;
+        }
+
+        // two queues: the sorted leaves, and the joined nodes, which come out in order too
+        for (i = 0; i < l_leaves; ++i)
+            l_weight[i] = l_count[l_leaf[i]];
+        l_li = 0;
+        l_ni = l_leaves;
+        for (l_next = l_leaves; l_next < 2 * l_leaves - 1; ++l_next) {
+            l_weight[l_next] = 0;
+            for (j = 0; j < 2; ++j) {
+                int l_take = ((l_li < l_leaves) && ((l_ni >= l_next) || (l_weight[l_li] <= l_weight[l_ni]))) ? l_li++ : l_ni++;
+                l_weight[l_next] += l_weight[l_take];
+                l_parent[l_take] = l_next;
+            }
+        }
+        // parents always come after their children, so walk down from the root
+        l_depth[2 * l_leaves - 2] = 0;
+        l_maxlen = 0;
+        for (i = 2 * l_leaves - 3; i >= 0; --i) {
+            l_depth[i] = l_depth[l_parent[i]] + 1;
+            if ((i < l_leaves) && (l_depth[i] > l_maxlen))
+                l_maxlen = l_depth[i];
+        }
+        if (l_maxlen <= CARITH_HUFF_BITS) {
+            for (i = 0; i < l_leaves; ++i)
+                a_len[l_leaf[i]] = l_depth[i];
+            return;
+        }
+        // too deep, flatten the counts and try again. All ones is at most 8 deep, so this ends
+        for (i = 0; i < 256; ++i)
+            l_count[i] = (l_count[i] + 1) >> 1;
     }
-    ftbl_enum_len = bc.byte;
-    //	printf("enumerated frequency table size: %d\n", ftbl_enum_len);
+}
+
+// canonical codes for a_len: shorter codes first, equal lengths in symbol order
+static void huff_codes(const uint8_t *a_len, uint16_t *a_code)
+{
+    uint16_t l_bl_count[CARITH_HUFF_BITS + 1] = { 0 };
+    uint16_t l_next_code[CARITH_HUFF_BITS + 1];
+    uint16_t l_code = 0;
+    int i;
 
-    // construct full frequency table
-    bc.byte = 0;
-    bc.bit = 7;
-    bc.buffer = ftbl_full;
-    cbit_write(&bc, 0); // first bit false indicates it's full
-    cbit_write_many(&bc, countwidth, 5); // value 0-31 for countwidth
+    for (i = 0; i < 256; ++i)
+        l_bl_count[a_len[i]]++;
+    l_bl_count[0] = 0;
+    for (i = 1; i <= CARITH_HUFF_BITS; ++i) {
+        l_code = (l_code + l_bl_count[i - 1]) << 1;
+        l_next_code[i] = l_code;
+    }
     for (i = 0; i < 256; ++i) {
-        cbit_write_many(&bc, ctx->freq[i].count, countwidth);
+        if (a_len[i] > 0)
+            a_code[i] = l_next_code[a_len[i]]++;
     }
-    if (bc.bit < 7) {
-        bc.byte++;
-        bc.bit = 7;
+}
+
+static void compress_huff(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    uint8_t l_len[256];
+    uint16_t l_code[256];
+    uint64_t l_acc = 0;
+    int l_nbits = 0;
+    size_t l_plain_ptr, l_comp_ptr = 0;
+    int i;
+
+    freq_count(ctx, a_in, a_in_len);
+    huff_lengths(ctx, l_len);
+    huff_codes(l_len, l_code);
+
+    for (l_plain_ptr = 0; l_plain_ptr < a_in_len; ++l_plain_ptr) {
+        uint8_t l_sym = a_in[l_plain_ptr];
+        l_acc = (l_acc << l_len[l_sym]) | l_code[l_sym];
+        l_nbits += l_len[l_sym];
+        while (l_nbits >= 8) {
+            l_nbits -= 8;
+            ctx->comp[l_comp_ptr++] = l_acc >> l_nbits;
+        }
     }
-    ftbl_full_len = bc.byte;
-    //	printf("full frequency table size: %d\n", ftbl_full_len);
+    if (l_nbits > 0)
+        ctx->comp[l_comp_ptr++] = l_acc << (8 - l_nbits);
+    ctx->comp_len = l_comp_ptr;
+
+    for (i = 0; i < 256; ++i)
+        ctx->freq.count[i] = l_len[i];
+    ctx->freq_comp[0] = CARITH_CODER_HUFF;
+    freq_table_write(ctx, ctx->freq_comp + 1, &ctx->freq_comp_len);
+    ctx->freq_comp_len++;
+}
+
+// the next 64 bits of a_buf from bit a_bitpos on, zeroes past the end
+static inline uint64_t huff_peek(const uint8_t *a_buf, size_t a_len, uint64_t a_bitpos)
+{
+    size_t l_byte = a_bitpos >> 3;
+    uint64_t l_val = 0;
+    int i;
 
-    if (ftbl_enum_len < ftbl_full_len) {
-        memcpy(ctx->freq_comp, ftbl_enum, ftbl_enum_len);
-        ctx->freq_comp_len = ftbl_enum_len;
+    if (l_byte + 8 <= a_len) {
+        memcpy(&l_val, a_buf + l_byte, 8);
+        l_val = __builtin_bswap64(l_val);
     } else {
-        memcpy(ctx->freq_comp, ftbl_full, ftbl_full_len);
-        ctx->freq_comp_len = ftbl_full_len;
+        for (i = 0; i < 8; ++i)
+            l_val = (l_val << 8) | ((l_byte + i < a_len) ? a_buf[l_byte + i] : 0);
     }
+    return l_val << (a_bitpos & 7);
 }
 
-static void extract_ac(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+// ctx->huff_dec from the code lengths in ctx->freq.count, each entry: symbols in the low 3 bytes, then how many (2 bits), then their total length
+static carith_error_t huff_build_decode(carith_comp_ctx *ctx)
 {
-    uint64_t range_lo, range_hi;
-    cbit_cursor_t bc;
-    uint8_t range_lo_hibyte, range_hi_hibyte; // bits 32-40 of the range
-    size_t comp_ptr, decomp_ptr;
-    size_t i;
-    uint64_t window;
-    uint16_t countwidth;
-    uint16_t ftbl_enum_entries;
-//    uint8_t underflow_lo = 0;
-//    uint8_t underflow_hi = 0;
+    const int l_bits = CARITH_HUFF_BITS;
+    uint16_t l_single[1 << CARITH_HUFF_BITS];
+    uint8_t l_len[256];
+    uint16_t l_code[256];
+    uint32_t l_kraft = 0;
+    uint32_t i, k;
 
-    // obliterate frequency table
     for (i = 0; i < 256; ++i) {
-        ctx->freq[i].count = 0;
-        ctx->freq[i].count_base = 0;
+        if (ctx->freq.count[i] > CARITH_HUFF_BITS)
+            return CARITH_ERR_DAMAGED; // code length too long
+        l_len[i] = ctx->freq.count[i];
+        if (l_len[i] > 0)
+            l_kraft += 1 << (l_bits - l_len[i]);
     }
+    if (l_kraft > (1U << l_bits))
+        return CARITH_ERR_DAMAGED; // code lengths don't make a prefix code
+    huff_codes(l_len, l_code);
 
-    // read compressed frequency table
-    uint64_t base_tab = 0;
-    bc.byte = 0;
-    bc.bit = 7;
-    bc.buffer = ctx->freq_comp;;
-    int ftbl_type = cbit_read(&bc);
-    if (ftbl_type == 1) {
-        countwidth = cbit_read_many(&bc, 5);
-        ftbl_enum_entries = cbit_read_many(&bc, 9);
-        //		printf("read compressed table - countwidth %d ftbl_enum_entries %ld\n", countwidth, ftbl_enum_entries);
-        for (i = 0; i < ftbl_enum_entries; ++i) {
-            uint8_t symbol = cbit_read_many(&bc, 8);
-            uint64_t symbol_count = cbit_read_many(&bc, countwidth);
-            ctx->freq[symbol].count_base = base_tab;
-            ctx->freq[symbol].count = symbol_count;
-            base_tab += symbol_count;
-        }
-    } else {
-        countwidth = cbit_read_many(&bc, 5);
-        for (i = 0; i < 256; ++i) {
-            ctx->freq[i].count_base = base_tab;
-            uint64_t symbol_count = cbit_read_many(&bc, countwidth);
-            ctx->freq[i].count = symbol_count;
-            base_tab += symbol_count;
+    // a peek's first symbol and its length, any gap left by a lone symbol's code decodes as symbol 0 taking the whole peek
+    for (i = 0; i < (1U << l_bits); ++i)
+        l_single[i] = l_bits << 8;
+    for (i = 0; i < 256; ++i) {
+        if (l_len[i] == 0)
+            continue;
+        for (k = 0; k < (1U << (l_bits - l_len[i])); ++k)
+            l_single[(l_code[i] << (l_bits - l_len[i])) | k] = i | (l_len[i] << 8);
+    }
+    // then keep decoding out of what's left of the peek while whole codes fit
+    for (i = 0; i < (1U << l_bits); ++i) {
+        uint32_t l_entry = 0;
+        uint32_t l_used = 0, l_syms = 0;
+        while (l_syms < HUFF_MAX_SYMS) {
+            uint16_t l_s = l_single[(i << l_used) & ((1 << l_bits) - 1)];
+            if (l_used + (l_s >> 8) > (uint32_t)l_bits)
+                break;
+            l_entry |= (uint32_t)(l_s & 0xff) << (8 * l_syms);
+            l_used += l_s >> 8;
+            l_syms++;
         }
+        ctx->huff_dec[i] = l_entry | (l_syms << 24) | (l_used << 26);
     }
+    return CARITH_ERR_NONE;
+}
 
-    // change decomp to plain once this is debugged and tested
-    range_lo = 0;
-    range_hi = ULLONG_MAX;
-    //	assign_ranges(ctx, range_lo, range_hi);
-    comp_ptr = 0;
-    decomp_ptr = 0;
-    // prime the pump
-    window = 0;
-    for (i = 0; i < 8; ++i) {
-        window <<= 8;
-        window |= ctx->comp[comp_ptr++];
-    }
+static carith_error_t extract_huff(carith_comp_ctx *ctx, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    const uint32_t *l_dec = ctx->huff_dec;
+    const uint8_t *l_comp = ctx->comp;
+    const size_t l_comp_len = ctx->comp_len;
+    uint64_t l_bitpos = 0;
+    size_t l_decomp_ptr = 0;
+    uint32_t l_e;
 
-    while (1) {
-        //		assign_ranges(ctx, range_lo, range_hi);
-        //		found = 0; // keep track of whether or not we found the range. If we didn't find the range, this is a fatal error!
-        //		printf("comp_ptr %ld decomp_ptr %ld\n", comp_ptr, decomp_ptr);
-        // find which range window falls between
-        //		uint64_t l_rangesize = range_hi - range_lo;
-        //		uint64_t l_windowpos = window - range_lo;
-        //		uint64_t l_countpos = ((__uint128_t)l_windowpos * (__uint128_t)ctx->plain_len) / (__uint128_t)l_rangesize;
-        //		printf("l_rangesize %016lX l_windowpos %016lX l_countpos %ld plain_len %ld\n", l_rangesize, l_windowpos, (uint64_t)l_countpos, ctx->plain_len);
-        //		for (i = 0; i < 256; ++i) {
-        //			printf("i %ld %ld %ld\n", i, ctx->freq[i].count_base, ctx->freq[i].count_base + ctx->freq[i].count);
-        //			if ((l_countpos >= ctx->freq[i].count_base) && (l_countpos < ctx->freq[i].count_base + ctx->freq[i].count))
-        //				break;
-        //		}
-        i = token_for_window(ctx, window, range_lo, range_hi, a_source_size);
-        // i should equal the token we are looking for
-        //		printf("discovered window %016lX conforms to %02lX\n", window, i);
-        //		printf("%ld\n", i);
-        // output i to decomp stream
-        //		printf("decomp_ptr %ld outputting %02lX\n", decomp_ptr, i);
-        a_out[decomp_ptr++] = i;
-        retrieve_range(ctx, i, &range_lo, &range_hi, a_source_size);
-        //		printf("new range %016lX %016lX\n", range_lo, range_hi);
-        //		found = 1;
-        //		range_lo = ctx->freq[i].range_start;
-        //		range_hi = ctx->freq[i].range_end;
-        range_lo_hibyte = (range_lo >> 56);
-        range_hi_hibyte = (range_hi >> 56);
-        // underflow detection
-        if ((range_hi_hibyte - range_lo_hibyte) == 1) {
-//            underflow_lo = range_lo_hibyte;
-//            underflow_hi = range_hi_hibyte;
-            uint8_t range_lo_2ndbyte = (range_lo >> 48) & 0xff;
-            uint8_t range_hi_2ndbyte = (range_hi >> 48) & 0xff;
-            if ((range_lo_2ndbyte == 0xff) && (range_hi_2ndbyte == 0x00)) {
-//                printf("underflow detected: %02X/%02X win %016lX\n", underflow_lo, underflow_hi, window);
-                // save the high byte of the ranges and the window
-                uint64_t range_lo_savetop = range_lo & 0xff00000000000000;
-                uint64_t range_hi_savetop = range_hi & 0xff00000000000000;
-                uint64_t window_savetop   =   window & 0xff00000000000000;
-                // slide everything over by one byte
-                range_lo <<= 8;
-                range_hi <<= 8;
-                window <<= 8;
-                // fix up the low byte: range_lo gets zeros courtesy of the shift, range_hi gets 0xff, window gets the next byte from the token stream
-                range_hi |= 0xff;
-                window |= ctx->comp[comp_ptr++];
-                // mask off high byte and stick the saved top byte back on
-                range_lo &= 0x00ffffffffffffff;
-                range_lo |= range_lo_savetop;
-                range_hi &= 0x00ffffffffffffff;
-                range_hi |= range_hi_savetop;
-                window &=   0x00ffffffffffffff;
-                window |= window_savetop;
-            }
-        }
-        while (range_lo_hibyte == range_hi_hibyte) {
-            //			printf("hibyte equivalency %02X range_lo %010lX range_hi %010lx\n", range_lo_hibyte, range_lo, range_hi);
-            // scoot our ranges over by 8 bits
-            range_lo <<= 8;
-            range_hi <<= 8;
-            range_hi |= 0xff;
-            // slide our window over and read next compressed byte into the low position
-            window <<= 8;
-            window |= ctx->comp[comp_ptr++];
-            // refresh our hibyte values for the next test at top of loop
-            range_lo_hibyte = (range_lo >> 56);
-            range_hi_hibyte = (range_hi >> 56);
-            //			printf("scoot     %016lX %016lX\n", range_lo, range_hi);
+    freq_table_read(ctx, ctx->freq_comp + 1);
+    if (huff_build_decode(ctx) != CARITH_ERR_NONE)
+        return CARITH_ERR_DAMAGED;
+
+    // one 64-bit load covers HUFF_LOOKUPS lookups, each giving several symbols,
+    // while there's room for them all in a_out and the whole load is inside comp
+    while ((l_decomp_ptr + HUFF_LOOKUPS * HUFF_MAX_SYMS <= a_source_size) && ((l_bitpos >> 3) + 8 <= l_comp_len)) {
+        uint64_t l_peek;
+        uint32_t l_used = 0;
+        int i;
+
+        memcpy(&l_peek, l_comp + (l_bitpos >> 3), 8);
+        l_peek = __builtin_bswap64(l_peek) << (l_bitpos & 7);
+        for (i = 0; i < HUFF_LOOKUPS; ++i) {
+            l_e = l_dec[l_peek >> (64 - CARITH_HUFF_BITS)];
+            a_out[l_decomp_ptr] = l_e;
+            a_out[l_decomp_ptr + 1] = l_e >> 8;
+            a_out[l_decomp_ptr + 2] = l_e >> 16;
+            l_decomp_ptr += (l_e >> 24) & 3;
+            l_peek <<= l_e >> 26;
+            l_used += l_e >> 26;
         }
-        //			assign_ranges(ctx, range_lo, range_hi);
-        //		if (found == 0) {
-        //			printf("range not found! %010lX\n", window);
-        //			exit(EXIT_FAILURE);
-        //		}
-        if (decomp_ptr >= a_source_size)
+        l_bitpos += l_used;
+    }
+    // the rest one symbol at a time, freq.count still has the code lengths
+    while (l_decomp_ptr < a_source_size) {
+        l_e = l_dec[huff_peek(l_comp, l_comp_len, l_bitpos) >> (64 - CARITH_HUFF_BITS)];
+        a_out[l_decomp_ptr++] = l_e;
+        l_bitpos += ctx->freq.count[l_e & 0xff];
+    }
+    *a_out_len = l_decomp_ptr;
+    return CARITH_ERR_NONE;
+}
+
+// run one entropy coder over a_in, flagging the scheme if it isn't the original one
+static void compress_coder(carith_comp_ctx *ctx, carith_coder_t a_coder, uint8_t *a_in, size_t a_in_len)
+{
+    // rANS writes its stream backwards from the end of comp, it must never run off the front, and neither may Huffman run off the back
+    if (((a_coder == CARITH_CODER_RANS) || (a_coder == CARITH_CODER_HUFF)) && ((a_in_len / 8 + 1) * CARITH_RANS_BITS + (RANS_STATES * 4) > ctx->comp_size))
+        a_coder = CARITH_CODER_AC;
+
+    ctx->scheme &= ~scheme_xcoder;
+    switch (a_coder) {
+        case CARITH_CODER_AC32:
+            compress_ac32(ctx, a_in, a_in_len);
+            ctx->scheme |= scheme_xcoder;
+            break;
+        case CARITH_CODER_AC32X:
+            compress_ac32x(ctx, a_in, a_in_len);
+            ctx->scheme |= scheme_xcoder;
+            break;
+        case CARITH_CODER_RANS:
+            compress_rans(ctx, a_in, a_in_len);
+            ctx->scheme |= scheme_xcoder;
+            break;
+        case CARITH_CODER_HUFF:
+            compress_huff(ctx, a_in, a_in_len);
+            ctx->scheme |= scheme_xcoder;
+            break;
+        case CARITH_CODER_ADAPT:
+            compress_adapt(ctx, a_in, a_in_len);
+            ctx->scheme |= scheme_xcoder;
+            break;
+        case CARITH_CODER_CM:
+            compress_cm(ctx, a_in, a_in_len);
+            ctx->scheme |= scheme_xcoder;
+            break;
+        case CARITH_CODER_RC:
+            compress_rc(ctx, a_in, a_in_len);
+            ctx->scheme |= scheme_xcoder;
+            break;
+        default:
+            compress_ac(ctx, a_in, a_in_len);
             break;
     }
-    *a_out_len = decomp_ptr;
+}
+
+/*
+ * CARITH_CODER_AUTO tries each of these, fastest to decode first, and keeps
+ * the first whose output is no more than ctx->auto_slack thousandths larger
+ * than the smallest.
+ */
+
+static const carith_coder_t g_auto_coders[] = { CARITH_CODER_HUFF, CARITH_CODER_RANS, CARITH_CODER_AC, CARITH_CODER_ADAPT };
+#define CARITH_AUTO_COUNT (sizeof(g_auto_coders) / sizeof(g_auto_coders[0]))
+
+// run whichever entropy coder ctx->coder asks for
+static void compress_entropy(carith_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len)
+{
+    size_t l_size[CARITH_AUTO_COUNT], l_best = SIZE_MAX;
+    size_t i, l_pick = 0;
+
+    if (ctx->coder != CARITH_CODER_AUTO) {
+        compress_coder(ctx, ctx->coder, a_in, a_in_len);
+        return;
+    }
+    for (i = 0; i < CARITH_AUTO_COUNT; ++i) {
+        compress_coder(ctx, g_auto_coders[i], a_in, a_in_len);
+        l_size[i] = ctx->comp_len + ctx->freq_comp_len;
+        if (l_size[i] < l_best)
+            l_best = l_size[i];
+    }
+    while (l_size[l_pick] > l_best + l_best * ctx->auto_slack / 1000)
+        l_pick++;
+    // the last one run is still sitting in comp
+    if (l_pick != CARITH_AUTO_COUNT - 1)
+        compress_coder(ctx, g_auto_coders[l_pick], a_in, a_in_len);
+}
+
+// a_xcoder is scheme_xcoder from the segment's scheme, which says whether the coder's number is in front of the table
+static carith_error_t extract_entropy(carith_comp_ctx *ctx, int a_xcoder, size_t a_source_size, uint8_t *a_out, size_t *a_out_len)
+{
+    uint8_t l_coder = a_xcoder ? (ctx->freq_comp[0] & ~CARITH_CODER_SHARED) : CARITH_CODER_AC;
+
+    switch (l_coder) {
+        case CARITH_CODER_AC:
+            return extract_ac(ctx, a_source_size, a_out, a_out_len);
+        case CARITH_CODER_AC32:
+            return extract_ac32(ctx, a_source_size, a_out, a_out_len);
+        case CARITH_CODER_AC32X:
+            return extract_ac32x(ctx, a_source_size, a_out, a_out_len);
+        case CARITH_CODER_RANS:
+            return extract_rans(ctx, a_source_size, a_out, a_out_len);
+        case CARITH_CODER_HUFF:
+            return extract_huff(ctx, a_source_size, a_out, a_out_len);
+        case CARITH_CODER_ADAPT:
+            return extract_adapt(ctx, a_source_size, a_out, a_out_len);
+        case CARITH_CODER_CM:
+            return extract_cm(ctx, a_source_size, a_out, a_out_len);
+        case CARITH_CODER_RC:
+            return extract_rc(ctx, a_source_size, a_out, a_out_len);
+        default:
+            return CARITH_ERR_DAMAGED; // unknown entropy coder
+    }
 }
 
 /**
@@ -561,13 +2133,14 @@ carith_error_t carith_compress(carith_comp_ctx *ctx)
         lzss32_error_t err32;
 
         // before we do anything else, let's try using lzss32 instead of rle/lzss4.
-        // bounce plain buffer to rleenc + window, then
+        // bounce plain buffer to lzssenc + window, then
         // we will stick our compressed data in rledec.
+        // the windowed copy stays put in case RLE blooms and we need it again below.
         size_t l_initial_lzss32;
-        memcpy(ctx->rleenc + LZSS32_WINDOW_SIZE, ctx->plain, ctx->plain_len);
-        lzss32_prepare_default_dictionary(&ctx->lzss32_context, ctx->rleenc);
-        lzss32_prepare_pointer_pool(&ctx->lzss32_context, ctx->rleenc, ctx->plain_len);
-        err32 = lzss32_encode(&ctx->lzss32_context, ctx->rleenc, ctx->plain_len, ctx->rledec, &l_initial_lzss32);
+        memcpy(ctx->lzssenc + LZSS32_WINDOW_SIZE, ctx->plain, ctx->plain_len);
+        lzss32_prepare_default_dictionary(&ctx->lzss32_context, ctx->lzssenc);
+        lzss32_prepare_pointer_pool(&ctx->lzss32_context, ctx->lzssenc, ctx->plain_len);
+        err32 = lzss32_encode(&ctx->lzss32_context, ctx->lzssenc, ctx->plain_len, ctx->rledec, &l_initial_lzss32);
         if (err32 != LZSS32_ERR_NONE) {
             fprintf(stderr, "lzss32 error: %s", lzss32_strerror(err32));
             exit(EXIT_FAILURE);
@@ -577,10 +2150,10 @@ carith_error_t carith_compress(carith_comp_ctx *ctx)
         // try RLE first
         rle_encode(ctx->plain, ctx->comp, ctx->plain_len, &ctx->rle_intermediate);
         if (ctx->rle_intermediate >= ctx->plain_len) {
-            // RLE caused bloom; copy plain into encode buffers and continue
+            // RLE caused bloom; copy plain into the LZSS4 encode buffer and continue.
+            // lzssenc already holds plain behind its window from the first lzss32 pass
             memcpy(ctx->rleenc + LZSS_WINDOW_SIZE, ctx->plain, ctx->plain_len);
             ctx->rle_intermediate = ctx->plain_len;
-            memcpy(ctx->lzssenc + LZSS32_WINDOW_SIZE, ctx->plain, ctx->plain_len);
             ctx->scheme &= ~scheme_rle;
 //            printf("carith.c: omitting RLE: %ld\n", ctx->rle_intermediate);
         } else {
@@ -641,10 +2214,35 @@ carith_error_t carith_compress(carith_comp_ctx *ctx)
             ctx->lzss_intermediate = l_initial_lzss32;
 //            printf("carith.c: choosing initial lzss32 instead: %ld\n", l_initial_lzss32);
         }
-        compress_ac(ctx, ac_source, ac_source_size);
+        compress_entropy(ctx, ac_source, ac_source_size);
+        // the context model usually does better on the plain bytes than on LZSS tokens or RLE runs,
+        // so try it on those too and keep whichever comes out smaller. decomp is free while compressing
+        if ((ctx->coder == CARITH_CODER_CM) && ((ctx->scheme & (scheme_rle | scheme_lzss4 | scheme_lzss32)) != 0)) {
+            uint8_t l_chain_scheme = ctx->scheme;
+            size_t l_chain_len = ctx->comp_len;
+            int l_chain_ok = ((ctx->comp_len + ctx->freq_comp_len) < l_prog_int);
+
+            if (l_chain_ok)
+                memcpy(ctx->decomp, ctx->comp, l_chain_len);
+            compress_entropy(ctx, ctx->plain, ctx->plain_len);
+            if (!l_chain_ok || (ctx->comp_len < l_chain_len)) {
+                ctx->scheme = scheme_roulette | (ctx->scheme & scheme_xcoder);
+                ctx->rle_intermediate = 0;
+                ctx->lzss_intermediate = 0;
+                ac_source = ctx->plain;
+                ac_source_size = ctx->plain_len;
+                l_prog_int = ctx->plain_len;
+            } else {
+                // both have the same one byte table, just the stream goes back
+                memcpy(ctx->comp, ctx->decomp, l_chain_len);
+                ctx->comp_len = l_chain_len;
+                ctx->scheme = l_chain_scheme;
+            }
+        }
         if ((ctx->comp_len + ctx->freq_comp_len) >= l_prog_int) {
 //            printf("carith.c: AC ballooned data from %ld to %ld, omitting AC\n", l_prog_int, (ctx->comp_len + ctx->freq_comp_len));
             // store ac_source buffer instead and call it a day
+            ctx->scheme &= ~scheme_xcoder;
             memcpy(ctx->comp, ac_source, ac_source_size);
             ctx->comp_len = ac_source_size;
             ctx->freq_comp_len = 0;
@@ -785,12 +2383,14 @@ carith_error_t carith_compress(carith_comp_ctx *ctx)
         // we're already set up with the AC source set to plain, so do nothing...
     }
 
-    compress_ac(ctx, ac_source, ac_source_size);
+    compress_entropy(ctx, ac_source, ac_source_size);
     return CARITH_ERR_NONE;
 }
 
 /**
  * @brief Decompress comp buffer into decomp buffer
+ * A damaged segment gives CARITH_ERR_DAMAGED and a decomp_len of 0, it never
+ * writes past the end of the context's buffers.
  */
 
 carith_error_t carith_extract(carith_comp_ctx *ctx)
@@ -800,12 +2400,16 @@ carith_error_t carith_extract(carith_comp_ctx *ctx)
     // set these up to default to ACONLY configuration
     size_t *ac_dest_size;
     ac_dest_size = &ctx->decomp_len;
+    // every work buffer has at least this much room after its window
+    size_t l_out_max = ctx->comp_size - LZSS32_WINDOW_SIZE;
 
 //    printf("input (%ld) ", ctx->comp_len);
 //    ccct_print_hex(ctx->comp, ctx->comp_len);
 
     // were we stored? if so then just do a straight copy
     if ((ctx->scheme & scheme_stored) == scheme_stored) {
+        if (ctx->comp_len > l_out_max)
+            goto carith_extract_damaged;
         memcpy(ctx->decomp, ctx->comp, ctx->comp_len);
         ctx->decomp_len = ctx->comp_len;
         return CARITH_ERR_NONE;
@@ -813,6 +2417,7 @@ carith_error_t carith_extract(carith_comp_ctx *ctx)
 
     // eight options here: RLE only, RLE/LZSS/AC, RLE/AC, LZSS/AC, and AC only, plus 3 extra LZSS32 substitutions.
     enum { RLEONLY, LZSSONLY, RLELZSSAC, RLEAC, RLELZSS, RLELZSS32, LZSSAC, ACONLY, LZSS32ONLY, RLELZSS32AC, LZSS32AC } l_schemenum;
+    int l_xcoder = ((ctx->scheme & scheme_xcoder) == scheme_xcoder);
     ctx->scheme &= 0xf0;
     switch (ctx->scheme) {
         case 0x40: l_schemenum = RLEONLY; break;
@@ -826,10 +2431,8 @@ carith_error_t carith_extract(carith_comp_ctx *ctx)
         case 0xd0: l_schemenum = RLELZSS32AC; break;
         case 0xa0: l_schemenum = LZSSAC; break;
         case 0x90: l_schemenum = LZSS32AC; break;
-        default: {
-            fprintf(stderr, "carith_extract: unexpected scheme byte value: %02X\n", ctx->scheme);
-            exit(EXIT_FAILURE);
-        }
+        default:
+            goto carith_extract_damaged;
     }
 
     // if we're doing RLE or LZSS only, just skip all the AC stuff
@@ -852,7 +2455,10 @@ carith_error_t carith_extract(carith_comp_ctx *ctx)
         ac_source_size = ctx->lzss_intermediate;
     }
 
-    extract_ac(ctx, ac_source_size, ac_dest, ac_dest_size);
+    if (ac_source_size > l_out_max)
+        goto carith_extract_damaged;
+    if (extract_entropy(ctx, l_xcoder, ac_source_size, ac_dest, ac_dest_size) != CARITH_ERR_NONE)
+        goto carith_extract_damaged;
 
     // if we're doing AC only, just return
     if (l_schemenum == ACONLY)
@@ -868,16 +2474,15 @@ carith_extract_skipac:
         memcpy(ctx->rledec, ctx->comp, ctx->comp_len);
         ctx->rledec_len = ctx->comp_len;
         // RLE decode rledec into decomp
-        rle_decode(ctx->rledec, ctx->decomp, ctx->rledec_len, &ctx->decomp_len);
+        if (rle_decode(ctx->rledec, ctx->decomp, ctx->rledec_len, l_out_max, &ctx->decomp_len) != 0)
+            goto carith_extract_damaged;
     } else if (l_schemenum == LZSSONLY) {
         //        printf("ctx->comp (%ld) ", ctx->comp_len);
         //        ccct_print_hex(ctx->comp, ctx->comp_len);
         err = lzss4_prepare_default_dictionary(&ctx->lzss4_context, ctx->rledec);
-        err = lzss4_decode(&ctx->lzss4_context, ctx->comp, ctx->comp_len, ctx->rledec, &ctx->rledec_len);
-        if (err != LZSS_ERR_NONE) {
-            fprintf(stderr, "LZSSONLY lzss4 error: %s", lzss4_strerror(err));
-            exit(EXIT_FAILURE);
-        }
+        err = lzss4_decode(&ctx->lzss4_context, ctx->comp, ctx->comp_len, ctx->rledec, l_out_max, &ctx->rledec_len);
+        if (err != LZSS_ERR_NONE)
+            goto carith_extract_damaged;
         //        printf("ctx->rledec + window(%ld) ", ctx->rledec_len);
         //        ccct_print_hex(ctx->rledec + LZSS_WINDOW_SIZE, ctx->rledec_len);
         memcpy(ctx->decomp, ctx->rledec + LZSS_WINDOW_SIZE, ctx->rledec_len);
@@ -886,76 +2491,64 @@ carith_extract_skipac:
         //        ccct_print_hex(ctx->decomp, ctx->decomp_len);
     } else if (l_schemenum == LZSS32ONLY) {
         err32 = lzss32_prepare_default_dictionary(&ctx->lzss32_context, ctx->rledec);
-        err32 = lzss32_decode(&ctx->lzss32_context, ctx->comp, ctx->comp_len, ctx->rledec, &ctx->rledec_len);
-        if (err32 != LZSS32_ERR_NONE) {
-            fprintf(stderr, "LZSS32ONLY lzss32 error: %s", lzss32_strerror(err32));
-            exit(EXIT_FAILURE);
-        }
+        err32 = lzss32_decode(&ctx->lzss32_context, ctx->comp, ctx->comp_len, ctx->rledec, l_out_max, &ctx->rledec_len);
+        if (err32 != LZSS32_ERR_NONE)
+            goto carith_extract_damaged;
         memcpy(ctx->decomp, ctx->rledec + LZSS32_WINDOW_SIZE, ctx->rledec_len);
         ctx->decomp_len = ctx->rledec_len;
     } else if (l_schemenum == RLELZSS) {
         memcpy(ctx->rledec, ctx->comp, ctx->comp_len);
         lzss4_prepare_default_dictionary(&ctx->lzss4_context, ctx->lzssdec);
-        err = lzss4_decode(&ctx->lzss4_context, ctx->rledec, ctx->comp_len, ctx->lzssdec, &ctx->rledec_len);
-        if (err != LZSS_ERR_NONE) {
-            fprintf(stderr, "RLELZSS lzss4 error: %s", lzss4_strerror(err));
-//            ccct_print_hex(ctx->rledec, ctx->comp_len);
-            exit(EXIT_FAILURE);
-        }
+        err = lzss4_decode(&ctx->lzss4_context, ctx->rledec, ctx->comp_len, ctx->lzssdec, l_out_max, &ctx->rledec_len);
+        if (err != LZSS_ERR_NONE)
+            goto carith_extract_damaged;
         // and then do the RLE decode
-        rle_decode(ctx->lzssdec + LZSS_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, &ctx->decomp_len);
+        if (rle_decode(ctx->lzssdec + LZSS_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, l_out_max, &ctx->decomp_len) != 0)
+            goto carith_extract_damaged;
     } else if (l_schemenum == RLELZSS32) {
         memcpy(ctx->rledec, ctx->comp, ctx->comp_len);
         lzss32_prepare_default_dictionary(&ctx->lzss32_context, ctx->lzssdec);
-        err32 = lzss32_decode(&ctx->lzss32_context, ctx->rledec, ctx->comp_len, ctx->lzssdec, &ctx->rledec_len);
-        if (err32 != LZSS32_ERR_NONE) {
-            fprintf(stderr, "RLELZSS32 lzss32 error: %s", lzss32_strerror(err32));
-            exit(EXIT_FAILURE);
-        }
-        rle_decode(ctx->lzssdec + LZSS32_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, &ctx->decomp_len);
+        err32 = lzss32_decode(&ctx->lzss32_context, ctx->rledec, ctx->comp_len, ctx->lzssdec, l_out_max, &ctx->rledec_len);
+        if (err32 != LZSS32_ERR_NONE)
+            goto carith_extract_damaged;
+        if (rle_decode(ctx->lzssdec + LZSS32_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, l_out_max, &ctx->decomp_len) != 0)
+            goto carith_extract_damaged;
     } else if (l_schemenum == RLEAC) {
         // AC operation decomped into rledec, so decode it
-        rle_decode(ctx->rledec, ctx->decomp, ctx->rledec_len, &ctx->decomp_len);
+        if (rle_decode(ctx->rledec, ctx->decomp, ctx->rledec_len, l_out_max, &ctx->decomp_len) != 0)
+            goto carith_extract_damaged;
     } else if (l_schemenum == RLELZSSAC) {
         // decompress LZSS tokens waiting in lzss4dec into rledec.
         // remember, rledec will be windowed after this operation.
         lzss4_prepare_default_dictionary(&ctx->lzss4_context, ctx->rledec);
-        err = lzss4_decode(&ctx->lzss4_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, &ctx->rledec_len);
-        if (err != LZSS_ERR_NONE) {
-            fprintf(stderr, "RLELZSSAC lzss4 error: %s", lzss4_strerror(err));
-            exit(EXIT_FAILURE);
-        }
+        err = lzss4_decode(&ctx->lzss4_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, l_out_max, &ctx->rledec_len);
+        if (err != LZSS_ERR_NONE)
+            goto carith_extract_damaged;
         // and then do the RLE decode
-        rle_decode(ctx->rledec + LZSS_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, &ctx->decomp_len);
+        if (rle_decode(ctx->rledec + LZSS_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, l_out_max, &ctx->decomp_len) != 0)
+            goto carith_extract_damaged;
     } else if (l_schemenum == RLELZSS32AC) {
         lzss32_prepare_default_dictionary(&ctx->lzss32_context, ctx->rledec);
-        err32 = lzss32_decode(&ctx->lzss32_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, &ctx->rledec_len);
-        if (err32 != LZSS32_ERR_NONE) {
-            fprintf(stderr, "RLELZSS32AC lzss32 error: %s", lzss32_strerror(err32));
-            exit(EXIT_FAILURE);
-        }
-        rle_decode(ctx->rledec + LZSS32_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, &ctx->decomp_len);
+        err32 = lzss32_decode(&ctx->lzss32_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, l_out_max, &ctx->rledec_len);
+        if (err32 != LZSS32_ERR_NONE)
+            goto carith_extract_damaged;
+        if (rle_decode(ctx->rledec + LZSS32_WINDOW_SIZE, ctx->decomp, ctx->rledec_len, l_out_max, &ctx->decomp_len) != 0)
+            goto carith_extract_damaged;
     } else if (l_schemenum == LZSSAC) {
         // decompress into lzss4dec, then copy the text after the window into decomp and set decomp's len
         lzss4_prepare_default_dictionary(&ctx->lzss4_context, ctx->rledec);
-        err = lzss4_decode(&ctx->lzss4_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, &ctx->rledec_len);
-        if (err != LZSS_ERR_NONE) {
-            fprintf(stderr, "LZSSAC lzss4 error: %s what the AC decompressor gave us: len %ld", lzss4_strerror(err), ctx->lzssdec_len);
-//            ccct_print_hex(ctx->lzssdec, ctx->lzssdec_len);
-            exit(EXIT_FAILURE);
-        }
+        err = lzss4_decode(&ctx->lzss4_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, l_out_max, &ctx->rledec_len);
+        if (err != LZSS_ERR_NONE)
+            goto carith_extract_damaged;
         //        printf("lzss4 output: (%ld) ", ctx->rledec_len);
         //        ccct_print_hex(ctx->rledec + LZSS_WINDOW_SIZE, ctx->rledec_len);
         memcpy(ctx->decomp, ctx->rledec + LZSS_WINDOW_SIZE, ctx->rledec_len);
         ctx->decomp_len = ctx->rledec_len;
     } else if (l_schemenum == LZSS32AC) {
         lzss32_prepare_default_dictionary(&ctx->lzss32_context, ctx->rledec);
-        err32 = lzss32_decode(&ctx->lzss32_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, &ctx->rledec_len);
-        if (err32 != LZSS32_ERR_NONE) {
-            fprintf(stderr, "LZSS32AC lzss32 error: %s what the AC decompressor gave us: len %ld", lzss32_strerror(err32), ctx->lzssdec_len);
-//            ccct_print_hex(ctx->lzssdec, ctx->lzssdec_len);
-            exit(EXIT_FAILURE);
-        }
+        err32 = lzss32_decode(&ctx->lzss32_context, ctx->lzssdec, ctx->lzssdec_len, ctx->rledec, l_out_max, &ctx->rledec_len);
+        if (err32 != LZSS32_ERR_NONE)
+            goto carith_extract_damaged;
         memcpy(ctx->decomp, ctx->rledec + LZSS32_WINDOW_SIZE, ctx->rledec_len);
         ctx->decomp_len = ctx->rledec_len;
     }
@@ -972,4 +2565,73 @@ carith_extract_skipac:
 
 //    printf("after rle decode: decomp_len %ld\n", ctx->decomp_len);
     return CARITH_ERR_NONE;
+
+carith_extract_damaged:
+    // nothing trustworthy came out of it, let the caller's CRC and length checks see that
+    ctx->decomp_len = 0;
+    return CARITH_ERR_DAMAGED;
+}
+
+/**
+ * @brief Build a file wide frequency table for carith_shared_load
+ * Every symbol gets a count of at least 1, so any segment can be coded with
+ * it. The table is written the same way as a segment's own table.
+ *
+ * @param[in] a_hist Number of times each symbol occurs across the file
+ * @param[out] a_out Table, at least CARITH_SHARED_TABLE_MAX bytes
+ * @param[out] a_out_len Length of the table
+ */
+
+carith_error_t carith_shared_build(const uint64_t *a_hist, uint8_t *a_out, uint16_t *a_out_len)
+{
+    carith_comp_ctx *l_ctx;
+    uint64_t l_total = 0;
+    size_t i;
+
+    l_ctx = aligned_alloc(CARITH_CACHE_LINE, sizeof(carith_comp_ctx));
+    if (l_ctx == NULL)
+        return CARITH_ERR_MEMORY;
+    for (i = 0; i < 256; ++i) {
+        l_ctx->freq.count[i] = a_hist[i] + 1;
+        l_total += l_ctx->freq.count[i];
+    }
+    freq_normalize(l_ctx, l_total, CARITH_NORM_BITS);
+    freq_table_write(l_ctx, a_out, a_out_len);
+    free(l_ctx);
+    return CARITH_ERR_NONE;
+}
+
+/**
+ * @brief Give a context the file's shared frequency table
+ * Segments compressed with CARITH_CODER_AC32, CARITH_CODER_AC32X or
+ * CARITH_CODER_RC afterwards may use it in place of their own table, and
+ * segments that did need it loaded to be extracted.
+ *
+ * @param[in] ctx Pointer to an initialized carith context
+ * @param[in] a_table Table written by carith_shared_build
+ * @param[in] a_table_len Length of the table
+ */
+
+carith_error_t carith_shared_load(carith_comp_ctx *ctx, const uint8_t *a_table, uint16_t a_table_len)
+{
+    uint8_t l_table[2 * CARITH_SHARED_TABLE_MAX];
+    uint64_t l_total;
+    size_t i;
+
+    ctx->shared_set = 0;
+    if ((a_table_len == 0) || (a_table_len > CARITH_SHARED_TABLE_MAX))
+        return CARITH_ERR_TABLE;
+    // zero padded, so a short table reads zeroes rather than whatever follows it
+    memset(l_table, 0, sizeof(l_table));
+    memcpy(l_table, a_table, a_table_len);
+    l_total = freq_table_read(ctx, l_table);
+    if (l_total != (1 << CARITH_NORM_BITS))
+        return CARITH_ERR_TABLE;
+    for (i = 0; i < 256; ++i) {
+        if (ctx->freq.count[i] == 0)
+            return CARITH_ERR_TABLE;
+        ctx->shared[i] = ctx->freq.count[i];
+    }
+    ctx->shared_set = 1;
+    return CARITH_ERR_NONE;
 }
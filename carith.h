@@ -40,8 +40,6 @@
 extern "C" {
 #endif
 
-#pragma pack(1)
-
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -56,21 +54,101 @@ extern "C" {
 #define LZSS_WINDOW_SIZE 4095               ///< Extra space in buffers for LZSS window
 #define LZSS32_WINDOW_SIZE 32767            ///< LZSS32's is a little bigger
 
+#define CARITH_CACHE_LINE 64                ///< Hot tables start on their own cache line, and contexts never share one
+
+/**
+ * @struct carith_freq_table_t
+ * @brief Frequency table, laid out as two arrays so a search over count_base touches only count_base
+ */
+
+typedef struct {
+    uint64_t            count_base[256];    ///< Running tally of counts so far in the table
+    uint64_t            count[256];         ///< Number of times each symbol occurs in plaintext
+} carith_freq_table_t;
+
+#define CARITH_NORM_BITS 16                  ///< CARITH_CODER_AC32 scales every frequency table to total 2^CARITH_NORM_BITS
+#define CARITH_QUANT_BITS 16                 ///< CARITH_CODER_AC scales the frequency table of any segment longer than 2^CARITH_QUANT_BITS to total that
+#define CARITH_RANS_BITS 12                  ///< CARITH_CODER_RANS scales every frequency table to total 2^CARITH_RANS_BITS
+#define CARITH_HUFF_BITS 11                  ///< Longest CARITH_CODER_HUFF code, and the bits its decoder looks up at a time
+#define CARITH_AUTO_SLACK 10                 ///< Default auto_slack, in thousandths
+#define CARITH_DECODE_LUT_BITS 12            ///< The decoder's lookup table has this many bits worth of buckets
+#define CARITH_SHARED_TABLE_MAX 1024         ///< Largest a shared table written by carith_shared_build can be
+
+/**
+ * @struct carith_decode_table_t
+ * @brief Built by the decoder from the frequency table, maps a count position to its symbol in O(1)
+ *
+ * Only symbols that occur are listed, in count_base order, with sym[k]
+ * covering count positions start[k] up to start[k + 1]. The count range is
+ * cut into buckets of 2^shift positions, and lut[] holds the first symbol
+ * touching each bucket, so finding a symbol is one table lookup followed by
+ * a step or two forward at most.
+ */
+
+typedef struct {
+    uint64_t            start[257];         ///< count_base of each present symbol, then the total
+    uint8_t             lut[1 << CARITH_DECODE_LUT_BITS]; ///< Index into sym/start of the first symbol in each bucket
+    uint8_t             sym[256];           ///< Present symbols, in count_base order
+    uint16_t            count;              ///< Number of present symbols
+    uint8_t             shift;              ///< Count position >> shift is the bucket
+} carith_decode_table_t;
+
+#define CARITH_CM_O2_BITS 18                 ///< CARITH_CODER_CM hashes order 2 contexts into 2^CARITH_CM_O2_BITS slots
+
+/**
+ * @struct carith_cm_t
+ * @brief CARITH_CODER_CM's model: bit probabilities under order 0, 1 and 2 contexts, and the mixer that weighs them
+ *
+ * Around 640k all told, so the tables that are hit for every bit stay in L2.
+ * It's allocated once per context and reset at the start of each segment.
+ */
+
+typedef struct {
+    uint16_t            o0[256];            ///< Probability of a 1, 16 bit, by the bits of this byte so far
+    uint16_t            o1[65536];          ///< ... and the byte before
+    uint16_t            o2[1 << CARITH_CM_O2_BITS]; ///< ... and the two bytes before, hashed
+    int32_t             mix[256][3];        ///< Mixer weights, 16.16, one set per partial byte
+    int16_t             stretch[4096];      ///< ln(p / (1 - p)), the inverse of squash
+} carith_cm_t;
+
+/**
+ * @struct carith_recip_t
+ * @brief Precomputed reciprocal of a 64-bit divisor, for exact 128/64 division by multiplying
+ *
+ * Möller and Granlund's "Improved division by invariant integers": the
+ * divisor is normalized so its top bit is set, and v = floor((2^128 - 1) / d) - 2^64.
+ * A division then costs two multiplies and at most two corrections, and its
+ * quotient is exactly the one a real division would give.
+ */
+
 typedef struct {
-    uint64_t            count_base;         ///< Running tally of counts so far in the table
-    uint64_t            count;              ///< Number of times this symbol occurs in plaintext
-} carith_freq_entry_t;
+    uint64_t            divisor;            ///< Divisor as given
+    uint64_t            d;                  ///< Divisor, normalized
+    uint64_t            v;                  ///< Reciprocal of the normalized divisor
+    uint8_t             shift;              ///< How far the divisor was shifted left to normalize it
+} carith_recip_t;
 
 typedef struct {
+    carith_freq_table_t freq __attribute__((aligned(CARITH_CACHE_LINE))); ///< Frequency table, contains list of ranges for all possible symbols
+    carith_decode_table_t dec __attribute__((aligned(CARITH_CACHE_LINE))); ///< Decoder's symbol lookup, built from freq
+    uint32_t            rans_slot[1 << CARITH_RANS_BITS]; ///< rANS decoder's table, one entry per count position: symbol, count - 1, offset into the symbol's range
+    uint32_t            huff_dec[1 << CARITH_HUFF_BITS]; ///< Huffman decoder's table, the symbols whose codes fit whole in each CARITH_HUFF_BITS peek
+    carith_recip_t      recip;              ///< Reciprocal of the segment's symbol count, the divisor for every range calculation
     uint8_t             scheme;             ///< compression chain specifier
+    uint8_t             coder;              ///< Entropy coder scheme_ac runs, one of carith_coder_t
+    uint16_t            auto_slack;         ///< CARITH_CODER_AUTO takes a faster coder whose output is at most this many thousandths larger than the smallest
     uint32_t            block_num;          ///< Optional tag for block number, used by implementation
-    carith_freq_entry_t freq[256];          ///< Frequency table, contains list of ranges for all possible symbols
-    uint8_t             freq_comp[1024];    ///< Compressed frequency table, either enumerated or full
+    uint8_t             freq_comp[1024];    ///< Compressed frequency table: enumerated, full or compact
     uint16_t            freq_comp_len;      ///< Length of compressed frequency table
+    uint32_t            shared[256];        ///< File wide table loaded by carith_shared_load, normalized like CARITH_CODER_AC32's
+    uint8_t             shared_set;         ///< Nonzero once shared holds a table
+    uint8_t             table_ref;          ///< How the segment being compressed sends its table: own, shared as is, or deltas from shared
     cbit_cursor_t       bc;                 ///< Bit cursor used by carith to write out frequency tables
     lzss4_comp_ctx      lzss4_context;      ///< Our LZSS4 context
     lzss32_comp_ctx     lzss32_context;     ///< Our LZSS32 context
-    uint8_t            *plain;              ///< Buffer for plaintext to be compressed
+    carith_cm_t        *cm;                 ///< CARITH_CODER_CM's model
+    uint8_t            *plain;              ///< Plaintext to be compressed, either plain_buf or caller supplied (e.g. a mapped input file)
+    uint8_t            *plain_buf;          ///< Buffer allocated for plaintext
     size_t              plain_len;          ///< Plaintext length
     uint8_t            *rleenc;             ///< Buffer for RLE encoded data
     size_t              rle_intermediate;   ///< Size of plain smooshed to RLE, if specified in scheme
@@ -78,22 +156,53 @@ typedef struct {
     size_t              lzss_intermediate;  ///< Size of LZSS encoded data
     uint8_t             *comp;              ///< Buffer for compressed tokens, larger than plaintext buffer to guard against over-ratio compresions
     size_t              comp_len;           ///< Length of compressed token stream
+    size_t              comp_size;          ///< Allocated size of comp
     uint8_t            *lzssdec;            ///< Buffer for LZSS compression tokens to be decoded
     size_t              lzssdec_len;        ///< Length of LZSS decode buffer
     uint8_t            *rledec;             ///< Buffer for RLE decode
     size_t              rledec_len;         ///< Length of RLE data to be decoded
     uint8_t            *decomp;             ///< Buffer for decompressed data
     size_t              decomp_len;         ///< Length of decompressed data
-} carith_comp_ctx;
+} __attribute__((aligned(CARITH_CACHE_LINE))) carith_comp_ctx;
 
 // scheme bits - order of operations: RLE, then LZSS4/LZSS32, then AC. OR these together to make a compression chain
 const static uint8_t scheme_ac = 0x80;
 const static uint8_t scheme_rle = 0x40;
 const static uint8_t scheme_lzss4 = 0x20;
 const static uint8_t scheme_lzss32 = 0x10;
+const static uint8_t scheme_xcoder = 0x08; // the entropy stage isn't the original AC, the first byte of the frequency table says which coder it is
 const static uint8_t scheme_stored = 0x02;
 const static uint8_t scheme_roulette = 0x01;
 
+/**
+ * @enum carith_coder_t
+ * @brief Entropy coders the scheme_ac stage can run.
+ *
+ * CARITH_CODER_AC is the original 64-bit arithmetic coder and still needs no
+ * scheme_xcoder, but a segment longer than 2^CARITH_QUANT_BITS has its counts
+ * scaled to total 2^CARITH_QUANT_BITS, and the frequency table of any coder
+ * may be written as a compact one. Readers older than either change can't
+ * extract those segments, so carchive never writes them under the original
+ * carchive_cookie. Exact counts of any length still decode, which keeps
+ * original format files readable. Any other coder sets scheme_xcoder in the segment's
+ * scheme and puts its carith_coder_t in front of its frequency table.
+ */
+
+typedef enum {
+    CARITH_CODER_AC,                        ///< 64-bit arithmetic coder, exact counts up to 2^CARITH_QUANT_BITS bytes of segment, scaled past that
+    CARITH_CODER_AC32,                      ///< 32-bit range coder, counts scaled to a power of two total so coding needs no division
+    CARITH_CODER_AC32X,                     ///< Four CARITH_CODER_AC32 coders taking turns, one stream each, so decoding overlaps them
+    CARITH_CODER_RANS,                      ///< rANS, four interleaved states, decodes with one table lookup and no division per byte
+    CARITH_CODER_HUFF,                      ///< Canonical Huffman, several symbols per decode lookup. Fastest, gives up a little ratio
+    CARITH_CODER_ADAPT,                     ///< Adaptive order 0 range coder, no frequency table in the segment, so small segments pay nothing for one
+    CARITH_CODER_CM,                        ///< Adaptive order 1/order 2 context mixing, a bit at a time. Best ratio, slowest by far, so auto never picks it
+    CARITH_CODER_RC,                        ///< CARITH_CODER_AC32's tables through a carry propagating range coder, LZMA style, renormalizing on range alone
+    CARITH_CODER_COUNT,
+    CARITH_CODER_AUTO = CARITH_CODER_COUNT  ///< Try the coders, keep the fastest to decode that compresses about as well as the best. Never written to a segment
+} carith_coder_t;
+
+#define CARITH_CODER_SHARED 0x80            ///< Set on the coder byte when the segment's table is the file's shared table, or deltas from it
+
 /**
  * @enum carith_error_t
  * @brief An enumerated list of return error codes.
@@ -101,14 +210,19 @@ const static uint8_t scheme_roulette = 0x01;
 
 typedef enum {
     CARITH_ERR_NONE,
-    CARITH_ERR_MEMORY
+    CARITH_ERR_MEMORY,
+    CARITH_ERR_TABLE,
+    CARITH_ERR_DAMAGED
 } carith_error_t;
 
 const char    *carith_strerror   (carith_error_t a_errno);
+const char    *carith_coder_name (carith_coder_t a_coder);
 carith_error_t carith_init_ctx   (carith_comp_ctx *ctx, size_t a_worksize);
 carith_error_t carith_free_ctx   (carith_comp_ctx *ctx);
 carith_error_t carith_compress   (carith_comp_ctx *ctx);
 carith_error_t carith_extract    (carith_comp_ctx *ctx);
+carith_error_t carith_shared_build(const uint64_t *a_hist, uint8_t *a_out, uint16_t *a_out_len);
+carith_error_t carith_shared_load (carith_comp_ctx *ctx, const uint8_t *a_table, uint16_t a_table_len);
 
 #ifdef __cplusplus
 }
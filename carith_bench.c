@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "carith.h"
+
+#define SEGSIZE 524288
+#define PASSES 3
+
+static uint8_t *corpus;
+static size_t corpus_len;
+static uint8_t shared_table[CARITH_SHARED_TABLE_MAX];
+static uint16_t shared_table_len;
+carith_comp_ctx *ctx;
+
+static double now()
+{
+    struct timespec l_ts;
+    clock_gettime(CLOCK_MONOTONIC, &l_ts);
+    return l_ts.tv_sec + l_ts.tv_nsec / 1e9;
+}
+
+// pull every regular file in a_dir into the corpus, back to back
+void load_dir(const char *a_dir)
+{
+    DIR *l_dir;
+    struct dirent *l_ent;
+    struct stat l_stat;
+    char l_path[1024];
+
+    l_dir = opendir(a_dir);
+    if (l_dir == NULL) {
+        fprintf(stderr, "can't open %s\n", a_dir);
+        exit(EXIT_FAILURE);
+    }
+    while ((l_ent = readdir(l_dir)) != NULL) {
+        snprintf(l_path, sizeof(l_path), "%s/%s", a_dir, l_ent->d_name);
+        if ((stat(l_path, &l_stat) < 0) || !S_ISREG(l_stat.st_mode) || (l_stat.st_size == 0))
+            continue;
+        FILE *l_f = fopen(l_path, "rb");
+        if (l_f == NULL)
+            continue;
+        corpus = realloc(corpus, corpus_len + l_stat.st_size);
+        if (corpus == NULL) {
+            fprintf(stderr, "realloc");
+            exit(EXIT_FAILURE);
+        }
+        corpus_len += fread(corpus + corpus_len, 1, l_stat.st_size, l_f);
+        fclose(l_f);
+    }
+    closedir(l_dir);
+}
+
+// compress and extract the whole corpus a segment at a time with one scheme,
+// checking every segment comes back intact
+void bench(const char *a_name, uint8_t a_scheme, carith_coder_t a_coder)
+{
+    int l_pass;
+    size_t l_off, l_len;
+    size_t l_comp_total = 0;
+    double l_comp_secs = 0, l_ext_secs = 0, l_t;
+
+    for (l_pass = 0; l_pass < PASSES; ++l_pass) {
+        l_comp_total = 0;
+        for (l_off = 0; l_off < corpus_len; l_off += SEGSIZE) {
+            l_len = (corpus_len - l_off < SEGSIZE) ? corpus_len - l_off : SEGSIZE;
+            ctx->plain = ctx->plain_buf;
+            memcpy(ctx->plain, corpus + l_off, l_len);
+            ctx->plain_len = l_len;
+            ctx->scheme = a_scheme;
+            ctx->coder = a_coder;
+            l_t = now();
+            carith_compress(ctx);
+            l_comp_secs += now() - l_t;
+            l_comp_total += ctx->comp_len + ctx->freq_comp_len;
+            l_t = now();
+            carith_extract(ctx);
+            l_ext_secs += now() - l_t;
+            if ((ctx->decomp_len != l_len) || (memcmp(ctx->decomp, corpus + l_off, l_len) != 0)) {
+                printf("%s: segment at %zu did not survive the round trip\n", a_name, l_off);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    // a shared table is in the archive header once, charge it once
+    if (ctx->shared_set)
+        l_comp_total += shared_table_len;
+    printf("%-10s ratio %7.3f%%  compress %8.2f MB/s  extract %8.2f MB/s\n", a_name,
+           (double)l_comp_total / (double)corpus_len * 100.0,
+           (double)corpus_len * PASSES / l_comp_secs / 1e6, (double)corpus_len * PASSES / l_ext_secs / 1e6);
+}
+
+// load the whole corpus's table into ctx, as --sharedtable would
+void shared_load()
+{
+    uint64_t l_hist[256];
+    size_t i;
+
+    memset(l_hist, 0, sizeof(l_hist));
+    for (i = 0; i < corpus_len; ++i)
+        l_hist[corpus[i]]++;
+    if ((carith_shared_build(l_hist, shared_table, &shared_table_len) != CARITH_ERR_NONE) ||
+        (carith_shared_load(ctx, shared_table, shared_table_len) != CARITH_ERR_NONE)) {
+        fprintf(stderr, "shared table");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: carith_bench <dir> [dir...]\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 1; i < argc; ++i)
+        load_dir(argv[i]);
+    if (corpus_len == 0) {
+        fprintf(stderr, "nothing to compress\n");
+        exit(EXIT_FAILURE);
+    }
+    ctx = aligned_alloc(64, (sizeof(carith_comp_ctx) + 63) & ~(size_t)63);
+    if ((ctx == NULL) || (carith_init_ctx(ctx, SEGSIZE) != CARITH_ERR_NONE)) {
+        fprintf(stderr, "init context");
+        exit(EXIT_FAILURE);
+    }
+    printf("corpus %zu bytes, %d passes, %dk segments\n", corpus_len, PASSES, SEGSIZE / 1024);
+    bench("AC", scheme_ac, CARITH_CODER_AC);
+    bench("AC32", scheme_ac, CARITH_CODER_AC32);
+    bench("AC32x4", scheme_ac, CARITH_CODER_AC32X);
+    bench("RC", scheme_ac, CARITH_CODER_RC);
+    bench("RANS", scheme_ac, CARITH_CODER_RANS);
+    bench("HUFF", scheme_ac, CARITH_CODER_HUFF);
+    bench("ADAPT", scheme_ac, CARITH_CODER_ADAPT);
+    bench("CM", scheme_ac, CARITH_CODER_CM);
+    bench("RLE+AC", scheme_rle | scheme_ac, CARITH_CODER_AC);
+    bench("LZSS4+AC", scheme_lzss4 | scheme_ac, CARITH_CODER_AC);
+    bench("LZSS4+AC32", scheme_lzss4 | scheme_ac, CARITH_CODER_AC32);
+    bench("LZSS4+RC", scheme_lzss4 | scheme_ac, CARITH_CODER_RC);
+    bench("LZSS32+AC", scheme_lzss32 | scheme_ac, CARITH_CODER_AC);
+    bench("ICMS", scheme_roulette, CARITH_CODER_AC);
+    bench("ICMS/AC32", scheme_roulette, CARITH_CODER_AC32);
+    bench("ICMS/AC32x4", scheme_roulette, CARITH_CODER_AC32X);
+    bench("ICMS/RANS", scheme_roulette, CARITH_CODER_RANS);
+    bench("ICMS/HUFF", scheme_roulette, CARITH_CODER_HUFF);
+    bench("ICMS/ADAPT", scheme_roulette, CARITH_CODER_ADAPT);
+    bench("ICMS/CM", scheme_roulette, CARITH_CODER_CM);
+    bench("ICMS/auto", scheme_roulette, CARITH_CODER_AUTO);
+    shared_load();
+    bench("AC32/shared", scheme_ac, CARITH_CODER_AC32);
+    bench("ICMS/AC32/shared", scheme_roulette, CARITH_CODER_AC32);
+    ctx->shared_set = 0;
+    carith_free_ctx(ctx);
+    free(ctx);
+    free(corpus);
+    return 0;
+}
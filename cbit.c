@@ -1,7 +1,7 @@
 /**
  *
  * C Bit Read/Write Library
- * 2025/Nov/23 - Revision 0.80 alpha
+ * 2026/Oct/17 - Revision 0.80 alpha
  *
  * Created by: Stephen Sviatko
  *
@@ -38,6 +38,25 @@
 
 static uint8_t cbit_byte_mask[] = { 0xfe, 0xfd, 0xfb, 0xf7, 0xef, 0xdf, 0xbf, 0x7f }; ///< Byte mask to mask off requested bit
 
+// move the cursor on by a_count bits, never more than are left in the current byte
+static inline void cbit_advance(cbit_cursor_t *a_cursor, uint16_t a_count)
+{
+	if (a_cursor->bit >= a_count) {
+		a_cursor->bit -= a_count;
+	} else {
+		++a_cursor->byte;
+		a_cursor->bit = 7;
+	}
+}
+
+// the byte under the cursor, or zero if it's past the limit
+static inline uint8_t cbit_byte(cbit_cursor_t *a_cursor)
+{
+	if ((a_cursor->limit > 0) && (a_cursor->byte >= a_cursor->limit))
+		return 0;
+	return a_cursor->buffer[a_cursor->byte];
+}
+
 /**
  * @brief Write a single bit at current cursor position
  *
@@ -57,38 +76,39 @@ void cbit_write(cbit_cursor_t *a_cursor, unsigned int a_bit)
 		a_cursor->buffer[a_cursor->byte] |= l_or;
 
 	// advance the cursor
-	if (a_cursor->bit > 0) {
-		--a_cursor->bit;
-	} else {
-		++a_cursor->byte;
-		a_cursor->bit = 7;
-	}
+	cbit_advance(a_cursor, 1);
 }
 
 /**
  * @brief Write many bits at current cursor position
  *
  * @param[in] a_cursor Pointer to cursor to use
- * @param[in] a_bits Integer containing bits to write
+ * Writing 0 bits does nothing.
+ *
+ * @param[in] a_bits Integer containing bits to write, in its low a_count bits
  * @param[in] a_count Number of bits to write
  */
 
 void cbit_write_many(cbit_cursor_t *a_cursor, uint64_t a_bits, uint16_t a_count)
 {
+	uint16_t l_n;
+	uint8_t l_shift, l_mask;
+
 	// sanity check our bit count
-	if (!((a_count <= 64) && (a_count > 0))) {
-		fprintf(stderr, "cbit_write_many: insane bit count of %d. bit count must between 1-64.", a_count);
+	if (a_count > 64) {
+		fprintf(stderr, "cbit_write_many: insane bit count of %d. bit count must between 0-64.", a_count);
 		exit(EXIT_FAILURE);
 	}
 
-	// shift everything over all the way to the left
-	a_bits <<= (64 - a_count);
-
-	// feed them into write_bit one at a time.
+	// as many bits at a time as are left in the cursor's byte, most significant first
 	while (a_count > 0) {
-		cbit_write(a_cursor, (a_bits & 0x8000000000000000ULL) > 0);
-		a_bits <<= 1;
-		--a_count;
+		l_n = (a_count < a_cursor->bit + 1) ? a_count : a_cursor->bit + 1;
+		l_shift = a_cursor->bit + 1 - l_n;
+		l_mask = ((1 << l_n) - 1) << l_shift;
+		a_count -= l_n;
+		a_cursor->buffer[a_cursor->byte] &= ~l_mask;
+		a_cursor->buffer[a_cursor->byte] |= ((a_bits >> a_count) << l_shift) & l_mask;
+		cbit_advance(a_cursor, l_n);
 	}
 }
 
@@ -101,15 +121,10 @@ void cbit_write_many(cbit_cursor_t *a_cursor, uint64_t a_bits, uint16_t a_count)
 int cbit_read(cbit_cursor_t *a_cursor)
 {
 	uint8_t l_mask = cbit_byte_mask[a_cursor->bit] ^ 0xff;
-	uint8_t l_byte = a_cursor->buffer[a_cursor->byte] & l_mask;
+	uint8_t l_byte = cbit_byte(a_cursor) & l_mask;
 
 	// advance the cursor
-	if (a_cursor->bit > 0) {
-		--a_cursor->bit;
-	} else {
-		++a_cursor->byte;
-		a_cursor->bit = 7;
-	}
+	cbit_advance(a_cursor, 1);
 
 	return (l_byte > 0); // true, if the bit we requested is set
 }
@@ -118,28 +133,48 @@ int cbit_read(cbit_cursor_t *a_cursor)
  * @brief Read many bits at current cursor position
  *
  * @param[in] a_cursor Pointer to cursor to use
- * @param[in] a_count Number of bits to read
+ * @param[in] a_count Number of bits to read, reading 0 bits returns 0
  */
 
 uint64_t cbit_read_many(cbit_cursor_t *a_cursor, uint16_t a_count)
 {
+	uint16_t l_n;
+	uint8_t l_shift;
+
 	// sanity check our bit count
-	if (!((a_count <= 64) && (a_count > 0))) {
-		fprintf(stderr, "cbit_read_many: insane bit count of %d. bit count must between 1-64.", a_count);
+	if (a_count > 64) {
+		fprintf(stderr, "cbit_read_many: insane bit count of %d. bit count must between 0-64.", a_count);
 		exit(EXIT_FAILURE);
 	}
 
 	uint64_t l_ret = 0;
 
+	// as many bits at a time as are left in the cursor's byte
 	while (a_count > 0) {
-		l_ret <<= 1;
-		if (cbit_read(a_cursor) > 0)
-			l_ret |= 0x0000000000000001ULL;
-		--a_count;
+		l_n = (a_count < a_cursor->bit + 1) ? a_count : a_cursor->bit + 1;
+		l_shift = a_cursor->bit + 1 - l_n;
+		l_ret = (l_ret << l_n) | ((cbit_byte(a_cursor) >> l_shift) & ((1 << l_n) - 1));
+		a_count -= l_n;
+		cbit_advance(a_cursor, l_n);
 	}
 	return l_ret;
 }
 
+/**
+ * @brief Zero the rest of the cursor's byte, if it's partly written
+ *
+ * @param[in] a_cursor Pointer to cursor to use
+ *
+ * @return Number of bytes written so far, counting the padded one
+ */
+
+uint64_t cbit_pad(cbit_cursor_t *a_cursor)
+{
+	if (a_cursor->bit < 7)
+		cbit_write_many(a_cursor, 0, a_cursor->bit + 1);
+	return a_cursor->byte;
+}
+
 /**
  * @brief Discover how many bits wide an integer value is
  *
@@ -1,7 +1,7 @@
 /**
  *
  * C Bit Read/Write Library
- * 2025/Nov/23 - Revision 0.80 alpha
+ * 2026/Oct/17 - Revision 0.80 alpha
  *
  * Created by: Stephen Sviatko
  *
@@ -41,8 +41,6 @@
 extern "C" {
 #endif
 
-#pragma pack(1)
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -52,19 +50,23 @@ extern "C" {
  * @brief The bit cursor
  *
  * How to use: Initialize this structure with byte = 0, bit = 7, and buffer
- * set to point to a byte buffer that you wish to operate upon.
+ * set to point to a byte buffer that you wish to operate upon. When reading
+ * something that may be damaged, set limit to the length of the buffer, and
+ * everything from there on reads as zero bits; otherwise leave it 0.
  */
 
 typedef struct {
     uint64_t byte;   ///< Byte counter into buffer
     uint8_t  bit;    ///< Next bit to manipulate on above byte
     uint8_t *buffer; ///< Pointer to buffer we are working with
+    uint64_t limit;  ///< Reads at or past this byte return zero bits, 0 for no limit
 } cbit_cursor_t;
 
 void     cbit_write         (cbit_cursor_t *a_cursor, unsigned int a_bit);
 void     cbit_write_many    (cbit_cursor_t *a_cursor, uint64_t a_bits, uint16_t a_count);
 int      cbit_read          (cbit_cursor_t *a_cursor);
 uint64_t cbit_read_many     (cbit_cursor_t *a_cursor, uint16_t a_count);
+uint64_t cbit_pad           (cbit_cursor_t *a_cursor);
 uint16_t cbit_bit_width     (uint64_t a_val);
 
 #ifdef __cplusplus
@@ -35,6 +35,9 @@
 
 #include "color_print.h"
 
+#include <unistd.h>
+#include <sys/uio.h>
+
 static char g_ansi_highlight[ANSIBUFFLEN];
 static char g_ansi_heading[ANSIBUFFLEN];
 static char g_ansi_error[ANSIBUFFLEN];
@@ -43,8 +46,25 @@ static char g_ansi_bullet[ANSIBUFFLEN];
 static char g_ansi_debug[ANSIBUFFLEN];
 
 static int g_nocolor; ///< Set to 1 to disable color printing
-static int g_debug;   ///< Set to 1 to enable debug printing
-static pthread_mutex_t g_debug_mtx; ///< protect debug messages in multithreaded environment
+int g_cp_log_level = CP_LOG_NONE; ///< Debug messages at or below this level get printed
+
+/**
+ * @struct cp_log_ring_t
+ * @brief One thread's pending debug output
+ */
+
+typedef struct cp_log_ring {
+    char buf[CP_LOG_RING]; ///< Formatted messages
+    size_t head; ///< Oldest unwritten byte
+    size_t len; ///< Number of unwritten bytes
+    pthread_mutex_t lock; ///< Held while the ring is filled or drained, exit() drains it from whichever thread called it
+    struct cp_log_ring *next; ///< Next ring in g_log_rings
+} cp_log_ring_t;
+
+static pthread_key_t g_log_key; ///< Each thread's cp_log_ring_t
+static pthread_once_t g_log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_log_mtx = PTHREAD_MUTEX_INITIALIZER; ///< Guards g_log_rings
+static cp_log_ring_t *g_log_rings; ///< Every live thread's ring
 
 static uint16_t paren_opts[8];
 static uint16_t paren_count;
@@ -74,11 +94,94 @@ const uint8_t gs_standard_colors[][3] = {
     { 0xff, 0xff, 0xff }  // White
 };
 
+static void log_ring_drain(cp_log_ring_t *a_ring)
+{
+    struct iovec l_iov[2];
+    int l_iovcnt = 1;
+    ssize_t res;
+
+    if (a_ring->len == 0)
+        return;
+    // at most two pieces, the second one if the pending bytes wrap around the end
+    l_iov[0].iov_base = a_ring->buf + a_ring->head;
+    l_iov[0].iov_len = a_ring->len;
+    if (a_ring->head + a_ring->len > CP_LOG_RING) {
+        l_iov[0].iov_len = CP_LOG_RING - a_ring->head;
+        l_iov[1].iov_base = a_ring->buf;
+        l_iov[1].iov_len = a_ring->len - l_iov[0].iov_len;
+        l_iovcnt = 2;
+    }
+    do {
+        res = writev(STDERR_FILENO, l_iov, l_iovcnt);
+    } while ((res < 0) && (errno == EINTR));
+    // debug output is best effort, whatever happened it's gone now
+    a_ring->head = 0;
+    a_ring->len = 0;
+}
+
+static void log_ring_destroy(void *a_ring)
+{
+    // thread exit: off the list first, so exit() can't drain it while it's being freed
+    cp_log_ring_t **l_link;
+
+    pthread_mutex_lock(&g_log_mtx);
+    for (l_link = &g_log_rings; *l_link != NULL; l_link = &(*l_link)->next) {
+        if (*l_link == a_ring) {
+            *l_link = (*l_link)->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_log_mtx);
+    log_ring_drain(a_ring);
+    pthread_mutex_destroy(&((cp_log_ring_t *)a_ring)->lock);
+    free(a_ring);
+}
+
+static void log_flush_all()
+{
+    // exit() runs no key destructors, and any thread can call it while the others are
+    // still logging, so drain every ring there is
+    cp_log_ring_t *l_ring;
+
+    pthread_mutex_lock(&g_log_mtx);
+    for (l_ring = g_log_rings; l_ring != NULL; l_ring = l_ring->next) {
+        pthread_mutex_lock(&l_ring->lock);
+        log_ring_drain(l_ring);
+        pthread_mutex_unlock(&l_ring->lock);
+    }
+    pthread_mutex_unlock(&g_log_mtx);
+}
+
+static void log_key_init()
+{
+    pthread_key_create(&g_log_key, log_ring_destroy);
+    atexit(log_flush_all);
+}
+
+static cp_log_ring_t *log_ring()
+{
+    cp_log_ring_t *l_ring;
+
+    pthread_once(&g_log_once, log_key_init);
+    l_ring = pthread_getspecific(g_log_key);
+    if (l_ring == NULL) {
+        l_ring = calloc(1, sizeof(cp_log_ring_t));
+        if (l_ring != NULL) {
+            pthread_mutex_init(&l_ring->lock, NULL);
+            pthread_setspecific(g_log_key, l_ring);
+            pthread_mutex_lock(&g_log_mtx);
+            l_ring->next = g_log_rings;
+            g_log_rings = l_ring;
+            pthread_mutex_unlock(&g_log_mtx);
+        }
+    }
+    return l_ring;
+}
+
 void color_init(const int a_nocolor, const int a_debug)
 {
     g_nocolor = a_nocolor;
-    g_debug = a_debug;
-    pthread_mutex_init(&g_debug_mtx, NULL);
+    color_set_debug(a_debug);
 }
 
 void color_set_nocolor(const int a_nocolor)
@@ -88,7 +191,7 @@ void color_set_nocolor(const int a_nocolor)
 
 void color_set_debug(const int a_debug)
 {
-    g_debug = a_debug;
+    g_cp_log_level = a_debug;
 }
 
 void color_set_theme(cp_theme_t a_theme)
@@ -147,10 +250,10 @@ void color_set_theme(cp_theme_t a_theme)
 
 void color_free()
 {
-    pthread_mutex_destroy(&g_debug_mtx);
+    color_log_flush();
 }
 
-void color_progress(uint32_t a_sofar, uint32_t a_total)
+void color_progress(uint64_t a_sofar, uint64_t a_total)
 {
     static size_t l_lastsize = 0;
     int i;
@@ -168,10 +271,10 @@ void color_progress(uint32_t a_sofar, uint32_t a_total)
         printf("\b");
 
     // print our message to l_txt to gauge the size on screen
-    sprintf(l_txt, "(%u of %u) ", a_sofar, a_total);
+    sprintf(l_txt, "(%lu of %lu) ", a_sofar, a_total);
     l_lastsize = strlen(l_txt);
     // now print it on screen in color with ansi escape codes
-    color_printf("(*h%u*d of *h%u*d) ", a_sofar, a_total);
+    color_printf("(*h%lu*d of *h%lu*d) ", a_sofar, a_total);
 }
 
 char *color_rgb(uint8_t a_red, uint8_t a_green, uint8_t a_blue)
@@ -446,8 +549,11 @@ void color_printf(const char *format, ...)
     }
     edited_format[j] = 0;
 
+    if (g_cp_log_level > CP_LOG_NONE)
+        color_log_flush(); // keep our own debug output in order with everything else
+
     va_list args;
-    va_start(args);
+    va_start(args, format);
     vprintf(edited_format, args);
     va_end(args);
 }
@@ -456,6 +562,8 @@ void color_err_printf(int a_strerror, const char *format, ...)
 {
     // call this without a linefeed at the end
     char edited_format[BUFFLEN];
+    if (g_cp_log_level > CP_LOG_NONE)
+        log_flush_all(); // everybody's debug output leads up to this, so it goes first
     edited_format[0] = 0;
     if (!g_nocolor) strcat(edited_format, g_ansi_error);
     strcat(edited_format, format);
@@ -471,21 +579,59 @@ void color_err_printf(int a_strerror, const char *format, ...)
     va_end(args);
 }
 
-void color_debug(const char *format, ...)
+void color_log_flush()
 {
-    if (g_debug == 0)
-        return; // don't print anything if debug isn't turned on
-    pthread_mutex_lock(&g_debug_mtx);
+    // write out whatever the calling thread has waiting
+    cp_log_ring_t *l_ring;
+
+    pthread_once(&g_log_once, log_key_init);
+    l_ring = pthread_getspecific(g_log_key);
+    if (l_ring != NULL) {
+        pthread_mutex_lock(&l_ring->lock);
+        log_ring_drain(l_ring);
+        pthread_mutex_unlock(&l_ring->lock);
+    }
+}
+
+void color_log_write(int a_level, const char *format, ...)
+{
+    // call through color_debug/color_trace, which check the level for us
     char edited_format[BUFFLEN];
+    char l_msg[BUFFLEN];
+    cp_log_ring_t *l_ring;
+    size_t l_len, l_tail, l_first;
+    int res;
+
     edited_format[0] = 0;
     if (!g_nocolor)
         strcat(edited_format, g_ansi_debug);
-    strcat(edited_format, format);
+    strncat(edited_format, format, BUFFLEN - 2 * ANSIBUFFLEN);
     if (!g_nocolor)
         strcat(edited_format, g_ansi_default);
     va_list args;
     va_start(args, format);
-    vprintf(edited_format, args);
+    res = vsnprintf(l_msg, sizeof(l_msg), edited_format, args);
     va_end(args);
-    pthread_mutex_unlock(&g_debug_mtx);
+    if (res < 0)
+        return;
+    l_len = ((size_t)res < sizeof(l_msg)) ? (size_t)res : sizeof(l_msg) - 1;
+
+    l_ring = log_ring();
+    if (l_ring == NULL) {
+        // no memory for a ring, just write it
+        res = write(STDERR_FILENO, l_msg, l_len);
+        return;
+    }
+    pthread_mutex_lock(&l_ring->lock);
+    if (l_ring->len + l_len > CP_LOG_RING)
+        log_ring_drain(l_ring);
+    // copy in, wrapping around the end of the ring if we have to
+    l_tail = (l_ring->head + l_ring->len) % CP_LOG_RING;
+    l_first = (l_len < CP_LOG_RING - l_tail) ? l_len : CP_LOG_RING - l_tail;
+    memcpy(l_ring->buf + l_tail, l_msg, l_first);
+    memcpy(l_ring->buf, l_msg + l_first, l_len - l_first);
+    l_ring->len += l_len;
+    if (l_ring->len >= CP_LOG_FLUSH)
+        log_ring_drain(l_ring);
+    pthread_mutex_unlock(&l_ring->lock);
 }
@@ -31,6 +31,15 @@
  *
  * Extends printf and fprintf to enable color ANSI printing to the terminal.
  *
+ * Debug logging is leveled. color_debug() and color_trace() are macros that
+ * test the current level before anything else, so their arguments are never
+ * evaluated when the level is off, and building with -DCP_LOG_MAX=CP_LOG_NONE
+ * compiles them out entirely. Each thread formats its messages into its own
+ * ring buffer, which is written out in one piece when it fills up and when the
+ * thread exits, so threads never wait on each other to log. exit() writes out
+ * every thread's ring, whichever thread calls it.
+ * It goes to stderr, so debugging never ends up mixed into data on stdout.
+ *
  */
 
 #ifndef COLOR_PRINT_H
@@ -50,6 +59,16 @@ extern "C" {
 
 #define BUFFLEN 1024
 #define ANSIBUFFLEN 20
+#define CP_LOG_RING 16384  ///< Size of each thread's debug ring buffer
+#define CP_LOG_FLUSH 4096  ///< Write a thread's ring out once this much is waiting in it
+
+#define CP_LOG_NONE 0      ///< No debug output
+#define CP_LOG_DEBUG 1     ///< Per-file and per-segment detail
+#define CP_LOG_TRACE 2     ///< Everything, including the pipeline's inner workings
+
+#ifndef CP_LOG_MAX
+#define CP_LOG_MAX CP_LOG_TRACE ///< Highest level compiled in, anything above it costs nothing at all
+#endif
 
 /* GREEN theme */
 #define CP_GREEN_COLOR_HEADING   "\033[32m"          ///< Heading color
@@ -90,15 +109,31 @@ typedef enum {
     THEME_PURPLE
 } cp_theme_t;
 
+extern int g_cp_log_level; ///< Current debug level, only color_set_debug should change it
+
+/**
+ * @brief Log a message at a_level, evaluating the arguments only if that level is on
+ */
+
+#define color_log(a_level, ...) \
+    do { \
+        if (((a_level) <= CP_LOG_MAX) && __builtin_expect((a_level) <= g_cp_log_level, 0)) \
+            color_log_write((a_level), __VA_ARGS__); \
+    } while (0)
+
+#define color_debug(...) color_log(CP_LOG_DEBUG, __VA_ARGS__)
+#define color_trace(...) color_log(CP_LOG_TRACE, __VA_ARGS__)
+
 void color_init         (const int a_nocolor, const int a_debug);
 void color_set_theme    (cp_theme_t a_theme);
 void color_set_nocolor  (const int a_nocolor);
 void color_set_debug    (const int a_debug);
 void color_free         ();
-void color_progress     (uint32_t a_sofar, uint32_t a_total);
+void color_progress     (uint64_t a_sofar, uint64_t a_total);
 void color_printf       (const char *format, ...);
 void color_err_printf   (int a_strerror, const char *format, ...);
-void color_debug        (const char *format, ...);
+void color_log_write    (int a_level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void color_log_flush    ();
 char *color_256         (unsigned int a_color);
 char *color_256_bg      (unsigned int a_color);
 char *color_rgb         (uint8_t a_red, uint8_t a_green, uint8_t a_blue);
@@ -35,6 +35,15 @@
 
 #include "crc32.h"
 
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_HAVE_CLMUL
+#endif
+
 static uint32_t g_crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
     0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -81,7 +90,71 @@ static uint32_t g_crc32_tab[] = {
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t get_buffer_crc(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+static uint32_t g_crc32_slice[16][256]; ///< g_crc32_slice[k][n] is the CRC of byte n followed by k zero bytes
+static uint32_t g_crc32_x2n[32]; ///< g_crc32_x2n[n] is x^(2^n) modulo the polynomial, for crc32_combine
+static pthread_once_t g_crc32_once = PTHREAD_ONCE_INIT;
+static uint32_t (*g_crc32_impl)(uint32_t, uint8_t *, size_t) = crc32_table;
+static const char *g_crc32_impl_name = "table";
+
+/**
+ * @fn uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+ * @brief Multiply two polynomials modulo the CRC polynomial, both bit reflected
+ */
+
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ 0xEDB88320 : b >> 1;
+    }
+    return p;
+}
+
+/**
+ * @fn void crc32_init()
+ * @brief Build the slicing tables and pick the fastest implementation this CPU can run
+ */
+
+static void crc32_init()
+{
+    int i, k;
+
+    for (i = 0; i < 256; ++i)
+        g_crc32_slice[0][i] = g_crc32_tab[i];
+    for (k = 1; k < 16; ++k)
+        for (i = 0; i < 256; ++i)
+            g_crc32_slice[k][i] = (g_crc32_slice[k - 1][i] >> 8) ^ g_crc32_tab[g_crc32_slice[k - 1][i] & 0xFF];
+
+    // x^1, then keep squaring it
+    g_crc32_x2n[0] = 1U << 30;
+    for (k = 1; k < 32; ++k)
+        g_crc32_x2n[k] = crc32_multmodp(g_crc32_x2n[k - 1], g_crc32_x2n[k - 1]);
+
+    g_crc32_impl = crc32_slice16;
+    g_crc32_impl_name = "slice16";
+#ifdef CRC32_HAVE_CLMUL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        g_crc32_impl = crc32_clmul;
+        g_crc32_impl_name = "clmul";
+    }
+#endif
+}
+
+/**
+ * @fn uint32_t crc32_table(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+ * @brief Byte at a time table driven CRC32, runs anywhere
+ */
+
+uint32_t crc32_table(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
 {
     uint32_t l_crc = a_crcin;
     l_crc = l_crc ^ ~0U;
@@ -95,3 +168,219 @@ uint32_t get_buffer_crc(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
 
     return l_crc ^ ~0U;
 }
+
+/**
+ * @fn uint32_t crc32_slice16(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+ * @brief Slicing-by-16 CRC32, 16 independent table lookups per 16 bytes of input
+ */
+
+uint32_t crc32_slice16(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+{
+    pthread_once(&g_crc32_once, crc32_init);
+
+    uint32_t l_crc = a_crcin ^ ~0U;
+    uint32_t l_w[4];
+
+    while (a_len >= 16) {
+        memcpy(l_w, a_buff, 16);
+        uint32_t a = le32toh(l_w[0]) ^ l_crc;
+        uint32_t b = le32toh(l_w[1]);
+        uint32_t c = le32toh(l_w[2]);
+        uint32_t d = le32toh(l_w[3]);
+        l_crc = g_crc32_slice[15][a & 0xFF] ^ g_crc32_slice[14][(a >> 8) & 0xFF] ^
+                g_crc32_slice[13][(a >> 16) & 0xFF] ^ g_crc32_slice[12][a >> 24] ^
+                g_crc32_slice[11][b & 0xFF] ^ g_crc32_slice[10][(b >> 8) & 0xFF] ^
+                g_crc32_slice[9][(b >> 16) & 0xFF] ^ g_crc32_slice[8][b >> 24] ^
+                g_crc32_slice[7][c & 0xFF] ^ g_crc32_slice[6][(c >> 8) & 0xFF] ^
+                g_crc32_slice[5][(c >> 16) & 0xFF] ^ g_crc32_slice[4][c >> 24] ^
+                g_crc32_slice[3][d & 0xFF] ^ g_crc32_slice[2][(d >> 8) & 0xFF] ^
+                g_crc32_slice[1][(d >> 16) & 0xFF] ^ g_crc32_slice[0][d >> 24];
+        a_buff += 16;
+        a_len -= 16;
+    }
+    while (a_len--)
+        l_crc = g_crc32_tab[(l_crc ^ *a_buff++) & 0xFF] ^ (l_crc >> 8);
+
+    return l_crc ^ ~0U;
+}
+
+#ifdef CRC32_HAVE_CLMUL
+
+/**
+ * @fn uint32_t crc32_clmul_fold(uint32_t a_crc, const uint8_t *a_buff, size_t a_len)
+ * @brief Fold a_len bytes (at least 64, a multiple of 16) into a_crc with PCLMULQDQ
+ *
+ * Straight from Intel's "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction": four 128 bit lanes are folded forward 64 bytes at a
+ * time, collapsed into one, folded 16 bytes at a time through the rest of the
+ * input, then Barrett reduced down to 32 bits. The constants are for the bit
+ * reflected 0xEDB88320 polynomial. a_crc is the raw (not inverted) register.
+ */
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul_fold(uint32_t a_crc, const uint8_t *a_buff, size_t a_len)
+{
+    static const uint64_t __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t __attribute__((aligned(16))) k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t __attribute__((aligned(16))) poly[] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(a_buff + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(a_buff + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(a_buff + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(a_buff + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(a_crc));
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+    a_buff += 64;
+    a_len -= 64;
+
+    // fold four lanes at a time
+    while (a_len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i *)(a_buff + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(a_buff + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(a_buff + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(a_buff + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        a_buff += 64;
+        a_len -= 64;
+    }
+
+    // collapse the four lanes into one
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // fold whatever whole 16 byte blocks are left
+    while (a_len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)a_buff);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        a_buff += 16;
+        a_len -= 16;
+    }
+
+    // 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction down to 32
+    x0 = _mm_load_si128((const __m128i *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+#endif // CRC32_HAVE_CLMUL
+
+/**
+ * @fn uint32_t crc32_clmul(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+ * @brief Carry-less multiply folding CRC32, falls back to slicing-by-16 for short buffers and tails
+ *
+ * Only call this if crc32_clmul_supported() says so.
+ */
+
+uint32_t crc32_clmul(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+{
+#ifdef CRC32_HAVE_CLMUL
+    if (a_len >= 64) {
+        size_t l_chunk = a_len & ~(size_t)15;
+        a_crcin = crc32_clmul_fold(a_crcin ^ ~0U, a_buff, l_chunk) ^ ~0U;
+        a_buff += l_chunk;
+        a_len -= l_chunk;
+    }
+#endif
+    return crc32_slice16(a_crcin, a_buff, a_len);
+}
+
+/**
+ * @fn int crc32_clmul_supported()
+ * @brief Returns nonzero if this CPU can run crc32_clmul
+ */
+
+int crc32_clmul_supported()
+{
+    pthread_once(&g_crc32_once, crc32_init);
+    return g_crc32_impl == crc32_clmul;
+}
+
+/**
+ * @fn const char *crc32_impl_name()
+ * @brief Name of the implementation get_buffer_crc dispatches to
+ */
+
+const char *crc32_impl_name()
+{
+    pthread_once(&g_crc32_once, crc32_init);
+    return g_crc32_impl_name;
+}
+
+/**
+ * @fn uint32_t crc32_combine(uint32_t a_crc1, uint32_t a_crc2, uint64_t a_len2)
+ * @brief CRC of two buffers back to back, given the CRC of each one
+ *
+ * a_crc1 is the CRC of the first buffer, a_crc2 that of the second, and
+ * a_len2 the length of the second. Shifting a_crc1 past a_len2 zero bytes
+ * is a multiplication by x^(8 * a_len2), which takes O(log a_len2) steps
+ * using the precomputed powers of x, so it's cheap whatever the length.
+ */
+
+uint32_t crc32_combine(uint32_t a_crc1, uint32_t a_crc2, uint64_t a_len2)
+{
+    uint32_t l_p = 1U << 31; // x^0
+    unsigned int k = 3; // x^(2^3) is one byte's worth of shift
+
+    pthread_once(&g_crc32_once, crc32_init);
+    while (a_len2) {
+        if (a_len2 & 1)
+            l_p = crc32_multmodp(g_crc32_x2n[k & 31], l_p);
+        a_len2 >>= 1;
+        k++;
+    }
+    return crc32_multmodp(l_p, a_crc1) ^ a_crc2;
+}
+
+/**
+ * @fn uint32_t get_buffer_crc(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+ * @brief Rolling CRC32 of a buffer, using the fastest implementation the CPU supports
+ *
+ * Pass 0 as a_crcin for the first buffer, and the previous return value for
+ * every buffer after that.
+ */
+
+uint32_t get_buffer_crc(uint32_t a_crcin, uint8_t *a_buff, size_t a_len)
+{
+    pthread_once(&g_crc32_once, crc32_init);
+    return g_crc32_impl(a_crcin, a_buff, a_len);
+}
@@ -29,7 +29,11 @@
  * @file crc32.h
  * @brief CRC32 API
  *
- * Computes a rolling CRC32 on a buffer.
+ * Computes a rolling CRC32 on a buffer. get_buffer_crc picks PCLMULQDQ
+ * folding, slicing-by-16 or the plain byte table at first use, depending on
+ * what the CPU supports; the individual implementations are exported for
+ * benchmarking. crc32_combine joins the CRCs of two adjacent buffers, so
+ * pieces of a file can be checksummed independently.
  *
  */
 
@@ -43,7 +47,13 @@
 extern "C" {
 #endif
 
-uint32_t get_buffer_crc(uint32_t a_crcin, uint8_t *a_buff, size_t a_len);
+uint32_t    get_buffer_crc       (uint32_t a_crcin, uint8_t *a_buff, size_t a_len);
+uint32_t    crc32_table          (uint32_t a_crcin, uint8_t *a_buff, size_t a_len);
+uint32_t    crc32_slice16        (uint32_t a_crcin, uint8_t *a_buff, size_t a_len);
+uint32_t    crc32_clmul          (uint32_t a_crcin, uint8_t *a_buff, size_t a_len);
+uint32_t    crc32_combine        (uint32_t a_crc1, uint32_t a_crc2, uint64_t a_len2);
+int         crc32_clmul_supported();
+const char *crc32_impl_name      ();
 
 #ifdef __cplusplus
 }
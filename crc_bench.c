@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "crc32.h"
+
+#define BUFLEN (16 * 1024 * 1024)
+#define PASSES 8
+
+typedef uint32_t (*crc_fn)(uint32_t, uint8_t *, size_t);
+
+static uint8_t *buffer;
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static double now()
+{
+    struct timespec l_ts;
+    clock_gettime(CLOCK_MONOTONIC, &l_ts);
+    return l_ts.tv_sec + l_ts.tv_nsec / 1e9;
+}
+
+// check an implementation against the table version on odd lengths, odd
+// alignments and in rolling pieces
+int verify(const char *a_name, crc_fn a_fn)
+{
+    size_t l_len, l_off;
+    for (l_off = 0; l_off < 16; ++l_off) {
+        for (l_len = 0; l_len < 300; ++l_len) {
+            if (a_fn(0, buffer + l_off, l_len) != crc32_table(0, buffer + l_off, l_len)) {
+                printf("%s: mismatch at offset %zu len %zu\n", a_name, l_off, l_len);
+                return 0;
+            }
+        }
+    }
+    uint32_t l_roll = 0;
+    for (l_off = 0; l_off < 1000000; l_off += 4099)
+        l_roll = a_fn(l_roll, buffer + l_off, 4099);
+    if (l_roll != crc32_table(0, buffer, l_off)) {
+        printf("%s: rolling mismatch\n", a_name);
+        return 0;
+    }
+    return 1;
+}
+
+void bench(const char *a_name, crc_fn a_fn)
+{
+    int i;
+    uint32_t l_crc = 0;
+    if (!verify(a_name, a_fn))
+        exit(EXIT_FAILURE);
+    a_fn(0, buffer, BUFLEN); // warm up
+    double l_start = now();
+    uint64_t l_cstart = cycles();
+    for (i = 0; i < PASSES; ++i)
+        l_crc = a_fn(l_crc, buffer, BUFLEN);
+    uint64_t l_cend = cycles();
+    double l_secs = now() - l_start;
+    double l_bytes = (double)BUFLEN * PASSES;
+    printf("%-8s crc %08x  %6.3f cycles/byte  %8.1f MB/s\n", a_name, l_crc,
+           (double)(l_cend - l_cstart) / l_bytes, l_bytes / l_secs / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+    buffer = malloc(BUFLEN);
+    if (buffer == NULL) {
+        fprintf(stderr, "malloc");
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    for (i = 0; i < BUFLEN; ++i)
+        buffer[i] = rand();
+
+    uint32_t l_check = crc32_table(0, (uint8_t *)"123456789", 9);
+    if (l_check != 0xcbf43926) {
+        printf("table: check value %08x, expected cbf43926\n", l_check);
+        exit(EXIT_FAILURE);
+    }
+
+    // crc32_combine has to agree with one pass over both halves
+    for (i = 0; i < 70000; i += 6997) {
+        uint32_t l_a = crc32_table(0, buffer, i);
+        uint32_t l_b = crc32_table(0, buffer + i, 70000 - i);
+        if (crc32_combine(l_a, l_b, 70000 - i) != crc32_table(0, buffer, 70000)) {
+            printf("crc32_combine: mismatch splitting at %zu\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("get_buffer_crc dispatches to: %s\n", crc32_impl_name());
+    bench("table", crc32_table);
+    bench("slice16", crc32_slice16);
+    if (crc32_clmul_supported())
+        bench("clmul", crc32_clmul);
+    else
+        printf("clmul    not supported on this CPU\n");
+
+    free(buffer);
+    return 0;
+}
@@ -51,12 +51,14 @@ static const char *g_seed_filename = "/home/ssviatko/dev/carith/lzss32_seed_dic"
 uint8_t g_seed_dictionary[32768];
 uint32_t g_seed_dictionary_len;
 int g_seed_dictionary_loaded = 0;
+static pthread_mutex_t g_seed_dictionary_mtx = PTHREAD_MUTEX_INITIALIZER; ///< Workers may all reach for the seed dictionary at once
 
 const char *lzss32_error_string[] = {
     "none",
     "memory allocation error",
     "zero length input",
-    "minicookie error"
+    "minicookie error",
+    "damaged token stream"
 }; ///< List of standard LZSS error strings correlated to integer LZSS error codes.
 
 /**
@@ -109,6 +111,7 @@ lzss32_error_t lzss32_prepare_default_dictionary(lzss32_comp_ctx *ctx, uint8_t *
 {
     int res;
 
+    pthread_mutex_lock(&g_seed_dictionary_mtx);
     if (g_seed_dictionary_loaded)
         goto lzss32_prepare_default_dictionary_already_loaded;
 
@@ -122,10 +125,12 @@ lzss32_error_t lzss32_prepare_default_dictionary(lzss32_comp_ctx *ctx, uint8_t *
         fprintf(stderr, "lzss32: unable to read seed dictionary %s: %s\n", g_seed_filename, strerror(errno));
         exit(EXIT_FAILURE);
     }
-    g_seed_dictionary_loaded = 1;
+    close(seed_fd);
     g_seed_dictionary_len = res;
+    g_seed_dictionary_loaded = 1;
 
 lzss32_prepare_default_dictionary_already_loaded:
+    pthread_mutex_unlock(&g_seed_dictionary_mtx);
     return lzss32_prepare_dictionary(ctx, g_seed_dictionary, g_seed_dictionary_len, a_buffer);
 }
 
@@ -498,15 +503,21 @@ lzss32_error_t lzss32_encode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_le
  * is recommended that the output buffer be 3/2 the size of expected
  * decompressed plain text plus the size of the window.
  *
+ * Damaged tokens can't take it outside a_in or past a_out_max bytes of output,
+ * it stops with LZSS32_ERR_DAMAGED instead.
+ *
  * @param[in] ctx The LZSS Context
  * @param[in] a_in Pointer to buffer containing compression tokens
  * @param[in] a_in_len Length of buffer containing compression tokens
  * @param[in] a_out Pointer to windowed buffer with appropriate seed dictionary and space for output
+ * @param[in] a_out_max Room for output in a_out after the window
  * @param[out] a_out_len The length of the output data
  */
 
-lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t *a_out_len)
+lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t a_out_max, size_t *a_out_len)
 {
+    if (a_in_len < OFFSET_OUTPUT_STREAM)
+        return LZSS32_ERR_DAMAGED;
     uint32_t initial_copy;
     memcpy(&initial_copy, a_in + OFFSET_INITIAL_COPY, sizeof(initial_copy));
     initial_copy = ntohl(initial_copy);
@@ -525,6 +536,8 @@ lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_le
     *a_out_len = 0;
 
     // do initial copy of raw bytes
+    if ((initial_copy > a_in_len - in_ptr) || (initial_copy > a_out_max))
+        return LZSS32_ERR_DAMAGED;
     for (i = 0; i < initial_copy; ++i) {
         a_out[WINDOW_SIZE + out_ptr++] = a_in[in_ptr++];
     }
@@ -532,6 +545,8 @@ lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_le
 
     // read in token_count tokens in 8 token increments
     for (i = 0; i < token_count; i += 8) {
+        if (in_ptr + 2 > a_in_len)
+            return LZSS32_ERR_DAMAGED;
         uint16_t hibyte = a_in[in_ptr++];
         uint16_t lobyte = a_in[in_ptr++];
         uint16_t flags = (hibyte << 8) + lobyte;
@@ -541,11 +556,16 @@ lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_le
                 goto lzss32_decode_done;
             if ((flags & 0x03) == 0x03) {
                 uint32_t l_temp32 = 0;
+                if (in_ptr + 3 > a_in_len)
+                    return LZSS32_ERR_DAMAGED;
                 memcpy((uint8_t *)(&l_temp32) + 1, a_in + in_ptr, 3);
                 l_temp32 = ntohl(l_temp32);
                 uint32_t match_back_ptr = l_temp32 >> 9;
                 uint16_t match_len = l_temp32 & 0x1ff;
                 match_len += MINMATCH_LARGE;
+                // the encoder never overlaps a match with itself, so one that does is damage
+                if ((out_ptr + match_len > a_out_max) || (match_back_ptr > out_ptr + WINDOW_SIZE) || (match_back_ptr < match_len))
+                    return LZSS32_ERR_DAMAGED;
                 memcpy(a_out + out_ptr + WINDOW_SIZE, a_out + out_ptr + WINDOW_SIZE - match_back_ptr, match_len);
 //                // report
 //                char cc[516]; memset(cc, 0, 516);
@@ -560,11 +580,16 @@ lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_le
             } else if ((flags & 0x03) == 0x02) {
                 // read medium match token
                 uint16_t l_temp16;
+                if (in_ptr + sizeof(l_temp16) > a_in_len)
+                    return LZSS32_ERR_DAMAGED;
                 memcpy(&l_temp16, a_in + in_ptr, sizeof(l_temp16));
                 l_temp16 = ntohs(l_temp16);
                 uint16_t match_back_ptr = l_temp16 >> 4;
                 uint8_t match_len = l_temp16 & 0xf;
                 match_len += MINMATCH_MEDIUM;
+                // the encoder never overlaps a match with itself, so one that does is damage
+                if ((out_ptr + match_len > a_out_max) || (match_back_ptr > out_ptr + WINDOW_SIZE) || (match_back_ptr < match_len))
+                    return LZSS32_ERR_DAMAGED;
                 memcpy(a_out + out_ptr + WINDOW_SIZE, a_out + out_ptr + WINDOW_SIZE - match_back_ptr, match_len);
 //                // report
 //                char cc[516]; memset(cc, 0, 516);
@@ -578,9 +603,13 @@ lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_le
                 out_ptr += match_len;
             } else if ((flags & 0x03) == 0x01) {
                 // read small match token
+                if (in_ptr >= a_in_len)
+                    return LZSS32_ERR_DAMAGED;
                 uint8_t match_back_ptr = a_in[in_ptr] >> 3;
                 uint8_t match_len = a_in[in_ptr] & 0x7;
                 match_len += MINMATCH;
+                if ((out_ptr + match_len > a_out_max) || (match_back_ptr < match_len))
+                    return LZSS32_ERR_DAMAGED;
                 memcpy(a_out + out_ptr + WINDOW_SIZE, a_out + out_ptr + WINDOW_SIZE - match_back_ptr, match_len);
 //                // report
 //                char cc[516]; memset(cc, 0, 516);
@@ -595,6 +624,8 @@ lzss32_error_t lzss32_decode(lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_le
             } else {
                 //read byte token
                 uint8_t l_temp8;
+                if ((in_ptr >= a_in_len) || (out_ptr >= a_out_max))
+                    return LZSS32_ERR_DAMAGED;
                 memcpy(&l_temp8, a_in + in_ptr, sizeof(l_temp8));
                 memcpy(a_out + WINDOW_SIZE + out_ptr, &l_temp8, sizeof(l_temp8));
 //                // report
@@ -40,8 +40,6 @@
 extern "C" {
 #endif
 
-#pragma pack(1)
-
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -50,6 +48,7 @@ extern "C" {
 #include <sys/fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 /**
  * @struct token_block32_t
@@ -107,7 +106,7 @@ typedef struct {
 
 typedef struct {
     uint32_t *pointer_pool; ///< pointers, one for every byte in the buffer, which is typically [WINDOW_SIZE + SEGSIZE]
-    symbol_hint32_t symbols[256]; ///< Array of symbol hints
+    symbol_hint32_t symbols[256] __attribute__((aligned(64))); ///< Array of symbol hints
     uint32_t seed_dictionary_start; ///< Pointer to start of seeded dictionary. This is where we open the window at the start of encoding.
 } lzss32_comp_ctx; ///< LZSS Compression Context
 
@@ -120,7 +119,8 @@ typedef enum {
     LZSS32_ERR_NONE,
     LZSS32_ERR_MEMORY,
     LZSS32_ERR_ZEROIN,
-    LZSS32_ERR_MINICOOKIE
+    LZSS32_ERR_MINICOOKIE,
+    LZSS32_ERR_DAMAGED
 } lzss32_error_t;
 
 const char       *lzss32_strerror                   (lzss32_error_t a_errno);
@@ -130,7 +130,7 @@ lzss32_error_t    lzss32_init_context               (lzss32_comp_ctx *ctx, size_
 lzss32_error_t    lzss32_free_context               (lzss32_comp_ctx *ctx);
 lzss32_error_t    lzss32_prepare_pointer_pool       (lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len);
 lzss32_error_t    lzss32_encode                     (lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t *a_out_len);
-lzss32_error_t    lzss32_decode                     (lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t *a_out_len);
+lzss32_error_t    lzss32_decode                     (lzss32_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t a_out_max, size_t *a_out_len);
 
 #ifdef __cplusplus
 }
@@ -51,7 +51,8 @@ const char *lzss4_error_string[] = {
     "none",
     "memory allocation error",
     "zero length input",
-    "minicookie error"
+    "minicookie error",
+    "damaged token stream"
 }; ///< List of standard LZSS error strings correlated to integer LZSS error codes.
 
 /**
@@ -413,15 +414,21 @@ lzss4_error_t lzss4_encode(lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len,
  * is recommended that the output buffer be 3/2 the size of expected
  * decompressed plain text plus the size of the window.
  *
+ * Damaged tokens can't take it outside a_in or past a_out_max bytes of output,
+ * it stops with LZSS_ERR_DAMAGED instead.
+ *
  * @param[in] ctx The LZSS Context
  * @param[in] a_in Pointer to buffer containing compression tokens
  * @param[in] a_in_len Length of buffer containing compression tokens
  * @param[in] a_out Pointer to windowed buffer with appropriate seed dictionary and space for output
+ * @param[in] a_out_max Room for output in a_out after the window
  * @param[out] a_out_len The length of the output data
  */
 
-lzss4_error_t lzss4_decode(lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t *a_out_len)
+lzss4_error_t lzss4_decode(lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t a_out_max, size_t *a_out_len)
 {
+    if (a_in_len < OFFSET_OUTPUT_STREAM)
+        return LZSS_ERR_DAMAGED;
     uint32_t initial_copy;
     memcpy(&initial_copy, a_in + OFFSET_INITIAL_COPY, sizeof(initial_copy));
     initial_copy = ntohl(initial_copy);
@@ -440,6 +447,8 @@ lzss4_error_t lzss4_decode(lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len,
     *a_out_len = 0;
 
     // do initial copy of raw bytes
+    if ((initial_copy > a_in_len - in_ptr) || (initial_copy > a_out_max))
+        return LZSS_ERR_DAMAGED;
     for (i = 0; i < initial_copy; ++i) {
         a_out[WINDOW_SIZE + out_ptr++] = a_in[in_ptr++];
     }
@@ -447,6 +456,8 @@ lzss4_error_t lzss4_decode(lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len,
 
     // read in token_count tokens in 8 token increments
     for (i = 0; i < token_count; i += 8) {
+        if (in_ptr >= a_in_len)
+            return LZSS_ERR_DAMAGED;
         uint8_t flags = a_in[in_ptr++];
         //        printf("lzss4_decode: in_ptr %ld i %ld flags %02X\n", in_ptr, i, flags);
         for (j = 0; j < 8; ++j) {
@@ -455,11 +466,16 @@ lzss4_error_t lzss4_decode(lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len,
             if ((flags & 0x01) == 0x01) {
                 // read match token
                 uint16_t l_temp16;
+                if (in_ptr + sizeof(l_temp16) > a_in_len)
+                    return LZSS_ERR_DAMAGED;
                 memcpy(&l_temp16, a_in + in_ptr, sizeof(l_temp16));
                 l_temp16 = ntohs(l_temp16);
                 uint16_t match_back_ptr = l_temp16 >> 4;
                 uint8_t match_len = l_temp16 & 0xf;
                 match_len += MINMATCH;
+                // the encoder never overlaps a match with itself, so one that does is damage
+                if ((out_ptr + match_len > a_out_max) || (match_back_ptr > out_ptr + WINDOW_SIZE) || (match_back_ptr < match_len))
+                    return LZSS_ERR_DAMAGED;
                 memcpy(a_out + out_ptr + WINDOW_SIZE, a_out + out_ptr + WINDOW_SIZE - match_back_ptr, match_len);
 //                // report
 //                char cc[20]; memset(cc, 0, 20);
@@ -474,6 +490,8 @@ lzss4_error_t lzss4_decode(lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len,
             } else {
                 //read byte token
                 uint8_t l_temp8;
+                if ((in_ptr >= a_in_len) || (out_ptr >= a_out_max))
+                    return LZSS_ERR_DAMAGED;
                 memcpy(&l_temp8, a_in + in_ptr, sizeof(l_temp8));
                 memcpy(a_out + WINDOW_SIZE + out_ptr, &l_temp8, sizeof(l_temp8));
 //                // report
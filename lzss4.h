@@ -40,8 +40,6 @@
 extern "C" {
 #endif
 
-#pragma pack(1)
-
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -104,7 +102,7 @@ typedef struct {
 
 typedef struct {
     uint32_t *pointer_pool; ///< pointers, one for every byte in the buffer, which is typically [WINDOW_SIZE + SEGSIZE]
-    symbol_hint_t symbols[256]; ///< Array of symbol hints
+    symbol_hint_t symbols[256] __attribute__((aligned(64))); ///< Array of symbol hints
     uint32_t seed_dictionary_start; ///< Pointer to start of seeded dictionary. This is where we open the window at the start of encoding.
 } lzss4_comp_ctx; ///< LZSS Compression Context
 
@@ -117,7 +115,8 @@ typedef enum {
     LZSS_ERR_NONE,
     LZSS_ERR_MEMORY,
     LZSS_ERR_ZEROIN,
-    LZSS_ERR_MINICOOKIE
+    LZSS_ERR_MINICOOKIE,
+    LZSS_ERR_DAMAGED
 } lzss4_error_t;
 
 const char     *lzss4_strerror                   (lzss4_error_t a_errno);
@@ -127,7 +126,7 @@ lzss4_error_t    lzss4_init_context               (lzss4_comp_ctx *ctx, size_t a
 lzss4_error_t    lzss4_free_context               (lzss4_comp_ctx *ctx);
 lzss4_error_t    lzss4_prepare_pointer_pool       (lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len);
 lzss4_error_t    lzss4_encode                     (lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t *a_out_len);
-lzss4_error_t    lzss4_decode                     (lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t *a_out_len);
+lzss4_error_t    lzss4_decode                     (lzss4_comp_ctx *ctx, uint8_t *a_in, size_t a_in_len, uint8_t *a_out, size_t a_out_max, size_t *a_out_len);
 
 #ifdef __cplusplus
 }
@@ -55,7 +55,7 @@ void process4()
     //    ccct_print_hex((uint8_t *)comp, compsize);
     size_t decompsize4;
     lzss4_prepare_default_dictionary(&ctx4, decomp4);
-    lzss4_decode(&ctx4, comp, compsize, decomp4, &decompsize4);
+    lzss4_decode(&ctx4, comp, compsize, decomp4, SEGSIZE * 3 / 2, &decompsize4);
     printf("decomp4 (%ld bytes ratio %3.5f) ", decompsize4, (float)compsize / (float)decompsize4 * 100.0);
     //    ccct_print_hex((uint8_t *)decomp + WINDOW_SIZE, decompsize);
     //    printf("P:%s\nD:%s\n", l_plain, decomp + WINDOW_SIZE);
@@ -84,7 +84,7 @@ void process32()
 //    ccct_print_hex((uint8_t *)comp, compsize);
     size_t decompsize32;
     lzss32_prepare_default_dictionary(&ctx32, decomp32);
-    lzss32_decode(&ctx32, comp, compsize, decomp32, &decompsize32);
+    lzss32_decode(&ctx32, comp, compsize, decomp32, SEGSIZE * 3 / 2, &decompsize32);
     printf("decomp32 (%ld bytes ratio %3.5f) ", decompsize32, (float)compsize / (float)decompsize32 * 100.0);
 //    ccct_print_hex((uint8_t *)decomp32 + LZSS32_WINDOW_SIZE, decompsize32);
     //    printf("P:%s\nD:%s\n", l_plain, decomp + WINDOW_SIZE);
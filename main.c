@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // for sched_getaffinity
+
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -10,17 +12,21 @@
 #include <sys/stat.h>
 #include <sys/fcntl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
 #include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 
 #include "carith.h"
+#include "carchive.h"
 #include "color_print.h"
 #include "crc32.h"
 
-#pragma pack(1)
 
-#define MAXTHREADS 48
+#define PIPELINE_DEPTH 2 // segment slots (and carith contexts) owned by each worker thread
 #define DEFAULT_SEGSIZE 524288
 #define BUFFLEN 1024 // general text buffer size
 
@@ -34,11 +40,27 @@ int g_lzssonly = 0;
 int g_uselzss32 = 0;
 int g_showsegs = 0;
 int g_roulette = 1;
+int g_usemmap = 1;
+int g_pwrite = 1;
+int g_index = 1;
+int g_range_set = 0;
+int g_use_stdin = 0; // input file given as "-"
+int g_use_stdout = 0; // write output to stdout, always the case when reading stdin
+int g_header64 = 0; // write the 64-bit file header even if the input would fit the 32-bit one
+carith_coder_t g_coder = CARITH_CODER_AC; // entropy coder for the AC stage
+int g_auto_slack = CARITH_AUTO_SLACK; // thousandths of ratio --coder auto gives up for a faster coder
+int g_sharedtable = 0; // put a file wide frequency table in the header for segments to use
+uint8_t *g_shared_table = NULL; // the archive's shared frequency table, loaded into every context
+uint16_t g_shared_table_len = 0;
+int g_failfast = 0; // -T: give up at the first damaged segment
+uint64_t g_range_offset; // --range: first byte of the original file to extract
+uint64_t g_range_len; // --range: how many bytes
 int g_color_theme = THEME_PURPLE;
 uint32_t g_segsize = DEFAULT_SEGSIZE;
-enum { MODE_NONE, MODE_COMPRESS, MODE_EXTRACT, MODE_TELL } g_mode = MODE_NONE;
+enum { MODE_NONE, MODE_COMPRESS, MODE_EXTRACT, MODE_TELL, MODE_TEST } g_mode = MODE_NONE;
 char g_in[BUFFLEN];
 int g_in_fd;
+uint8_t *g_in_map = NULL; // input file mapped for compression, NULL if we're read()ing it
 off_t g_in_len;
 time_t g_in_mtime;
 mode_t g_in_mode;
@@ -51,47 +73,68 @@ char g_dmbuff[4];
 char g_infotag[256];
 int g_infotag_set = 0;
 
-uint16_t g_cookie = 0xd5aa;
+// concurrency
+int g_threads = 0; // 0 = pick a thread count from the CPUs we're allowed to use
 
-typedef struct {
-	uint16_t cookie; // network byte order
-	uint8_t scheme;
-	mode_t mode; // mode of original file
-	uint8_t mtime[5]; // lower 5 bytes of mtime time_t
-	uint32_t plain_crc; // crc of plain input file
-	uint32_t total_plain_len;
-	uint32_t total_rle_len;
-	uint32_t total_lzss_len;
-	uint32_t segsize;
-} file_header_t;
+// pipeline: the reader (main thread) fills a ring of segment slots, the worker
+// threads process them, and the writer thread emits finished slots strictly in
+// segment order, handing each one back to the reader. segment n always lives in
+// slot n % g_slot_count, so the ring bounds how far the reader can run ahead of
+// the writer.
+typedef enum { SLOT_FREE, SLOT_QUEUED, SLOT_DONE } slot_state_t;
 
 typedef struct {
-	uint8_t scheme;
-	uint32_t rle_intermediate;
-	uint32_t lzss_intermediate;
-	uint32_t total_compsize; // comp_len + freq_comp_len
-	uint16_t freq_comp_len; // freq_comp_len
-	uint32_t plain_len;
-} segment_header_t;
-
-// concurrency
-int g_threads = 8; // default thread count
-pthread_mutex_t g_tally_mtx;
-pthread_cond_t g_tally_cond;
-int g_tally = 0;
+	carith_comp_ctx ctx;
+	uint32_t seg_num;
+	off_t out_offset; // extract: where this segment's plaintext lands in the output file
+	uint64_t in_offset; // extract: where the worker should pread this segment from, if g_pread_segments
+	uint32_t crc; // CRC of this segment's plaintext, worked out by the worker
+	uint32_t seg_crc; // extract: CRC the segment header says the plaintext should have, if g_segcrc
+	slot_state_t state;
+} __attribute__((aligned(64))) segment_slot; // never share a cache line with the next slot's worker
+
+// work stealing: slot s is owned by worker s % g_threads, and each worker has its
+// own queue of slot numbers. the reader pushes every segment onto the queue of the
+// worker owning its slot; a worker drains its own queue first and steals from the
+// others when it runs dry. the queues are lock-free: the reader is the only
+// producer, and owner and thieves alike claim the oldest entry with a CAS on head,
+// which keeps the in-order writer fed.
+typedef struct {
+	_Atomic uint32_t head __attribute__((aligned(64))); // next entry to claim
+	_Atomic uint32_t tail __attribute__((aligned(64))); // next entry for the reader to fill, on its own line so thieves' CASes don't bounce it
+	uint32_t *entries; // slot numbers, ring of g_slot_count
+} work_queue;
 
 typedef struct {
 	pthread_t thread;
 	unsigned int id;
-	int runflag;
-	pthread_mutex_t sig_mtx;
-	pthread_cond_t sig_cond;
-	int sigflag;
-	uint32_t cur_seg;
-} thread_work_area;
-
-thread_work_area twa[MAXTHREADS];
-carith_comp_ctx ctx[MAXTHREADS];
+	work_queue queue;
+} __attribute__((aligned(64))) thread_work_area;
+
+thread_work_area *twa;
+segment_slot *g_slots;
+int g_slot_count;
+pthread_t g_writer_thread;
+sem_t g_pipe_work_sem; // one token per queued segment, plus one per worker at EOF
+pthread_mutex_t g_pipe_mtx;
+pthread_cond_t g_pipe_done_cond; // writer waits here for the next segment in order, idle workers for the reader to queue one
+pthread_cond_t g_pipe_free_cond; // reader waits here for its next slot to be written out
+uint32_t g_pipe_queued; // segments handed to the pipeline by the reader
+uint32_t g_pipe_idle; // workers waiting on g_pipe_done_cond because every queue was empty
+atomic_int g_pipe_eof; // reader has run out of input
+
+// writer stage results
+carchive_header_t g_fh; // compress: the file header we write
+uint64_t g_total_rle_len; // compress: running totals
+uint64_t g_total_lzss_len;
+carchive_index_t g_idx; // compress: built by the writer. extract: loaded from the archive
+uint64_t g_out_offset; // compress: file offset of the next segment header
+int g_pread_segments = 0; // extract: workers fetch their own segments using the index
+uint32_t g_plain_crc; // CRC of the plaintext through the writer so far, combined from the workers' segment CRCs
+int g_segcrc = 0; // extract: segment headers carry a CRC of their plaintext
+uint32_t g_bad_segs; // extract: segments whose plaintext didn't match their CRC
+size_t g_sofar; // plaintext bytes through the writer so far
+size_t g_progress_total; // denominator for color_progress
 
 // options
 enum {
@@ -104,7 +147,17 @@ enum {
 	OPT_LZSSONLY,
 	OPT_USELZSS32,
 	OPT_COLOR_THEME,
-	OPT_NOROULETTE
+	OPT_NOROULETTE,
+	OPT_NOMMAP,
+	OPT_NOPWRITE,
+	OPT_NOINDEX,
+	OPT_RANGE,
+	OPT_STDOUT,
+	OPT_HEADER64,
+	OPT_CODER,
+	OPT_AUTOSLACK,
+	OPT_SHAREDTABLE,
+	OPT_FAILFAST
 };
 
 struct option g_options[] = {
@@ -127,6 +180,17 @@ struct option g_options[] = {
 	{ "showsegs", no_argument, NULL, 's' },
 	{ "noicms", no_argument, NULL, OPT_NOROULETTE },
 	{ "infotag", required_argument, NULL, 'i' },
+	{ "nommap", no_argument, NULL, OPT_NOMMAP },
+	{ "nopwrite", no_argument, NULL, OPT_NOPWRITE },
+	{ "noindex", no_argument, NULL, OPT_NOINDEX },
+	{ "range", required_argument, NULL, OPT_RANGE },
+	{ "stdout", no_argument, NULL, OPT_STDOUT },
+	{ "header64", no_argument, NULL, OPT_HEADER64 },
+	{ "coder", required_argument, NULL, OPT_CODER },
+	{ "autoslack", required_argument, NULL, OPT_AUTOSLACK },
+	{ "sharedtable", no_argument, NULL, OPT_SHAREDTABLE },
+	{ "test", no_argument, NULL, 'T' },
+	{ "failfast", no_argument, NULL, OPT_FAILFAST },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -147,12 +211,37 @@ char *decimal_mode(mode_t a_mode)
 	return g_dmbuff;
 }
 
+// name of a segment's entropy coder, peeking at the front of its frequency table if it isn't the original one
+const char *segment_coder_name(uint8_t a_scheme, off_t a_freq_offset)
+{
+	uint8_t l_coder;
+
+	if ((a_scheme & scheme_xcoder) != scheme_xcoder)
+		return carith_coder_name(CARITH_CODER_AC);
+	if (pread(g_in_fd, &l_coder, 1, a_freq_offset) != 1)
+		return "unknown";
+	if ((l_coder & CARITH_CODER_SHARED) == CARITH_CODER_SHARED)
+		return fmtbld("%s/shared", carith_coder_name(l_coder & ~CARITH_CODER_SHARED));
+	return carith_coder_name(l_coder);
+}
+
 void verify_file_argument()
 {
 	// stat the user specified file to make sure it exists
 	// no need to return anything as this will die if the file is not there or not a regular file
 	int res;
 	struct stat l_stat;
+	if (strcmp(g_in, "-") == 0) {
+		// stdin: we find out how long it is when it ends
+		g_use_stdin = 1;
+		g_use_stdout = (g_mode != MODE_TEST);
+		g_in_fd = STDIN_FILENO;
+		g_in_len = 0;
+		g_in_mode = S_IFREG | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+		g_in_mtime = time(NULL);
+		color_debug("reading stdin\n");
+		return;
+	}
 	res = stat(g_in, &l_stat);
 	if (res < 0) {
 		color_err_printf(1, "carith: unable to stat input file");
@@ -162,14 +251,10 @@ void verify_file_argument()
 		color_err_printf(0, "carith: input file is not a regular file.");
 		exit(EXIT_FAILURE);
 	}
-	if (l_stat.st_size > UINT_MAX) {
-		color_err_printf(0, "carith: input file exceeds 4GB in size.");
-		exit(EXIT_FAILURE);
-	}
 	g_in_len = l_stat.st_size;
 	g_in_mode = l_stat.st_mode;
 	g_in_mtime = l_stat.st_mtime;
-	color_debug("g_in stat - st_size %ld st_mode %08lX (%s) st_mtime (%016lX) %s", l_stat.st_size, l_stat.st_mode, decimal_mode(l_stat.st_mode), l_stat.st_mtime, ctime(&l_stat.st_mtime));
+	color_debug("g_in stat - st_size %ld st_mode %08X (%s) st_mtime (%016lX) %s", l_stat.st_size, l_stat.st_mode, decimal_mode(l_stat.st_mode), l_stat.st_mtime, ctime(&l_stat.st_mtime));
 	g_in_fd = open(g_in, O_RDONLY);
 	if (g_in_fd < 0) {
 		color_err_printf(1, "carith: can't open input file");
@@ -178,106 +263,686 @@ void verify_file_argument()
 	color_debug("opened input file %s, size %ld\n", g_in, g_in_len);
 }
 
+ssize_t read_fully(int a_fd, void *a_buff, size_t a_len)
+{
+	// read() until we have a_len bytes or hit EOF, pipes hand us data in dribs and drabs
+	ssize_t res;
+	size_t l_done = 0;
+
+	while (l_done < a_len) {
+		res = read(a_fd, (uint8_t *)a_buff + l_done, a_len - l_done);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			color_err_printf(1, "carith: unable to read input file");
+			exit(EXIT_FAILURE);
+		}
+		if (res == 0)
+			break;
+		l_done += res;
+	}
+	return l_done;
+}
+
+int work_queue_pop(work_queue *a_queue, uint32_t *a_slot)
+{
+	uint32_t l_head = atomic_load_explicit(&a_queue->head, memory_order_acquire);
+
+	while (l_head != atomic_load_explicit(&a_queue->tail, memory_order_acquire)) {
+		*a_slot = a_queue->entries[l_head % g_slot_count];
+		// on failure l_head is refreshed and we try again
+		if (atomic_compare_exchange_weak_explicit(&a_queue->head, &l_head, l_head + 1, memory_order_acq_rel, memory_order_acquire))
+			return 1;
+	}
+	return 0;
+}
+
+void work_queue_push(work_queue *a_queue, uint32_t a_slot)
+{
+	// single producer: the ring can never overflow since there are only g_slot_count slots
+	uint32_t l_tail = atomic_load_explicit(&a_queue->tail, memory_order_relaxed);
+	a_queue->entries[l_tail % g_slot_count] = a_slot;
+	atomic_store_explicit(&a_queue->tail, l_tail + 1, memory_order_release);
+}
+
+int work_queues_empty()
+{
+	size_t i;
+
+	for (i = 0; i < g_threads; ++i) {
+		if (atomic_load_explicit(&twa[i].queue.head, memory_order_acquire) != atomic_load_explicit(&twa[i].queue.tail, memory_order_acquire))
+			return 0;
+	}
+	return 1;
+}
+
+segment_slot *find_work(thread_work_area *a_twa)
+{
+	size_t i;
+	uint32_t l_slot;
+	int l_eof;
+
+	while (1) {
+		// our own queue first, then go stealing
+		for (i = 0; i < g_threads; ++i) {
+			if (work_queue_pop(&twa[(a_twa->id + i) % g_threads].queue, &l_slot) > 0) {
+				if (i > 0) color_trace("tid %d stole segment %d from tid %d\n", a_twa->id, g_slots[l_slot].seg_num, (int)((a_twa->id + i) % g_threads));
+				return &g_slots[l_slot];
+			}
+		}
+		// every queue is empty. after EOF that's final; before EOF our token
+		// guarantees that an entry is in flight, so sleep until the reader has
+		// pushed it rather than spin. it pushes under the mutex, so it can't
+		// slip in between our look and our wait
+		pthread_mutex_lock(&g_pipe_mtx);
+		l_eof = atomic_load(&g_pipe_eof);
+		if ((l_eof == 0) && work_queues_empty()) {
+			g_pipe_idle++;
+			pthread_cond_wait(&g_pipe_done_cond, &g_pipe_mtx);
+			g_pipe_idle--;
+		}
+		pthread_mutex_unlock(&g_pipe_mtx);
+		if (l_eof > 0)
+			return NULL;
+	}
+}
+
+void pwrite_extracted_segment(segment_slot *a_slot)
+{
+	ssize_t res;
+	size_t l_done = 0;
+
+	// a damaged segment can decode long or short, but it only gets its own plain_len bytes of the
+	// file, never any of the next segment's
+	while (l_done < a_slot->ctx.plain_len) {
+		res = pwrite(g_out_fd, a_slot->ctx.decomp + l_done, a_slot->ctx.plain_len - l_done, a_slot->out_offset + l_done);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			color_err_printf(1, "carith: unable to write to output file.");
+			exit(EXIT_FAILURE);
+		}
+		if (res == 0) {
+			color_err_printf(0, "carith: difficulty writing to output file: wrote %ld expected to write %ld.", l_done, a_slot->ctx.plain_len);
+			exit(EXIT_FAILURE);
+		}
+		l_done += res;
+	}
+}
+
+void pread_fully(void *a_buff, size_t a_len, uint64_t a_offset)
+{
+	ssize_t res;
+	size_t l_done = 0;
+
+	while (l_done < a_len) {
+		res = pread(g_in_fd, (uint8_t *)a_buff + l_done, a_len - l_done, a_offset + l_done);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			color_err_printf(1, "unable to read input file");
+			exit(EXIT_FAILURE);
+		}
+		if (res == 0) {
+			color_err_printf(0, "problems reading input file, read %ld expected to read %ld", l_done, a_len);
+			exit(EXIT_FAILURE);
+		}
+		l_done += res;
+	}
+}
+
+// a damaged segment header mustn't be able to send us past the end of the context's buffers
+int segment_fits(carith_comp_ctx *a_ctx, uint16_t a_freq_comp_len, uint32_t a_total_compsize, uint32_t a_plain_len)
+{
+	if ((a_freq_comp_len > sizeof(a_ctx->freq_comp)) || (a_freq_comp_len > a_total_compsize))
+		return 0;
+	if ((a_total_compsize - a_freq_comp_len) > a_ctx->comp_size)
+		return 0;
+	return (a_plain_len <= g_segsize);
+}
+
+void pread_segment(segment_slot *a_slot)
+{
+	// extract with an index: pull this segment's header, frequency table and tokens straight off the disk
+	carchive_segment_t *l_seg = &g_idx.segs[a_slot->seg_num];
+	segment_header_crc_t bh;
+
+	pread_fully(&bh, g_idx.hdr_len, a_slot->in_offset);
+	// the header has to agree with the index
+	if ((bh.scheme != l_seg->scheme) || (ntohl(bh.total_compsize) != l_seg->total_compsize) || (ntohl(bh.plain_len) != l_seg->plain_len) || (ntohs(bh.freq_comp_len) > l_seg->total_compsize)) {
+		color_err_printf(0, "carith: segment %d header does not match the archive index.", a_slot->seg_num);
+		exit(EXIT_FAILURE);
+	}
+	if (!segment_fits(&a_slot->ctx, ntohs(bh.freq_comp_len), l_seg->total_compsize, l_seg->plain_len)) {
+		color_err_printf(0, "carith: segment %d header is damaged, its lengths are impossible.", a_slot->seg_num);
+		exit(EXIT_FAILURE);
+	}
+	a_slot->ctx.rle_intermediate = ntohl(bh.rle_intermediate);
+	a_slot->ctx.lzss_intermediate = ntohl(bh.lzss_intermediate);
+	a_slot->ctx.freq_comp_len = ntohs(bh.freq_comp_len);
+	a_slot->ctx.comp_len = l_seg->total_compsize - a_slot->ctx.freq_comp_len;
+	a_slot->seg_crc = ntohl(bh.plain_crc);
+	pread_fully(a_slot->ctx.freq_comp, a_slot->ctx.freq_comp_len, a_slot->in_offset + g_idx.hdr_len);
+	pread_fully(a_slot->ctx.comp, a_slot->ctx.comp_len, a_slot->in_offset + g_idx.hdr_len + a_slot->ctx.freq_comp_len);
+}
+
 void *compress_tf(void *arg)
 {
 	thread_work_area *a_twa;
 	a_twa = arg;
+	segment_slot *l_slot;
 
 	while (1) {
-		// wait to get signalled
-		pthread_mutex_lock(&a_twa->sig_mtx);
-		while ((a_twa->sigflag == 0) && (a_twa->runflag > 0)) {
-			pthread_cond_wait(&a_twa->sig_cond, &a_twa->sig_mtx);
-		}
-		if (a_twa->runflag == 0) {
-			// telling us to quit
-			pthread_mutex_unlock(&a_twa->sig_mtx);
-			// clean up
+		// wait for the reader to queue a segment
+		while (sem_wait(&g_pipe_work_sem) < 0) {
+			if (errno != EINTR) {
+				color_err_printf(1, "carith: sem_wait");
+				exit(EXIT_FAILURE);
+			}
+		}
+		l_slot = find_work(a_twa);
+		if (l_slot == NULL) {
+			// input exhausted and nothing left to do, so quit
 			pthread_exit(NULL);
 		}
-		pthread_mutex_unlock(&a_twa->sig_mtx);
-		// signalled, so preform action
+		// preform action
 		if (g_mode == MODE_COMPRESS) {
-			carith_compress(&ctx[a_twa->id]);
-			color_debug("tid %d segment %d plain_len %ld comp_len %ld freq_comp_len %ld total_comp_len %ld plainCRC %08X compCRC %08X\n", a_twa->id, a_twa->cur_seg, ctx[a_twa->id].plain_len, ctx[a_twa->id].comp_len, ctx[a_twa->id].freq_comp_len, (ctx[a_twa->id].comp_len + ctx[a_twa->id].freq_comp_len), get_buffer_crc(0, ctx[a_twa->id].plain, ctx[a_twa->id].plain_len), get_buffer_crc(0, ctx[a_twa->id].comp, ctx[a_twa->id].comp_len));
-		} else if (g_mode == MODE_EXTRACT) {
-			carith_extract(&ctx[a_twa->id]);
-			color_debug("tid %d segment %d decomp_len %ld total_comp_len %ld compCRC %08X decompCRC %08X\n", a_twa->id, a_twa->cur_seg, ctx[a_twa->id].decomp_len, (ctx[a_twa->id].comp_len + ctx[a_twa->id].freq_comp_len), get_buffer_crc(0, ctx[a_twa->id].comp, ctx[a_twa->id].comp_len), get_buffer_crc(0, ctx[a_twa->id].decomp, ctx[a_twa->id].decomp_len));
-		}
-		// done
-		a_twa->sigflag = 0;
-		// signal doneness
-		pthread_mutex_lock(&g_tally_mtx);
-		g_tally++;
-		pthread_cond_signal(&g_tally_cond);
-		pthread_mutex_unlock(&g_tally_mtx);
+			carith_compress(&l_slot->ctx);
+			// checksum our own segment, the writer only has to combine them
+			l_slot->crc = get_buffer_crc(0, l_slot->ctx.plain, l_slot->ctx.plain_len);
+			color_debug("tid %d segment %d plain_len %ld comp_len %ld freq_comp_len %d total_comp_len %ld plainCRC %08X compCRC %08X\n", a_twa->id, l_slot->seg_num, l_slot->ctx.plain_len, l_slot->ctx.comp_len, l_slot->ctx.freq_comp_len, (l_slot->ctx.comp_len + l_slot->ctx.freq_comp_len), l_slot->crc, get_buffer_crc(0, l_slot->ctx.comp, l_slot->ctx.comp_len));
+		} else {
+			// extract or test
+			if (g_pread_segments)
+				pread_segment(l_slot);
+			carith_extract(&l_slot->ctx);
+			l_slot->crc = get_buffer_crc(0, l_slot->ctx.decomp, l_slot->ctx.decomp_len);
+			// short of what it should be, pad it out so it still fills exactly its own place in the file
+			if (l_slot->ctx.decomp_len < l_slot->ctx.plain_len)
+				memset(l_slot->ctx.decomp + l_slot->ctx.decomp_len, 0, l_slot->ctx.plain_len - l_slot->ctx.decomp_len);
+			color_debug("tid %d segment %d decomp_len %ld total_comp_len %ld compCRC %08X decompCRC %08X\n", a_twa->id, l_slot->seg_num, l_slot->ctx.decomp_len, (l_slot->ctx.comp_len + l_slot->ctx.freq_comp_len), get_buffer_crc(0, l_slot->ctx.comp, l_slot->ctx.comp_len), l_slot->crc);
+			// positional output: every segment already knows where it goes, so write it from here
+			if (g_pwrite)
+				pwrite_extracted_segment(l_slot);
+		}
+		// done, let the writer know
+		pthread_mutex_lock(&g_pipe_mtx);
+		l_slot->state = SLOT_DONE;
+		pthread_cond_broadcast(&g_pipe_done_cond);
+		pthread_mutex_unlock(&g_pipe_mtx);
+	}
+}
+
+void write_compressed_segment(segment_slot *a_slot)
+{
+	int res;
+	segment_header_crc_t bh;
+	carith_comp_ctx *l_ctx = &a_slot->ctx;
+
+	if (g_index) {
+		if (carchive_index_add(&g_idx, g_out_offset, l_ctx->comp_len + l_ctx->freq_comp_len, l_ctx->plain_len, l_ctx->scheme) != CARCHIVE_ERR_NONE) {
+			color_err_printf(1, "carith: unable to grow segment index");
+			exit(EXIT_FAILURE);
+		}
+	}
+	g_out_offset += sizeof(segment_header_crc_t) + l_ctx->freq_comp_len + l_ctx->comp_len;
+
+	bh.scheme = l_ctx->scheme;
+	bh.rle_intermediate = htonl(l_ctx->rle_intermediate);
+	g_total_rle_len += l_ctx->rle_intermediate;
+	bh.lzss_intermediate = htonl(l_ctx->lzss_intermediate);
+	g_total_lzss_len += l_ctx->lzss_intermediate;
+	g_plain_crc = crc32_combine(g_plain_crc, a_slot->crc, l_ctx->plain_len);
+	bh.total_compsize = htonl(l_ctx->comp_len + l_ctx->freq_comp_len);
+	bh.freq_comp_len = htons(l_ctx->freq_comp_len);
+	bh.plain_len = htonl(l_ctx->plain_len);
+	bh.plain_crc = htonl(a_slot->crc);
+
+	// write block header
+	res = write(g_out_fd, &bh, sizeof(segment_header_crc_t));
+	if (res < 0) {
+		color_err_printf(1, "carith: unable to write to output file.");
+		exit(EXIT_FAILURE);
 	}
+	if (res != sizeof(segment_header_crc_t)) {
+		color_err_printf(0, "carith: difficulty writing segment header to output file: wrote %ld expected to write %ld.", res, sizeof(segment_header_crc_t));
+		exit(EXIT_FAILURE);
+	}
+	// write frequency table
+	res = write(g_out_fd, l_ctx->freq_comp, l_ctx->freq_comp_len);
+	if (res < 0) {
+		color_err_printf(1, "carith: unable to write to output file.");
+		exit(EXIT_FAILURE);
+	}
+	if (res != l_ctx->freq_comp_len) {
+		color_err_printf(0, "carith: difficulty writing to output file: wrote %ld expected to write %ld.", res, l_ctx->freq_comp_len);
+		exit(EXIT_FAILURE);
+	}
+	// write token table
+	res = write(g_out_fd, l_ctx->comp, l_ctx->comp_len);
+	if (res < 0) {
+		color_err_printf(1, "carith: unable to write to output file.");
+		exit(EXIT_FAILURE);
+	}
+	if (res != l_ctx->comp_len) {
+		color_err_printf(0, "carith: difficulty writing to output file: wrote %ld expected to write %ld.", res, l_ctx->comp_len);
+		exit(EXIT_FAILURE);
+	}
+	g_sofar += l_ctx->plain_len;
+}
+
+void write_extracted_segment(segment_slot *a_slot)
+{
+	int res;
+	carith_comp_ctx *l_ctx = &a_slot->ctx;
+
+	if (l_ctx->decomp_len != l_ctx->plain_len) {
+		// decoded to the wrong length, no CRC needed to know that's bad
+		g_bad_segs++;
+		if (g_use_stdout || g_failfast) {
+			color_err_printf(0, "carith: segment %d decoded to %ld bytes, expected %ld.", a_slot->seg_num, l_ctx->decomp_len, l_ctx->plain_len);
+			exit(EXIT_FAILURE);
+		}
+		color_printf("*acarith:*d *esegment %d length mismatch*d, decoded to *h%ld*d bytes, expected *h%ld*d.\n", a_slot->seg_num, l_ctx->decomp_len, l_ctx->plain_len);
+	} else if (g_segcrc && (a_slot->crc != a_slot->seg_crc)) {
+		// we know exactly where the damage is
+		g_bad_segs++;
+		if (g_use_stdout || g_failfast) {
+			// don't hand bad plaintext downstream, or don't bother with the rest
+			color_err_printf(0, "carith: segment %d CRC mismatch (plaintext offset %ld), expected %08X but got %08X.", a_slot->seg_num, a_slot->out_offset, a_slot->seg_crc, a_slot->crc);
+			exit(EXIT_FAILURE);
+		}
+		color_printf("*acarith:*d *esegment %d CRC mismatch*d (plaintext offset *h%ld*d length *h%ld*d), expected *h%08X*d but got *h%08X*d.\n", a_slot->seg_num, a_slot->out_offset, l_ctx->decomp_len, a_slot->seg_crc, a_slot->crc);
+	}
+	g_plain_crc = crc32_combine(g_plain_crc, a_slot->crc, l_ctx->decomp_len);
+	// the segment's place in the file is plain_len long whatever it decoded to
+	g_sofar += l_ctx->plain_len;
+	if (g_mode == MODE_TEST) {
+		// checked, and that's all
+		return;
+	}
+	if (g_pwrite) {
+		// the worker already put it in place, we're only here for the CRC and the progress meter
+		return;
+	}
+	color_trace("writing block %d to file. block CRC: %08X\n", l_ctx->block_num, a_slot->crc);
+	// write plains to file, exactly plain_len of them so a damaged segment can't shift the rest
+	res = write(g_out_fd, l_ctx->decomp, l_ctx->plain_len);
+	if (res < 0) {
+		color_err_printf(1, "carith: unable to write to output file.");
+		exit(EXIT_FAILURE);
+	}
+	if (res != l_ctx->plain_len) {
+		color_err_printf(0, "carith: difficulty writing to output file: wrote %ld expected to write %ld.", res, l_ctx->plain_len);
+		exit(EXIT_FAILURE);
+	}
+}
+
+void *writer_tf(void *arg)
+{
+	uint32_t l_seg;
+	segment_slot *l_slot;
+
+	for (l_seg = 0; ; ++l_seg) {
+		l_slot = &g_slots[l_seg % g_slot_count];
+		// wait for the next segment in order, or for the reader to tell us there are no more
+		pthread_mutex_lock(&g_pipe_mtx);
+		while (((l_slot->state != SLOT_DONE) || (l_slot->seg_num != l_seg)) && ((g_pipe_eof == 0) || (l_seg < g_pipe_queued))) {
+			pthread_cond_wait(&g_pipe_done_cond, &g_pipe_mtx);
+		}
+		if ((g_pipe_eof > 0) && (l_seg >= g_pipe_queued)) {
+			pthread_mutex_unlock(&g_pipe_mtx);
+			break;
+		}
+		pthread_mutex_unlock(&g_pipe_mtx);
+
+		color_trace("writer: segment %d\n", l_seg);
+		if (g_mode == MODE_COMPRESS) {
+			write_compressed_segment(l_slot);
+		} else {
+			write_extracted_segment(l_slot);
+		}
+		if (g_verbose) color_progress(g_sofar, g_progress_total);
+
+		// hand the slot back to the reader
+		pthread_mutex_lock(&g_pipe_mtx);
+		l_slot->state = SLOT_FREE;
+		pthread_cond_signal(&g_pipe_free_cond);
+		pthread_mutex_unlock(&g_pipe_mtx);
+	}
+	return NULL;
+}
+
+int cgroup_cpu_limit()
+{
+	// returns the number of CPUs the cgroup CPU quota works out to, or 0 if unlimited/unknown
+	FILE *l_f;
+	char l_line[BUFFLEN];
+	char l_path[BUFFLEN + 32];
+	long long l_quota = -1, l_period = 0;
+
+	// cgroup v2: find our own cgroup, then look at its cpu.max ("max 100000" or "200000 100000")
+	strcpy(l_path, "/sys/fs/cgroup/cpu.max");
+	l_f = fopen("/proc/self/cgroup", "r");
+	if (l_f != NULL) {
+		while (fgets(l_line, sizeof(l_line), l_f) != NULL) {
+			if (strncmp(l_line, "0::", 3) == 0) {
+				l_line[strcspn(l_line, "\n")] = 0;
+				snprintf(l_path, sizeof(l_path), "/sys/fs/cgroup%s/cpu.max", l_line + 3);
+				break;
+			}
+		}
+		fclose(l_f);
+	}
+	l_f = fopen(l_path, "r");
+	if (l_f == NULL)
+		l_f = fopen("/sys/fs/cgroup/cpu.max", "r");
+	if (l_f != NULL) {
+		if (fgets(l_line, sizeof(l_line), l_f) != NULL) {
+			if (sscanf(l_line, "%lld %lld", &l_quota, &l_period) != 2)
+				l_quota = -1; // "max"
+		}
+		fclose(l_f);
+	} else {
+		// cgroup v1
+		l_f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+		if (l_f != NULL) {
+			if (fscanf(l_f, "%lld", &l_quota) != 1)
+				l_quota = -1;
+			fclose(l_f);
+		}
+		l_f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+		if (l_f != NULL) {
+			if (fscanf(l_f, "%lld", &l_period) != 1)
+				l_period = 0;
+			fclose(l_f);
+		}
+	}
+	if ((l_quota <= 0) || (l_period <= 0))
+		return 0;
+	color_debug("cgroup cpu quota %lld period %lld\n", l_quota, l_period);
+	return (l_quota + l_period - 1) / l_period; // round partial CPUs up
+}
+
+int detect_threads()
+{
+	int l_cpus = 0;
+	int l_quota;
+	cpu_set_t l_set;
+
+	// start with the CPUs our affinity mask lets us run on
+	if (sched_getaffinity(0, sizeof(l_set), &l_set) == 0)
+		l_cpus = CPU_COUNT(&l_set);
+	if (l_cpus < 1)
+		l_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (l_cpus < 1)
+		l_cpus = 1;
+	// then clamp to the container's CPU quota
+	l_quota = cgroup_cpu_limit();
+	if ((l_quota > 0) && (l_quota < l_cpus))
+		l_cpus = l_quota;
+	color_debug("detected %d usable CPUs\n", l_cpus);
+	return l_cpus;
+}
+
+uint64_t segments_for(uint64_t a_plain_len)
+{
+	return (a_plain_len + g_segsize - 1) / g_segsize;
+}
+
+// histogram the whole input for the shared frequency table, which goes in the header ahead of every segment
+void shared_table_build()
+{
+	uint64_t l_hist[256];
+	uint8_t *l_buff;
+	uint64_t l_offset, l_len;
+	size_t i;
+
+	l_buff = malloc(g_segsize);
+	if (l_buff == NULL) {
+		color_err_printf(1, "carith: unable to allocate shared table buffer");
+		exit(EXIT_FAILURE);
+	}
+	memset(l_hist, 0, sizeof(l_hist));
+	for (l_offset = 0; l_offset < (uint64_t)g_in_len; l_offset += l_len) {
+		l_len = g_in_len - l_offset;
+		if (l_len > g_segsize)
+			l_len = g_segsize;
+		pread_fully(l_buff, l_len, l_offset);
+		for (i = 0; i < l_len; ++i)
+			l_hist[l_buff[i]]++;
+	}
+	free(l_buff);
+	if (carith_shared_build(l_hist, g_fh.shared_table, &g_fh.shared_table_len) != CARITH_ERR_NONE) {
+		color_err_printf(0, "carith: unable to build shared frequency table");
+		exit(EXIT_FAILURE);
+	}
+	// only the 64-bit header has room for it
+	g_fh.cookie = carchive_cookie_shared;
+	g_shared_table = g_fh.shared_table;
+	g_shared_table_len = g_fh.shared_table_len;
+	if (g_verbose) color_printf("*acarith:*d shared frequency table: *h%d*d bytes\n", g_shared_table_len);
+}
+
+void pipeline_alloc(uint64_t a_segs)
+{
+	// size the thread pool and slot ring to the job: no more threads than
+	// segments, and no more slots than segments either. pass UINT32_MAX when
+	// reading a stream of unknown length
+	size_t i;
+	carith_error_t init_error;
+	uint64_t l_segs = a_segs;
+
+	if (l_segs < 1)
+		l_segs = 1;
+	if (g_threads > l_segs)
+		g_threads = l_segs;
+	g_slot_count = g_threads * PIPELINE_DEPTH;
+	if (g_slot_count > l_segs)
+		g_slot_count = l_segs;
+	if (g_threads > 1) {
+		if (g_verbose) color_printf("*acarith:*d enabling *h%d*d threads.\n", g_threads);
+	}
+	color_debug("%ld segments, %d threads, %d slots\n", l_segs, g_threads, g_slot_count);
+
+	twa = aligned_alloc(64, g_threads * sizeof(thread_work_area));
+	g_slots = aligned_alloc(64, g_slot_count * sizeof(segment_slot));
+	if ((twa == NULL) || (g_slots == NULL)) {
+		color_err_printf(1, "carith: unable to allocate pipeline");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < g_threads; ++i) {
+		twa[i].queue.entries = malloc(g_slot_count * sizeof(uint32_t));
+		if (twa[i].queue.entries == NULL) {
+			color_err_printf(1, "carith: unable to allocate work queue");
+			exit(EXIT_FAILURE);
+		}
+	}
+	// init carith contexts, one per pipeline slot
+	for (i = 0; i < g_slot_count; ++i) {
+		init_error = carith_init_ctx(&g_slots[i].ctx, g_segsize);
+		if (init_error != CARITH_ERR_NONE) {
+			color_err_printf(0, "carith_init_ctx retuned %s.\n", carith_strerror(init_error));
+			exit(EXIT_FAILURE);
+		}
+		if (g_shared_table_len > 0) {
+			init_error = carith_shared_load(&g_slots[i].ctx, g_shared_table, g_shared_table_len);
+			if (init_error != CARITH_ERR_NONE) {
+				color_err_printf(0, "carith: archive's shared frequency table: %s.", carith_strerror(init_error));
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+void pipeline_free()
+{
+	size_t i;
+
+	for (i = 0; i < g_slot_count; ++i) {
+		carith_free_ctx(&g_slots[i].ctx);
+	}
+	for (i = 0; i < g_threads; ++i) {
+		free(twa[i].queue.entries);
+	}
+	free(g_slots);
+	free(twa);
+}
+
+void pipeline_start()
+{
+	size_t i;
+
+	g_pipe_queued = 0;
+	g_pipe_idle = 0;
+	atomic_store(&g_pipe_eof, 0);
+	g_sofar = 0;
+	for (i = 0; i < g_slot_count; ++i)
+		g_slots[i].state = SLOT_FREE;
+	sem_init(&g_pipe_work_sem, 0, 0);
+	pthread_mutex_init(&g_pipe_mtx, NULL);
+	pthread_cond_init(&g_pipe_done_cond, NULL);
+	pthread_cond_init(&g_pipe_free_cond, NULL);
+	for (i = 0; i < g_threads; ++i) {
+		twa[i].id = i;
+		atomic_store(&twa[i].queue.head, 0);
+		atomic_store(&twa[i].queue.tail, 0);
+		pthread_create(&twa[i].thread, NULL, compress_tf, &twa[i]);
+	}
+	pthread_create(&g_writer_thread, NULL, writer_tf, NULL);
+}
+
+segment_slot *pipeline_claim_slot(uint32_t a_seg)
+{
+	// reader: wait for the slot that segment a_seg maps to to come back from the writer
+	segment_slot *l_slot = &g_slots[a_seg % g_slot_count];
+
+	pthread_mutex_lock(&g_pipe_mtx);
+	while (l_slot->state != SLOT_FREE)
+		pthread_cond_wait(&g_pipe_free_cond, &g_pipe_mtx);
+	// the writer reads seg_num under the mutex, so it has to be set under it too
+	l_slot->seg_num = a_seg;
+	pthread_mutex_unlock(&g_pipe_mtx);
+	return l_slot;
+}
+
+void pipeline_queue_slot(segment_slot *a_slot)
+{
+	uint32_t l_slot = a_slot - g_slots;
+
+	pthread_mutex_lock(&g_pipe_mtx);
+	a_slot->state = SLOT_QUEUED;
+	g_pipe_queued++;
+	// onto the owner's queue, waking any worker that found them all empty
+	work_queue_push(&twa[l_slot % g_threads].queue, l_slot);
+	if (g_pipe_idle > 0)
+		pthread_cond_broadcast(&g_pipe_done_cond);
+	pthread_mutex_unlock(&g_pipe_mtx);
+	// and wake up one worker
+	sem_post(&g_pipe_work_sem);
+}
+
+void pipeline_finish()
+{
+	size_t i;
+
+	// no more input: wake everybody up so they can drain the pipeline and quit
+	pthread_mutex_lock(&g_pipe_mtx);
+	atomic_store(&g_pipe_eof, 1);
+	pthread_cond_broadcast(&g_pipe_done_cond);
+	pthread_mutex_unlock(&g_pipe_mtx);
+	for (i = 0; i < g_threads; ++i)
+		sem_post(&g_pipe_work_sem);
+
+	color_debug("joining threads...\n");
+	pthread_join(g_writer_thread, NULL);
+	for (i = 0; i < g_threads; ++i) {
+		pthread_join(twa[i].thread, NULL);
+	}
+	color_debug("destroying synchronization primitives...\n");
+	pthread_cond_destroy(&g_pipe_free_cond);
+	pthread_cond_destroy(&g_pipe_done_cond);
+	pthread_mutex_destroy(&g_pipe_mtx);
+	sem_destroy(&g_pipe_work_sem);
 }
 
 void compress()
 {
 	// compress file g_in
 	int res;
-	size_t i, j;
-	int l_eof = 0;
-	int l_docontinue = 0;
-	uint32_t l_seg_ctr = 0;
-	file_header_t l_fh;
-	size_t l_sofar;
-
-	// set output name
-	g_out[0] = 0;
-	strcpy(g_out, g_in);
-	strcat(g_out, g_carith_suffix);
-	color_debug("set output filename to %s\n", g_out);
-	// open output file
-	g_out_fd = open(g_out, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (g_out_fd < 0) {
-		color_err_printf(1, "carith: unable to open output file");
-		exit(EXIT_FAILURE);
+	uint32_t l_seg_ctr;
+	segment_slot *l_slot;
+
+	if (g_use_stdout) {
+		// can't seek back on a pipe, so write the streamed format
+		g_out_fd = STDOUT_FILENO;
+		strcpy(g_out, "(stdout)");
+	} else {
+		// set output name
+		g_out[0] = 0;
+		strcpy(g_out, g_in);
+		strcat(g_out, g_carith_suffix);
+		color_debug("set output filename to %s\n", g_out);
+		// open output file
+		g_out_fd = open(g_out, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if (g_out_fd < 0) {
+			color_err_printf(1, "carith: unable to open output file");
+			exit(EXIT_FAILURE);
+		}
 	}
 	// prepare file header + space in output file
-	// we will rewind here later to populate the CRC and the total file size
-	memset(&l_fh, 0, sizeof(l_fh));
-	l_fh.cookie = htons(g_cookie);
-	l_fh.mode = htonl(g_in_mode);
-	// source file mtime
-	for (int mshift = 4; mshift >= 0; --mshift) {
-		l_fh.mtime[mshift] = g_in_mtime & 0xff;
-		g_in_mtime >>= 8;
-	}
+	// we will rewind here later to populate the CRC and the total file size,
+	// unless we're streaming, in which case those go in the trailer
+	memset(&g_fh, 0, sizeof(g_fh));
+	// anything over 4GB needs the 64-bit header
+	g_fh.cookie = ((g_in_len > UINT32_MAX) || g_header64) ? carchive_cookie64 : carchive_cookie;
+	g_fh.mode = g_in_mode;
+	g_fh.mtime = g_in_mtime;
 	if (g_roulette) {
-		l_fh.scheme |= scheme_roulette;
+		g_fh.scheme |= scheme_roulette;
 	} else if (g_rleonly) {
-		l_fh.scheme |= scheme_rle;
+		g_fh.scheme |= scheme_rle;
 	} else if (g_lzssonly) {
 		if (g_uselzss32) {
-			l_fh.scheme |= scheme_lzss32;
+			g_fh.scheme |= scheme_lzss32;
 		} else {
-			l_fh.scheme |= scheme_lzss4;
+			g_fh.scheme |= scheme_lzss4;
 		}
 	} else {
 		if (g_norle) {
-			l_fh.scheme |= scheme_ac;
+			g_fh.scheme |= scheme_ac;
 		} else {
-			l_fh.scheme |= scheme_ac;
-			l_fh.scheme |= scheme_rle;
+			g_fh.scheme |= scheme_ac;
+			g_fh.scheme |= scheme_rle;
 		}
 		if (g_nolzss == 0) {
 			if (g_uselzss32) {
-				l_fh.scheme |= scheme_lzss32;
+				g_fh.scheme |= scheme_lzss32;
 			} else {
-				l_fh.scheme |= scheme_lzss4;
+				g_fh.scheme |= scheme_lzss4;
 			}
 		}
 	}
-	l_fh.total_plain_len = htonl(g_in_len);
-	l_fh.segsize = htonl(g_segsize);
-	l_fh.total_rle_len = 0;
-	l_fh.total_lzss_len = 0;
-	res = write(g_out_fd, &l_fh, sizeof(l_fh));
-	if (res < 0) {
+	// the chain without any file level bits is what every segment starts out with
+	uint8_t l_chain = g_fh.scheme;
+	// every segment header carries the CRC of its plaintext
+	g_fh.scheme |= scheme_segcrc;
+	if (g_use_stdout) {
+		g_fh.scheme |= scheme_streamed;
+		// no going back to set this later
+		if (g_index)
+			g_fh.scheme |= scheme_indexed;
+	}
+	g_fh.total_plain_len = g_in_len;
+	g_fh.segsize = g_segsize;
+	if (g_sharedtable)
+		shared_table_build();
+	g_total_rle_len = 0;
+	g_total_lzss_len = 0;
+	size_t l_header_len;
+	if (carchive_header_write(&g_fh, g_out_fd, &l_header_len) != CARCHIVE_ERR_NONE) {
 		color_err_printf(1, "carith: unable to write file header to output file.");
+		exit(EXIT_FAILURE);
 	}
 
 	// write infotag, if it exists
@@ -293,113 +958,112 @@ void compress()
 		}
 	}
 
+	// segments start right after the infotag
+	g_out_offset = l_header_len + sizeof(l_infotag_len) + l_infotag_len;
+	carchive_index_init(&g_idx, g_fh.scheme);
+
+	pipeline_alloc(g_use_stdin ? UINT32_MAX : segments_for(g_in_len));
 	if (g_verbose) color_printf("*acarith:*d compressing *h%s*d ... ", g_in);
 
-	// spin up and init threads
-	for (i = 0; i < g_threads; ++i) {
-		pthread_mutex_init(&twa[i].sig_mtx, NULL);
-		pthread_cond_init(&twa[i].sig_cond, NULL);
-		twa[i].id = i;
-		twa[i].runflag = 1;
-		pthread_create(&twa[i].thread, NULL, compress_tf, &twa[i]);
+	// map the input if we can, so workers read their plaintext straight out of the page cache
+	if (g_usemmap && (g_in_len > 0)) {
+		g_in_map = mmap(NULL, g_in_len, PROT_READ, MAP_PRIVATE, g_in_fd, 0);
+		if (g_in_map == MAP_FAILED) {
+			color_debug("mmap of input failed (%s), falling back to read()\n", strerror(errno));
+			g_in_map = NULL;
+		} else {
+			madvise(g_in_map, g_in_len, MADV_SEQUENTIAL);
+		}
 	}
 
-	uint32_t l_crc = 0;
-	uint32_t l_block_crc = 0;
-	l_sofar = 0;
-	if (g_verbose) color_progress(l_sofar, g_in_len);
-
-	do {
-		g_tally = 0;
-		// now read a bunch of g_segsize blocks
-		for (i = 0; i < g_threads; ++i) {
-			res = read(g_in_fd, ctx[i].plain, g_segsize);;
-			if (res == 0) {
-				color_debug("EOF on input file, bailing out\n");
-				l_eof = 1;
-				if (i == 0)
-					l_docontinue = 1;
+	g_plain_crc = 0;
+	g_progress_total = g_in_len;
+	if (g_verbose) color_progress(0, g_progress_total);
+
+	// spin up workers and writer, then act as the reader stage
+	pipeline_start();
+	for (l_seg_ctr = 0; ; ++l_seg_ctr) {
+		l_slot = pipeline_claim_slot(l_seg_ctr);
+		if (g_in_map != NULL) {
+			// zero copy: point the context at its piece of the mapped file
+			off_t l_offset = (off_t)l_seg_ctr * g_segsize;
+			if (l_offset >= g_in_len) {
+				color_debug("end of mapped input file, bailing out\n");
 				break;
-				// at this point, i contains the number of bytes successfully read
-			} else if (res < 0) {
-				color_err_printf(1, "carith: unable to read input file");
-				exit(EXIT_FAILURE);
-			}
-			// compute crc on input file here
-			ctx[i].plain_len = res;
-			ctx[i].scheme = l_fh.scheme;
-			l_sofar += res;
-			l_crc = get_buffer_crc(l_crc, ctx[i].plain, ctx[i].plain_len);
-			l_block_crc = get_buffer_crc(0, ctx[i].plain, ctx[i].plain_len);
-			color_debug("read segment %d from input file len %ld block CRC %08X\n", l_seg_ctr, res, l_block_crc);
-			// populate a thread and signal it
-			pthread_mutex_lock(&twa[i].sig_mtx);
-			twa[i].cur_seg = l_seg_ctr;
-			twa[i].sigflag = 1;
-			pthread_cond_signal(&twa[i].sig_cond);
-			pthread_mutex_unlock(&twa[i].sig_mtx);
-			l_seg_ctr++;
-		}
-		if (l_docontinue > 0)
-			continue; // go down to bottom of do loop
-
-		color_debug("waiting for threads to finish\n");
-		// wait for threads to finish
-		pthread_mutex_lock(&g_tally_mtx);
-		while (g_tally < i)
-			pthread_cond_wait(&g_tally_cond, &g_tally_mtx);
-		pthread_mutex_unlock(&g_tally_mtx);
-		// all our threads are done and the plains are all contained in the ctx data structures
-		color_debug("processing %d segments\n", i);
-		for (j = 0; j < i; ++j) {
-			segment_header_t bh;
-			bh.scheme = ctx[j].scheme;
-			bh.rle_intermediate = htonl(ctx[j].rle_intermediate);
-			l_fh.total_rle_len += ctx[j].rle_intermediate;
-			bh.lzss_intermediate = htonl(ctx[j].lzss_intermediate);
-			l_fh.total_lzss_len += ctx[j].lzss_intermediate;
-			bh.total_compsize = htonl(ctx[j].comp_len + ctx[j].freq_comp_len);
-			bh.freq_comp_len = htons(ctx[j].freq_comp_len);
-			bh.plain_len = htonl(ctx[j].plain_len);
-
-			// write block header
-			color_debug("segment %ld writing header..\n", j);
-			res = write(g_out_fd, &bh, sizeof(bh));
-			if (res < 0) {
-				color_err_printf(1, "carith: unable to write to output file.");
-				exit(EXIT_FAILURE);
-			}
-			if (res != sizeof(bh)) {
-				color_err_printf(0, "carith: difficulty writing segment header to output file: wrote %ld expected to write %ld.", res, sizeof(bh));
-				exit(EXIT_FAILURE);
-			}
-			// write frequency table
-			res = write(g_out_fd, ctx[j].freq_comp, ctx[j].freq_comp_len);
-			if (res < 0) {
-				color_err_printf(1, "carith: unable to write to output file.");
-				exit(EXIT_FAILURE);
-			}
-			if (res != ctx[j].freq_comp_len) {
-				color_err_printf(0, "carith: difficulty writing to output file: wrote %ld expected to write %ld.", res, ctx[j].freq_comp_len);
-				exit(EXIT_FAILURE);
-			}
-			// write token table
-			res = write(g_out_fd, ctx[j].comp, ctx[j].comp_len);
-			if (res < 0) {
-				color_err_printf(1, "carith: unable to write to output file.");
-				exit(EXIT_FAILURE);
 			}
-			if (res != ctx[j].comp_len) {
-				color_err_printf(0, "carith: difficulty writing to output file: wrote %ld expected to write %ld.", res, ctx[j].comp_len);
-				exit(EXIT_FAILURE);
+			res = ((g_in_len - l_offset) < g_segsize) ? (g_in_len - l_offset) : g_segsize;
+			l_slot->ctx.plain = g_in_map + l_offset;
+		} else {
+			l_slot->ctx.plain = l_slot->ctx.plain_buf;
+			res = read_fully(g_in_fd, l_slot->ctx.plain, g_segsize);
+			if (res == 0) {
+				color_debug("EOF on input file, bailing out\n");
+				break;
 			}
 		}
-		if (g_verbose) color_progress(l_sofar, g_in_len);
-	} while (l_eof == 0);
+		l_slot->ctx.plain_len = res;
+		l_slot->ctx.scheme = l_chain;
+		l_slot->ctx.coder = g_coder;
+		l_slot->ctx.auto_slack = g_auto_slack;
+		color_trace("queued segment %d from input file len %d\n", l_seg_ctr, res);
+		pipeline_queue_slot(l_slot);
+	}
+	pipeline_finish();
+	pipeline_free();
+	if (g_in_map != NULL) {
+		munmap(g_in_map, g_in_len);
+		g_in_map = NULL;
+	}
 	if (g_verbose) printf("\n"); // after color_progress meter
 
+	// the writer combined the workers' segment CRCs in segment order
+	uint32_t l_crc = g_plain_crc;
 	color_debug("input file CRC: %08X\n", l_crc);
-	l_fh.plain_crc = htonl(l_crc);
+	g_fh.plain_crc = l_crc;
+
+	if (g_use_stdout) {
+		// streamed: end marker, then the trailer with everything we'd otherwise go back and put in the header
+		segment_header_crc_t l_end;
+		carchive_stream_trailer_t l_trailer;
+
+		memset(&l_end, 0, sizeof(l_end));
+		l_trailer.plain_crc = l_crc;
+		l_trailer.total_plain_len = g_sofar;
+		l_trailer.total_rle_len = g_total_rle_len;
+		l_trailer.total_lzss_len = g_total_lzss_len;
+		carchive_trailer_encode(&l_trailer);
+		res = write(g_out_fd, &l_end, sizeof(l_end));
+		if (res == sizeof(l_end))
+			res = write(g_out_fd, &l_trailer, sizeof(l_trailer));
+		if (res != sizeof(l_trailer)) {
+			color_err_printf(res < 0, "carith: unable to write stream trailer to output.");
+			exit(EXIT_FAILURE);
+		}
+		g_out_offset += sizeof(l_end) + sizeof(l_trailer);
+	}
+
+	// segment index goes on the end
+	uint64_t l_index_len = 0;
+	if (g_index) {
+		carchive_error_t l_err = carchive_index_write(&g_idx, g_out_fd, g_out_offset, &l_index_len);
+		if (l_err != CARCHIVE_ERR_NONE) {
+			color_err_printf(l_err == CARCHIVE_ERR_IO, "carith: unable to write segment index: %s", carchive_strerror(l_err));
+			exit(EXIT_FAILURE);
+		}
+		g_fh.scheme |= scheme_indexed;
+		color_debug("wrote index of %d segments at offset %ld, %ld bytes\n", g_idx.count, g_out_offset, l_index_len);
+	}
+	carchive_index_free(&g_idx);
+
+	if (g_use_stdout) {
+		// nothing to go back and fix up, and the input stays put, like gzip -c
+		color_debug("streamed %ld bytes into %ld\n", g_sofar, g_out_offset);
+		if (!g_use_stdin)
+			close(g_in_fd);
+		return;
+	}
+	g_fh.total_rle_len = g_total_rle_len;
+	g_fh.total_lzss_len = g_total_lzss_len;
 
 	// user warnings
 	int l_warn_norle = 0;
@@ -407,24 +1071,21 @@ void compress()
 	int l_warn_nolzss = 0;
 	int l_warn_aconly = 0;
 	// check total_rle_len, is it sane?
-	if (l_fh.total_rle_len > g_in_len)
+	if (g_fh.total_rle_len > g_in_len)
 		l_warn_norle = 1;
 
-	if (l_fh.total_lzss_len > g_in_len)
+	if (g_fh.total_lzss_len > g_in_len)
 		l_warn_nolzss = 1;
 
-	l_fh.total_rle_len = htonl(l_fh.total_rle_len);
-	l_fh.total_lzss_len = htonl(l_fh.total_lzss_len);
-
 	// seek output back and write out updated file header
 	res = lseek(g_out_fd, 0, SEEK_SET);
 	if (res < 0) {
 		color_err_printf(1, "carith: unable to seek output file.");
 		exit(EXIT_FAILURE);
 	}
-	res = write(g_out_fd, &l_fh, sizeof(l_fh));
-	if (res < 0) {
+	if (carchive_header_write(&g_fh, g_out_fd, &l_header_len) != CARCHIVE_ERR_NONE) {
 		color_err_printf(1, "carith: unable to write file header to output file after compression.");
+		exit(EXIT_FAILURE);
 	}
 	// how big is the output file in totality?
 	struct stat l_stat;
@@ -435,11 +1096,11 @@ void compress()
 	}
 
 	// did AC encoding with RLE increase the size of the file?
-	size_t l_complen = l_stat.st_size - sizeof(l_fh); // all the crap past the file header
-	if (((l_fh.scheme & 0xc0) == 0xc0) && (l_complen > ntohl(l_fh.total_rle_len)))
+	size_t l_complen = l_stat.st_size - l_header_len - l_index_len; // all the crap past the file header, less the index
+	if (((g_fh.scheme & 0xc0) == 0xc0) && (l_complen > g_fh.total_rle_len))
 		l_warn_rleonly = 1;
 	// did AC encoding by itself increase the size of the file?
-	if (((l_fh.scheme & 0xc0) == scheme_ac) && (l_stat.st_size > g_in_len))
+	if (((g_fh.scheme & 0xc0) == scheme_ac) && (l_stat.st_size > g_in_len))
 		l_warn_aconly = 1;
 
 	if (g_verbose) {
@@ -448,36 +1109,20 @@ void compress()
 			color_printf("*acarith:*d *ewarning:*d both RLE encoding and arithmetic coding caused file size to increase.\n*acarith:*d file *h%s*d can not be compressed efficiently with *acarith*d.\n", g_in);
 		} else {
 			if (l_warn_nolzss) {
-				color_printf("*acarith:*d *ewarning:*d LZSS encoding caused file size to bloom from *h%ld*d to *h%ld*d.\n*acarith:*d use *h--nolzss*d switch to get better compression ratio.\n", g_in_len, ntohl(l_fh.total_lzss_len));
+				color_printf("*acarith:*d *ewarning:*d LZSS encoding caused file size to bloom from *h%ld*d to *h%ld*d.\n*acarith:*d use *h--nolzss*d switch to get better compression ratio.\n", g_in_len, g_fh.total_lzss_len);
 			}
 			if (l_warn_norle) {
-				color_printf("*acarith:*d *ewarning:*d RLE encoding caused file size to bloom from *h%ld*d to *h%ld*d.\n*acarith:*d use *h--norle*d switch to get better compression ratio.\n", g_in_len, ntohl(l_fh.total_rle_len));
+				color_printf("*acarith:*d *ewarning:*d RLE encoding caused file size to bloom from *h%ld*d to *h%ld*d.\n*acarith:*d use *h--norle*d switch to get better compression ratio.\n", g_in_len, g_fh.total_rle_len);
 			}
 			if (l_warn_rleonly) { // warn user that ditching AC will mean a smaller file
-				color_printf("*acarith:*d *ewarning:*d arithmetic compression caused RLE output to bloom from *h%ld*d to final size of *h%ld*d.\n*acarith:*d use *h--rleonly*d switch to get better compression ratio.\n", ntohl(l_fh.total_rle_len), l_complen);
+				color_printf("*acarith:*d *ewarning:*d arithmetic compression caused RLE output to bloom from *h%ld*d to final size of *h%ld*d.\n*acarith:*d use *h--rleonly*d switch to get better compression ratio.\n", g_fh.total_rle_len, l_complen);
 			}
 			if (l_warn_aconly) { // warn user that AC by itself isn't cutting it
 				color_printf("*acarith:*d *ewarning:*d arithmetic compression by itself caused file size to bloom from *h%ld*d to *h%ld*d.\n*acarith:*d use RLE to possibly get better compression ratio.\n", g_in_len, l_stat.st_size);
 			}
 		}
 	}
-	if (g_verbose) color_printf("*acarith:*d compressed *h%s*d into *h%s*d (ratio *h%3.5f%%*d)\n", g_in, g_out, (float)(l_stat.st_size) / (float)(ntohl(l_fh.total_plain_len)) * 100.0);
-
-	color_debug("joining threads...\n");
-	// join threads
-	for (i = 0; i < g_threads; ++i) {
-		pthread_mutex_lock(&twa[i].sig_mtx);
-		twa[i].runflag = 0;
-		pthread_cond_signal(&twa[i].sig_cond);
-		pthread_mutex_unlock(&twa[i].sig_mtx);
-		pthread_join(twa[i].thread, NULL);
-	}
-	color_debug("destroying synchronization primitives...\n");
-	// clean up
-	for (i = 0; i < g_threads; ++i) {
-		pthread_mutex_destroy(&twa[i].sig_mtx);
-		pthread_cond_destroy(&twa[i].sig_cond);
-	}
+	if (g_verbose) color_printf("*acarith:*d compressed *h%s*d into *h%s*d (ratio *h%3.5f%%*d)\n", g_in, g_out, (float)(l_stat.st_size) / (float)(g_fh.total_plain_len) * 100.0);
 
 	if (g_keep == 0) {
 		// unlink g_in
@@ -491,35 +1136,35 @@ void compress()
 
 void extract()
 {
-	size_t i, j;
+	size_t i;
 	int res;
-	file_header_t l_fh;
+	carchive_header_t l_fh;
+	size_t l_header_len;
 	struct stat l_in_stat;
 	time_t l_in_mtime;
 
-	res = read(g_in_fd, &l_fh, sizeof(l_fh));
-	if (res < 0) {
-		color_err_printf(1, "unable to read file header from input file");
+	carchive_error_t l_header_err = carchive_header_read(&l_fh, g_in_fd, &l_header_len);
+	if (l_header_err != CARCHIVE_ERR_NONE) {
+		color_err_printf(l_header_err == CARCHIVE_ERR_IO, "carith: %s", (l_header_err == CARCHIVE_ERR_IO) ? "unable to read file header from input file" : "file is not a carith archive.");
 		exit(EXIT_FAILURE);
 	}
 
 	// read infotag
-	uint8_t l_infotag_len;
-	res = read(g_in_fd, &l_infotag_len, sizeof(l_infotag_len));
-	if (res < 0) {
-		color_err_printf(1, "unable to read infotag len from input file");
-		exit(EXIT_FAILURE);
-	}
+	uint8_t l_infotag_len = 0;
+	res = read_fully(g_in_fd, &l_infotag_len, sizeof(l_infotag_len));
 	if (l_infotag_len > 0) {
-		res = read(g_in_fd, g_infotag, l_infotag_len);
-		if (res < 0) {
-			color_err_printf(1, "unable to read infotag from input file");
+		res = read_fully(g_in_fd, g_infotag, l_infotag_len);
+		if (res < l_infotag_len) {
+			color_err_printf(0, "unable to read infotag from input file");
 			exit(EXIT_FAILURE);
 		}
 		g_infotag[l_infotag_len] = 0;
 	}
+	uint64_t l_segs_offset = l_header_len + sizeof(l_infotag_len) + l_infotag_len;
+	g_shared_table = l_fh.shared_table;
+	g_shared_table_len = l_fh.shared_table_len;
 
-	res = stat(g_in, &l_in_stat);
+	res = fstat(g_in_fd, &l_in_stat);
 	if (res < 0) {
 		color_err_printf(1, "unable to stat input file");
 		exit(EXIT_FAILURE);
@@ -529,64 +1174,124 @@ void extract()
 	if (g_mode == MODE_TELL)
 		g_verbose = 1;
 
-	if (ntohs(l_fh.cookie) == g_cookie) {
-		// unpack infile time
-		l_in_mtime = 0;
-		l_in_mtime |= l_fh.mtime[0];
-		for (i = 1; i < 5; ++i) {
-			l_in_mtime <<= 8;
-			l_in_mtime |= l_fh.mtime[i];
-		}
-		color_debug("l_in_mtime %016lX\n", l_in_mtime);
-		if (g_verbose) {
-			color_printf("*acarith:*d --- original file length: *h%ld*d\n", ntohl(l_fh.total_plain_len));
-			if ((l_fh.scheme & scheme_roulette) != scheme_roulette) {
-				if ((l_fh.scheme & scheme_rle) == scheme_rle) {
-					color_printf("*acarith:*d --- RLE intermediate:     *h%ld*d\n", ntohl(l_fh.total_rle_len));
-				}
-				if ((l_fh.scheme & 0x30) > 0) {
-					color_printf("*acarith:*d --- LZSS intermediate:    *h%ld*d\n", ntohl(l_fh.total_lzss_len));
-				}
-			}
-			color_printf("*acarith:*d --- size on disk:         *h%ld*d\n", g_in_len);
-			color_printf("*acarith:*d --- compression ratio:    *h%3.5f%%*d\n", (float)l_in_stat.st_size / (float)ntohl(l_fh.total_plain_len) * 100.0);
-			color_printf("*acarith:*d --- original file mode:   *h%08lX*d (*h%s*d)\n", ntohl(l_fh.mode), decimal_mode(ntohl(l_fh.mode)));
-			color_printf("*acarith:*d --- modification time:    *h%s*d", ctime(&l_in_mtime));
-			color_printf("*acarith:*d --- segment size:         *h%dk*d\n", ntohl(l_fh.segsize) / 1024);
-			color_printf("*acarith:*d --- original file CRC:    *h%08X*d\n", ntohl(l_fh.plain_crc));
-			color_printf("*acarith:*d --- compression chain:    ");
-			if ((l_fh.scheme & scheme_roulette) != scheme_roulette) {
-				if ((l_fh.scheme & scheme_rle) == scheme_rle)
-					color_printf("*bRLE *d");
-				if ((l_fh.scheme & scheme_lzss4) == scheme_lzss4)
-					color_printf("*bLZSS4 *d");
-				if ((l_fh.scheme & scheme_lzss32) == scheme_lzss32)
-					color_printf("*bLZSS32 *d");
-				if ((l_fh.scheme & scheme_ac) == scheme_ac)
-					color_printf("*bAC *d");
-			} else {
-				color_printf("*bICMS*d ");
-				if (!g_showsegs) color_printf("(use *h-t*d with *h-s*d or *h--showsegs*d to interrogate individual segments)");
+	segment_header_crc_t bh;
+	size_t l_hdr_len = carchive_segment_header_len(l_fh.scheme);
+	g_segcrc = ((l_fh.scheme & scheme_segcrc) == scheme_segcrc);
+	g_bad_segs = 0;
+
+	// pick up the segment index if there is one
+	carchive_index_init(&g_idx, l_fh.scheme);
+	g_pread_segments = 0;
+	if (((l_fh.scheme & scheme_indexed) == scheme_indexed) && !g_use_stdin) {
+		carchive_error_t l_err = carchive_index_read(&g_idx, g_in_fd, g_in_len);
+		if (l_err == CARCHIVE_ERR_NONE) {
+			color_debug("loaded index of %d segments\n", g_idx.count);
+			g_pread_segments = 1;
+		} else {
+			color_err_printf(0, "carith: warning: unable to use segment index (%s), scanning segment headers instead.", carchive_strerror(l_err));
+		}
+	}
+
+	// a streamed archive keeps its totals in the trailer. if it's sitting in a
+	// file we can go and get them now, otherwise they turn up after the last segment
+	int l_have_trailer = 0;
+	if (((l_fh.scheme & scheme_streamed) == scheme_streamed) && !g_use_stdin) {
+		carchive_stream_trailer_t l_trailer;
+		carchive_error_t l_err = CARCHIVE_ERR_NONE;
+
+		if (!g_pread_segments) {
+			l_err = carchive_index_scan(&g_idx, g_in_fd, l_segs_offset, g_in_len, UINT64_MAX);
+			if (l_err == CARCHIVE_ERR_NONE)
+				g_pread_segments = 1;
+		}
+		if (l_err == CARCHIVE_ERR_NONE)
+			l_err = carchive_trailer_read(&l_trailer, g_in_fd, carchive_segments_end(&g_idx, l_segs_offset) + l_hdr_len);
+		if (l_err != CARCHIVE_ERR_NONE) {
+			color_err_printf(0, "carith: unable to find stream trailer: %s", carchive_strerror(l_err));
+			exit(EXIT_FAILURE);
+		}
+		l_fh.plain_crc = l_trailer.plain_crc;
+		l_fh.total_plain_len = l_trailer.total_plain_len;
+		l_fh.total_rle_len = l_trailer.total_rle_len;
+		l_fh.total_lzss_len = l_trailer.total_lzss_len;
+		l_have_trailer = 1;
+	}
+
+	l_in_mtime = l_fh.mtime;
+	color_debug("l_in_mtime %016lX\n", l_in_mtime);
+	if (g_verbose) {
+		color_printf("*acarith:*d --- original file length: *h%ld*d\n", l_fh.total_plain_len);
+		if ((l_fh.scheme & scheme_roulette) != scheme_roulette) {
+			if ((l_fh.scheme & scheme_rle) == scheme_rle) {
+				color_printf("*acarith:*d --- RLE intermediate:     *h%ld*d\n", l_fh.total_rle_len);
 			}
-			printf("\n");
-			if (l_infotag_len > 0) {
-				color_printf("*acarith:*d --- infotag:              *h%s*d\n", g_infotag);
+			if ((l_fh.scheme & 0x30) > 0) {
+				color_printf("*acarith:*d --- LZSS intermediate:    *h%ld*d\n", l_fh.total_lzss_len);
 			}
 		}
-	} else {
-		color_err_printf(0, "carith: file is not a carith archive.");
-		close(g_in_fd);
-		exit(EXIT_FAILURE);
+		color_printf("*acarith:*d --- size on disk:         *h%ld*d\n", g_in_len);
+		color_printf("*acarith:*d --- compression ratio:    *h%3.5f%%*d\n", (float)l_in_stat.st_size / (float)l_fh.total_plain_len * 100.0);
+		color_printf("*acarith:*d --- original file mode:   *h%08lX*d (*h%s*d)\n", l_fh.mode, decimal_mode(l_fh.mode));
+		color_printf("*acarith:*d --- modification time:    *h%s*d", ctime(&l_in_mtime));
+		color_printf("*acarith:*d --- segment size:         *h%dk*d\n", l_fh.segsize / 1024);
+		color_printf("*acarith:*d --- original file CRC:    *h%08X*d\n", l_fh.plain_crc);
+		if (l_fh.shared_table_len > 0)
+			color_printf("*acarith:*d --- shared freq table:    *h%d*d bytes\n", l_fh.shared_table_len);
+		color_printf("*acarith:*d --- compression chain:    ");
+		if ((l_fh.scheme & scheme_roulette) != scheme_roulette) {
+			if ((l_fh.scheme & scheme_rle) == scheme_rle)
+				color_printf("*bRLE *d");
+			if ((l_fh.scheme & scheme_lzss4) == scheme_lzss4)
+				color_printf("*bLZSS4 *d");
+			if ((l_fh.scheme & scheme_lzss32) == scheme_lzss32)
+				color_printf("*bLZSS32 *d");
+			if ((l_fh.scheme & scheme_ac) == scheme_ac)
+				color_printf("*bAC *d");
+		} else {
+			color_printf("*bICMS*d ");
+			if (!g_showsegs) color_printf("(use *h-t*d with *h-s*d or *h--showsegs*d to interrogate individual segments)");
+		}
+		printf("\n");
+		if (l_infotag_len > 0) {
+			color_printf("*acarith:*d --- infotag:              *h%s*d\n", g_infotag);
+		}
 	}
 
-	segment_header_t bh;
+	if ((g_mode == MODE_TELL) && (g_showsegs == 1) && (g_pread_segments)) {
+		// everything we need is in the index
+		for (i = 0; i < g_idx.count; ++i) {
+			carchive_segment_t *l_seg = &g_idx.segs[i];
 
-	if ((g_mode == MODE_TELL) && (g_showsegs == 1)) {
+			color_printf("*acarith:*d seg: *h%d*d ", i);
+			color_printf("cc: ");
+			if ((l_seg->scheme & scheme_stored) == scheme_stored) {
+				color_printf("*bSTORED *d");
+			} else {
+				if ((l_seg->scheme & scheme_rle) == scheme_rle)
+					color_printf("*bRLE *d");
+				if ((l_seg->scheme & scheme_lzss4) == scheme_lzss4)
+					color_printf("*bLZSS4 *d");
+				if ((l_seg->scheme & scheme_lzss32) == scheme_lzss32)
+					color_printf("*bLZSS32 *d");
+				if ((l_seg->scheme & scheme_ac) == scheme_ac)
+					color_printf("*bAC*d(*b%s*d) ", segment_coder_name(l_seg->scheme, l_seg->offset + l_hdr_len));
+			}
+			color_printf("offset: *h%ld*d ", l_seg->offset);
+			color_printf("comp: *h%ld*d ", l_seg->total_compsize);
+			color_printf("plain: *h%ld*d ", l_seg->plain_len);
+			color_printf("ratio: *h%3.5f%%*d\n", (float)l_seg->total_compsize / (float)l_seg->plain_len * 100.0);
+		}
+	} else if ((g_mode == MODE_TELL) && (g_showsegs == 1)) {
 		int seg_ctr = 0;
 		int segscan_eof = 0;
 
+		size_t l_plain_sofar = 0;
+
 		do {
-			res = read(g_in_fd, &bh, sizeof(bh));
+			// an indexed archive whose index we couldn't use ends where the plaintext runs out
+			if (((l_fh.scheme & scheme_indexed) == scheme_indexed) && (l_plain_sofar >= l_fh.total_plain_len))
+				break;
+			res = read(g_in_fd, &bh, l_hdr_len);
 			if (res == 0) {
 				segscan_eof = 1;
 				continue;
@@ -611,7 +1316,7 @@ void extract()
 					if ((bh.scheme & scheme_lzss32) == scheme_lzss32)
 						color_printf("*bLZSS32 *d");
 					if ((bh.scheme & scheme_ac) == scheme_ac)
-						color_printf("*bAC *d");
+						color_printf("*bAC*d(*b%s*d) ", segment_coder_name(bh.scheme, lseek(g_in_fd, 0, SEEK_CUR)));
 				}
 				color_printf("comp: *h%ld*d ", bh.total_compsize);
 				color_printf("LZSSint: *h%ld*d ", bh.lzss_intermediate);
@@ -624,199 +1329,233 @@ void extract()
 				color_err_printf(1, "difficulty seeking through input file");
 				exit(EXIT_FAILURE);
 			}
+			l_plain_sofar += bh.plain_len;
 			seg_ctr++;
 		} while (segscan_eof == 0);
 	}
 
 	if (g_mode == MODE_TELL) {
+		carchive_index_free(&g_idx);
 		close(g_in_fd);
 		return;
 	}
 
-	// if block size differs from what we have selected with -g (or our default), then recycle it
-	if (g_segsize != ntohl(l_fh.segsize)) {
-		color_debug("changing segsize from %d to %d\n", g_segsize, ntohl(l_fh.segsize));
-		carith_error_t init_error;
-		g_segsize = ntohl(l_fh.segsize);
-		// dispose them all
-		for (i = 0; i < g_threads; ++i) {
-			carith_free_ctx(&ctx[i]);
-		}
-		// then init them again
-		for (i = 0; i < g_threads; ++i) {
-			init_error = carith_init_ctx(&ctx[i], g_segsize);
-			if (init_error != CARITH_ERR_NONE) {
-				color_err_printf(0, "carith_init_ctx retuned %s.\n", carith_strerror(init_error));
-				exit(EXIT_FAILURE);
+	// contexts are sized from the archive's segment size, whatever -g says
+	g_segsize = l_fh.segsize;
+
+	if (g_mode == MODE_TEST) {
+		// decode and check, but the plaintext goes nowhere
+		g_out_fd = -1;
+		strcpy(g_out, "(test)");
+		g_pwrite = 0;
+	} else if (g_use_stdout) {
+		// plaintext goes out in order as soon as each segment is decoded
+		g_out_fd = STDOUT_FILENO;
+		strcpy(g_out, "(stdout)");
+		g_pwrite = 0;
+	} else {
+		// create output file name
+		strcpy(g_out, g_in);
+		if (strlen(g_out) > 7) {
+			if (memcmp(g_out + strlen(g_out) - 7, g_carith_suffix, 7) == 0) {
+				// remove .carith suffix from output
+				g_out[strlen(g_out) - 7] = 0;
+				color_debug("stripped g_out of suffix: len %ld: %s\n", strlen(g_out), g_out);
 			}
 		}
-	}
-
-	// create output file name
-	strcpy(g_out, g_in);
-	if (strlen(g_out) > 7) {
-		if (memcmp(g_out + strlen(g_out) - 7, g_carith_suffix, 7) == 0) {
-			// remove .carith suffix from output
-			g_out[strlen(g_out) - 7] = 0;
-			color_debug("stripped g_out of suffix: len %d: %s\n", strlen(g_out), g_out);
+		if (g_keep > 0) {
+			strcat(g_out, g_keep_suffix);
 		}
-	}
-	if (g_keep > 0) {
-		strcat(g_out, g_keep_suffix);
-	}
 
-	g_out_fd = open(g_out, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (g_out_fd < 0) {
-		color_err_printf(1, "unable to open output file");
-		exit(EXIT_FAILURE);
+		g_out_fd = open(g_out, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if (g_out_fd < 0) {
+			color_err_printf(1, "unable to open output file");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	if (g_verbose) color_printf("*acarith:*d decompressing to *h%s*d ... ", g_out);
+	// a stream we're reading as it comes is of unknown length
+	int l_len_known = ((l_fh.scheme & scheme_streamed) != scheme_streamed) || l_have_trailer;
 
-	int l_eof = 0;
-	int l_seg_ctr = 0;
-	int l_docontinue = 0;
-	uint32_t l_crc = 0;
-	uint32_t l_block_crc = 0;
+	if (g_pwrite && (l_fh.total_plain_len > 0)) {
+		// reserve the whole output file up front so the workers can write into it in any order
+		res = posix_fallocate(g_out_fd, 0, l_fh.total_plain_len);
+		if (res == ENOSPC) {
+			errno = res;
+			color_err_printf(1, "unable to preallocate output file");
+			exit(EXIT_FAILURE);
+		} else if (res != 0) {
+			// filesystem can't preallocate, pwrite will just extend the file as it goes
+			color_debug("posix_fallocate: %s\n", strerror(res));
+		}
+	}
 
-	// spin up and init threads
-	for (i = 0; i < g_threads; ++i) {
-		pthread_mutex_init(&twa[i].sig_mtx, NULL);
-		pthread_cond_init(&twa[i].sig_cond, NULL);
-		twa[i].id = i;
-		twa[i].runflag = 1;
-		pthread_create(&twa[i].thread, NULL, compress_tf, &twa[i]);
+	pipeline_alloc(l_len_known ? segments_for(l_fh.total_plain_len) : UINT32_MAX);
+	if (g_verbose) {
+		if (g_mode == MODE_TEST)
+			color_printf("*acarith:*d testing *h%s*d ... ", g_in);
+		else
+			color_printf("*acarith:*d decompressing to *h%s*d ... ", g_out);
 	}
 
-	size_t l_sofar = 0;
-	if (g_verbose) color_progress(l_sofar, ntohl(l_fh.total_plain_len));
+	uint32_t l_seg_ctr;
+	segment_slot *l_slot;
+	off_t l_out_offset = 0;
 
-	do {
-		g_tally = 0;
-		for (i = 0; i < g_threads; ++i) {
-			// read block header
-			res = read(g_in_fd, &bh, sizeof(bh));
-			if (res == 0) {
-				// eof
-				l_eof = 1;
-				if (i == 0)
-					l_docontinue = 1;
-				break;
-			}
-			if (res < 0) {
-				color_err_printf(1, "unable to read input file");
-				exit(EXIT_FAILURE);
-			}
-			if (res < sizeof(bh)) {
-				color_err_printf(0, "problems reading input file, read %ld expected to read %ld", res, sizeof(bh));
-				exit(EXIT_FAILURE);
-			}
-			bh.rle_intermediate = ntohl(bh.rle_intermediate);
-			bh.lzss_intermediate = ntohl(bh.lzss_intermediate);
-			bh.total_compsize = ntohl(bh.total_compsize);
-			bh.freq_comp_len = ntohs(bh.freq_comp_len);
-			bh.plain_len = ntohl(bh.plain_len);
-			color_debug("block %d totalcompsize %d freqsize %d rle_intermediate %ld lzss_intermediate %ld\n", l_seg_ctr, bh.total_compsize, bh.freq_comp_len, bh.rle_intermediate, bh.lzss_intermediate);
-
-			ctx[i].block_num = l_seg_ctr;
-			ctx[i].plain_len = bh.plain_len;
-			ctx[i].rle_intermediate = bh.rle_intermediate;
-			ctx[i].lzss_intermediate = bh.lzss_intermediate;
-			ctx[i].freq_comp_len = bh.freq_comp_len;
-			res = read(g_in_fd, ctx[i].freq_comp, bh.freq_comp_len);
-			if (res < 0) {
-				color_err_printf(1, "unable to read input file");
-				exit(EXIT_FAILURE);
-			}
-			if (res < bh.freq_comp_len) {
-				color_err_printf(0, "problems reading input file, read %ld expected to read %ld", res, bh.freq_comp_len);
-				exit(EXIT_FAILURE);
-			}
-			uint32_t l_read_compsize = bh.total_compsize - bh.freq_comp_len;
-			ctx[i].comp_len = l_read_compsize;
-			res = read(g_in_fd, ctx[i].comp, l_read_compsize);
-			if (res < 0) {
-				color_err_printf(1, "unable to read input file");
-				exit(EXIT_FAILURE);
-			}
-			if (res < l_read_compsize) {
-				color_err_printf(0, "problems reading input file, read %ld expected to read %ld", res, l_read_compsize);
-				exit(EXIT_FAILURE);
-			}
+	g_plain_crc = 0;
+	g_progress_total = l_fh.total_plain_len;
+	if (g_verbose) color_progress(0, g_progress_total);
 
-			// populate a thread and signal it
-			ctx[i].scheme = bh.scheme;
-			pthread_mutex_lock(&twa[i].sig_mtx);
-			twa[i].cur_seg = l_seg_ctr;
-			twa[i].sigflag = 1;
-			pthread_cond_signal(&twa[i].sig_cond);
-			pthread_mutex_unlock(&twa[i].sig_mtx);
-
-			l_seg_ctr++;
-		}
-		if (l_docontinue > 0)
-			continue;
-
-		color_debug("waiting for threads to finish\n");
-		// wait for threads to finish
-		pthread_mutex_lock(&g_tally_mtx);
-		while (g_tally < i)
-			pthread_cond_wait(&g_tally_cond, &g_tally_mtx);
-		pthread_mutex_unlock(&g_tally_mtx);
-
-		// all our threads are done and the plains are all contained in the ctx data structures
-		color_debug("processing %d blocks\n", i);
-		for (j = 0; j < i; ++j) {
-			l_crc = get_buffer_crc(l_crc, ctx[j].decomp, ctx[j].decomp_len);
-			l_block_crc = get_buffer_crc(0, ctx[j].decomp, ctx[j].decomp_len);
-			color_debug("writing block %d to file. block CRC: %08X\n", ctx[j].block_num, l_block_crc);
-			// write plains to file
-			res = write(g_out_fd, ctx[j].decomp, ctx[j].decomp_len);
-			if (res < 0) {
-				color_err_printf(1, "carith: unable to write to output file.");
-				exit(EXIT_FAILURE);
-			}
-			if (res != ctx[j].decomp_len) {
-				color_err_printf(0, "carith: difficulty writing to output file: wrote %ld expected to write %ld.", res, ctx[j].decomp_len);
+	// spin up workers and writer, then act as the reader stage
+	pipeline_start();
+	for (l_seg_ctr = 0; g_pread_segments; ++l_seg_ctr) {
+		// with an index, all the reader does is tell each worker where to find its segment
+		if (l_seg_ctr >= g_idx.count)
+			break;
+		l_slot = pipeline_claim_slot(l_seg_ctr);
+		l_slot->in_offset = g_idx.segs[l_seg_ctr].offset;
+		l_slot->out_offset = g_idx.segs[l_seg_ctr].plain_offset;
+		l_slot->ctx.block_num = l_seg_ctr;
+		l_slot->ctx.plain_len = g_idx.segs[l_seg_ctr].plain_len;
+		l_slot->ctx.scheme = g_idx.segs[l_seg_ctr].scheme;
+		pipeline_queue_slot(l_slot);
+	}
+	for (l_seg_ctr = 0; !g_pread_segments; ++l_seg_ctr) {
+		// an indexed archive whose index we couldn't use ends where the plaintext runs out
+		if (((l_fh.scheme & (scheme_indexed | scheme_streamed)) == scheme_indexed) && (l_out_offset >= l_fh.total_plain_len))
+			break;
+		// read block header
+		res = read_fully(g_in_fd, &bh, l_hdr_len);
+		if (res == 0) {
+			// eof
+			if ((l_fh.scheme & scheme_streamed) == scheme_streamed) {
+				color_err_printf(0, "carith: stream ended before its end marker.");
 				exit(EXIT_FAILURE);
 			}
-			l_sofar += ctx[j].decomp_len;
+			break;
+		}
+		if ((res == l_hdr_len) && ((l_fh.scheme & scheme_streamed) == scheme_streamed) && (bh.plain_len == 0) && (bh.total_compsize == 0)) {
+			// end marker, the trailer comes next
+			break;
+		}
+		if (res < l_hdr_len) {
+			color_err_printf(0, "problems reading input file, read %ld expected to read %ld", res, l_hdr_len);
+			exit(EXIT_FAILURE);
+		}
+		bh.rle_intermediate = ntohl(bh.rle_intermediate);
+		bh.lzss_intermediate = ntohl(bh.lzss_intermediate);
+		bh.total_compsize = ntohl(bh.total_compsize);
+		bh.freq_comp_len = ntohs(bh.freq_comp_len);
+		bh.plain_len = ntohl(bh.plain_len);
+		color_trace("block %d totalcompsize %d freqsize %d rle_intermediate %d lzss_intermediate %d\n", l_seg_ctr, bh.total_compsize, bh.freq_comp_len, bh.rle_intermediate, bh.lzss_intermediate);
+
+		l_slot = pipeline_claim_slot(l_seg_ctr);
+		if (!segment_fits(&l_slot->ctx, bh.freq_comp_len, bh.total_compsize, bh.plain_len)) {
+			color_err_printf(0, "carith: segment %d header is damaged, its lengths are impossible.", l_seg_ctr);
+			exit(EXIT_FAILURE);
+		}
+		l_slot->out_offset = l_out_offset;
+		l_out_offset += bh.plain_len;
+		l_slot->ctx.block_num = l_seg_ctr;
+		l_slot->ctx.plain_len = bh.plain_len;
+		l_slot->ctx.rle_intermediate = bh.rle_intermediate;
+		l_slot->ctx.lzss_intermediate = bh.lzss_intermediate;
+		l_slot->ctx.freq_comp_len = bh.freq_comp_len;
+		l_slot->seg_crc = ntohl(bh.plain_crc);
+		res = read_fully(g_in_fd, l_slot->ctx.freq_comp, bh.freq_comp_len);
+		if (res < bh.freq_comp_len) {
+			color_err_printf(0, "problems reading input file, read %ld expected to read %ld", res, bh.freq_comp_len);
+			exit(EXIT_FAILURE);
+		}
+		uint32_t l_read_compsize = bh.total_compsize - bh.freq_comp_len;
+		l_slot->ctx.comp_len = l_read_compsize;
+		res = read_fully(g_in_fd, l_slot->ctx.comp, l_read_compsize);
+		if (res < l_read_compsize) {
+			color_err_printf(0, "problems reading input file, read %ld expected to read %ld", res, l_read_compsize);
+			exit(EXIT_FAILURE);
 		}
-		if (g_verbose) color_progress(l_sofar, ntohl(l_fh.total_plain_len));
-	} while (l_eof == 0);
 
-	if (g_verbose) printf("\n");
+		// hand it to the workers
+		l_slot->ctx.scheme = bh.scheme;
+		pipeline_queue_slot(l_slot);
+	}
+	pipeline_finish();
+	pipeline_free();
+	carchive_index_free(&g_idx);
 
-	color_debug("joining threads...\n");
-	// join threads
-	for (i = 0; i < g_threads; ++i) {
-		pthread_mutex_lock(&twa[i].sig_mtx);
-		twa[i].runflag = 0;
-		pthread_cond_signal(&twa[i].sig_cond);
-		pthread_mutex_unlock(&twa[i].sig_mtx);
-		pthread_join(twa[i].thread, NULL);
+	if (((l_fh.scheme & scheme_streamed) == scheme_streamed) && !l_have_trailer) {
+		// we've just read the end marker, the trailer follows it
+		carchive_stream_trailer_t l_trailer;
+
+		res = read_fully(g_in_fd, &l_trailer, sizeof(l_trailer));
+		if ((res < sizeof(l_trailer)) || (carchive_trailer_decode(&l_trailer) != CARCHIVE_ERR_NONE)) {
+			color_err_printf(0, "carith: stream trailer is missing or damaged.");
+			exit(EXIT_FAILURE);
+		}
+		l_fh.plain_crc = l_trailer.plain_crc;
+		l_fh.total_plain_len = l_trailer.total_plain_len;
 	}
-	color_debug("destroying synchronization primitives...\n");
-	// clean up
-	for (i = 0; i < g_threads; ++i) {
-		pthread_mutex_destroy(&twa[i].sig_mtx);
-		pthread_cond_destroy(&twa[i].sig_cond);
+
+	if (g_pwrite && (g_sofar != l_fh.total_plain_len)) {
+		// archive came up short of what the header promised, don't leave preallocated zeroes behind
+		res = ftruncate(g_out_fd, g_sofar);
+		if (res < 0) {
+			color_err_printf(1, "unable to truncate output file");
+			exit(EXIT_FAILURE);
+		}
 	}
 
+	if (g_verbose) printf("\n");
+
+	uint32_t l_crc = g_plain_crc;
 	color_debug("output file CRC: %08X\n", l_crc);
-	if (l_crc != htonl(l_fh.plain_crc)) {
-		color_printf("*acarith:*d *eCRC mismatch*d, expected *h%08X*d but got *h%08X*d.\n", htonl(l_fh.plain_crc), l_crc);
+	if (l_crc != l_fh.plain_crc) {
+		if (g_use_stdout) {
+			// stdout belongs to the data, and whoever is downstream needs to know
+			color_err_printf(0, "carith: CRC mismatch, expected %08X but got %08X.", l_fh.plain_crc, l_crc);
+			exit(EXIT_FAILURE);
+		}
+		color_printf("*acarith:*d *eCRC mismatch*d, expected *h%08X*d but got *h%08X*d.\n", l_fh.plain_crc, l_crc);
+		if (g_bad_segs > 0) color_printf("*acarith:*d *h%d*d damaged segment(s), see above.\n", g_bad_segs);
 	} else {
 		if (g_verbose) color_printf("*acarith:*d CRC *hOK*d (*h%08X*d)\n", l_crc);
 	}
 
-	if (g_keep == 0) {
+	if (g_sofar != l_fh.total_plain_len)
+		color_printf("*acarith:*d *elength mismatch*d, expected *h%ld*d bytes but got *h%ld*d.\n", l_fh.total_plain_len, g_sofar);
+	int l_failed = ((l_crc != l_fh.plain_crc) || (g_bad_segs > 0) || (g_sofar != l_fh.total_plain_len));
+
+	if (g_mode == MODE_TEST) {
+		// the exit status is the verdict
+		if (l_failed) {
+			color_err_printf(0, "carith: %s: FAILED", g_in);
+			exit(EXIT_FAILURE);
+		}
+		if (g_verbose) color_printf("*acarith:*d *h%s*d: *hOK*d\n", g_in);
+		if (!g_use_stdin)
+			close(g_in_fd);
+		return;
+	}
+
+	if (g_use_stdout) {
+		// no file of our own to fix up, and the archive stays put
+		if (l_failed) {
+			color_err_printf(0, "carith: %s: extracted with errors", g_in);
+			exit(EXIT_FAILURE);
+		}
+		if (!g_use_stdin)
+			close(g_in_fd);
+		return;
+	}
+
+	// whatever we salvaged still gets its mode and mtime, but the archive is the only good copy
+	if ((g_keep == 0) && (!l_failed)) {
 		// unlink g_in
 		unlink(g_in);
 	}
 
 	// set mode of output file to whatever the original file had
-	res = chmod(g_out, ntohl(l_fh.mode));
+	res = chmod(g_out, l_fh.mode);
 	if (res < 0) {
 		color_err_printf(1, "unable to chmod output file to original mode");
 		exit(EXIT_FAILURE);
@@ -834,31 +1573,77 @@ void extract()
 
 	close(g_in_fd);
 	close(g_out_fd);
+	if (l_failed) {
+		color_err_printf(0, "carith: %s: extracted with errors, archive kept", g_in);
+		exit(EXIT_FAILURE);
+	}
 	return;
 }
 
+void extract_range()
+{
+	// pull g_range_len bytes starting at g_range_offset out of archive g_in and send them to stdout
+	carchive_reader_t l_rd;
+	carchive_error_t l_err;
+	uint8_t *l_buff;
+	size_t l_buff_len = 1048576;
+	size_t l_read;
+	ssize_t res;
+	size_t l_done;
+
+	l_err = carchive_open(&l_rd, g_in, 0);
+	if (l_err != CARCHIVE_ERR_NONE) {
+		color_err_printf(l_err == CARCHIVE_ERR_IO, "carith: unable to open %s: %s", g_in, carchive_strerror(l_err));
+		exit(EXIT_FAILURE);
+	}
+	l_buff = malloc(l_buff_len);
+	if (l_buff == NULL) {
+		color_err_printf(1, "carith: unable to allocate range buffer");
+		exit(EXIT_FAILURE);
+	}
+	color_debug("range %ld:%ld of %ld bytes, %d segments\n", g_range_offset, g_range_len, l_rd.idx.plain_len, l_rd.idx.count);
+	while (g_range_len > 0) {
+		l_err = carchive_read(&l_rd, l_buff, (g_range_len < l_buff_len) ? g_range_len : l_buff_len, g_range_offset, &l_read);
+		if (l_err != CARCHIVE_ERR_NONE) {
+			color_err_printf(l_err == CARCHIVE_ERR_IO, "carith: unable to read %s: %s", g_in, carchive_strerror(l_err));
+			exit(EXIT_FAILURE);
+		}
+		if (l_read == 0)
+			break; // ran off the end of the original file
+		for (l_done = 0; l_done < l_read; l_done += res) {
+			res = write(STDOUT_FILENO, l_buff + l_done, l_read - l_done);
+			if (res < 0) {
+				if (errno == EINTR) {
+					res = 0;
+					continue;
+				}
+				color_err_printf(1, "carith: unable to write to stdout");
+				exit(EXIT_FAILURE);
+			}
+		}
+		g_range_offset += l_read;
+		g_range_len -= l_read;
+	}
+	color_debug("range: %ld segment cache hits, %ld misses\n", l_rd.hits, l_rd.misses);
+	free(l_buff);
+	carchive_close(&l_rd);
+}
+
 int main(int argc, char **argv)
 {
 	int opt;
 	size_t i;
 
-	// try to determine hardware concurrency
-	unsigned int l_tcnt = sysconf(_SC_NPROCESSORS_ONLN);
-	if (l_tcnt != 0) {
-		g_threads = l_tcnt;
-	}
-
-	// initialize threaded environment
-	pthread_mutex_init(&g_tally_mtx, NULL);
-	pthread_cond_init(&g_tally_cond, NULL);
 	color_init(g_nocolor, g_debug);
 	color_set_theme(g_color_theme);
 
-	while ((opt = getopt_long(argc, argv, "?g:vcxtski:", g_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "?g:vcxtTski:", g_options, NULL)) != -1) {
 		switch (opt) {
 			case OPT_DEBUG:
 			{
-				g_debug = 1;
+				// once for debug, twice for trace
+				if (g_debug < CP_LOG_TRACE)
+					g_debug++;
 				color_set_debug(g_debug);
 			}
 			break;
@@ -928,6 +1713,20 @@ int main(int argc, char **argv)
 				g_mode = MODE_TELL;
 			}
 			break;
+			case 'T': // test
+			{
+				if (g_mode != MODE_NONE) {
+					color_err_printf(0, "carith: please select only one operational mode.");
+					exit(EXIT_FAILURE);
+				}
+				g_mode = MODE_TEST;
+			}
+			break;
+			case OPT_FAILFAST:
+			{
+				g_failfast = 1;
+			}
+			break;
 			case OPT_NORLE:
 			{
 				g_norle = 1;
@@ -958,6 +1757,73 @@ int main(int argc, char **argv)
 				g_roulette = 0;
 			}
 			break;
+			case OPT_NOMMAP:
+			{
+				g_usemmap = 0;
+			}
+			break;
+			case OPT_NOPWRITE:
+			{
+				g_pwrite = 0;
+			}
+			break;
+			case OPT_NOINDEX:
+			{
+				g_index = 0;
+			}
+			break;
+			case OPT_HEADER64:
+			{
+				g_header64 = 1;
+			}
+			break;
+			case OPT_CODER:
+			{
+				for (g_coder = 0; g_coder <= CARITH_CODER_AUTO; ++g_coder) {
+					if (strcmp(optarg, carith_coder_name(g_coder)) == 0)
+						break;
+				}
+				if (g_coder > CARITH_CODER_AUTO) {
+					color_err_printf(0, "carith: unknown coder %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+			}
+			break;
+			case OPT_AUTOSLACK:
+			{
+				g_auto_slack = atoi(optarg);
+				if ((g_auto_slack < 0) || (g_auto_slack > 1000)) {
+					color_err_printf(0, "carith: autoslack must be 0 to 1000.");
+					exit(EXIT_FAILURE);
+				}
+			}
+			break;
+			case OPT_SHAREDTABLE:
+			{
+				g_sharedtable = 1;
+			}
+			break;
+			case OPT_STDOUT:
+			{
+				g_use_stdout = 1;
+			}
+			break;
+			case OPT_RANGE:
+			{
+				char *l_end;
+				g_range_offset = strtoull(optarg, &l_end, 0);
+				if ((l_end == optarg) || (*l_end != ':')) {
+					color_err_printf(0, "carith: --range wants offset:length.");
+					exit(EXIT_FAILURE);
+				}
+				g_range_len = strtoull(l_end + 1, &l_end, 0);
+				if (*l_end != 0) {
+					color_err_printf(0, "carith: --range wants offset:length.");
+					exit(EXIT_FAILURE);
+				}
+				g_range_set = 1;
+			}
+			break;
 			case OPT_COLOR_THEME:
 			{
 				g_color_theme = atoi(optarg);
@@ -971,11 +1837,11 @@ int main(int argc, char **argv)
 				color_printf("*aby Stephen Sviatko - (C) 2025 Good Neighbors LLC*d\n");
 				color_printf("*husage:*a carith <options> <file>*d\n");
 				color_printf("*a  -? (--help)*d this screen\n");
-				color_printf("*a     (--debug)*d enable debug mode\n");
+				color_printf("*a     (--debug)*d enable debug mode, twice to trace the pipeline too\n");
 				color_printf("*a     (--nocolor)*d defeat colors\n");
 				color_printf("*a     (--theme)*d choose color theme 0-3 (default *h3*d)\n");
-				color_printf("*a     (--threads) <count>*d specify number of theads to use (default *h%d*d)\n", g_threads);
-				color_printf("*a  -g (--segsize) <kilobytes>*d specify size of segments (default *h%dk*d)\n", DEFAULT_SEGSIZE / 1024);
+				color_printf("*a     (--threads) <count>*d specify number of theads to use (default *h%d*d, the CPUs we may use)\n", detect_threads());
+				color_printf("*a  -g (--segsize) <kilobytes>*d specify size of segments (default *h%dk*d, at least *h32k*d, or *h4k*d with *h--coder adaptive*d, *hcm*d or *hauto*d)\n", DEFAULT_SEGSIZE / 1024);
 				color_printf("*a  -v (--verbose)*d enable verbose mode\n");
 				color_printf("*a  -i (--infotag)*d <string> set infotag string when compressing\n");
 				color_printf("*a     (--norle)*d defeat RLE encode before arithmetic compression\n");
@@ -986,10 +1852,21 @@ int main(int argc, char **argv)
 				color_printf("*a  -k (--keep)*d keep input files instead of automatically removing them\n");
 				color_printf("*a  -s (--showsegs)*d Show segment info in --tell mode\n");
 				color_printf("*a     (--noicms)*d defeat ICMS (intelligent compression method selection)\n");
+				color_printf("*a     (--nommap)*d read input with read() instead of mapping it when compressing\n");
+				color_printf("*a     (--stdout)*d write the archive (*h-c*d) or the original file (*h-x*d) to stdout. a file argument of *h-*d reads stdin and implies this\n");
+				color_printf("*a     (--header64)*d write the 64-bit archive header even for inputs under 4GB\n");
+				color_printf("*a     (--coder) <name>*d entropy coder for the arithmetic stage: *hac*d (default), *hac32*d (faster, power of two totals), *hac32x4*d (four interleaved ac32 coders, faster to decode), *hrans*d (fast to decode), *hhuff*d (fastest to decode, a little less ratio), *hadaptive*d (no frequency table, for small segments), *hcm*d (order 1/2 context mixing, best ratio, slow), *hrc*d (ac32 tables, carry propagating range coder) or *hauto*d (per segment, the fastest to decode that compresses about as well as the best)\n");
+				color_printf("*a     (--autoslack) <thousandths>*d with *h--coder auto*d, how much larger a faster coder's output may be than the smallest (default *h%d*d)\n", CARITH_AUTO_SLACK);
+				color_printf("*a     (--sharedtable)*d with *h--coder ac32*d, *hac32x4*d or *hrc*d, put one frequency table for the whole file in the archive header, which segments can use as is or send only their differences from\n");
+				color_printf("*a     (--range off:len)*d with *h-x*d, write just *hlen*d bytes of the original file starting at *hoff*d to stdout\n");
+				color_printf("*a     (--noindex)*d don't write a segment index at the end of the archive\n");
+				color_printf("*a     (--nopwrite)*d write extracted segments in order from one thread instead of in place from the workers\n");
+				color_printf("*a     (--failfast)*d with *h-T*d, stop at the first damaged segment\n");
 				color_printf("*hoperational modes*a (choose only one)*d\n");
 				color_printf("*a  -c (--compress) <file>*d compress a file\n");
 				color_printf("*a  -x (--extract) <file.carith>*d extract a file\n");
 				color_printf("*a  -t (--tell) <file.carith>*d show contents of compressed file\n");
+				color_printf("*a  -T (--test) <file.carith>*d decode and check a compressed file without writing anything\n");
 				exit(EXIT_SUCCESS);
 			}
 			break;
@@ -1029,22 +1906,40 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (g_range_set && (g_mode != MODE_EXTRACT)) {
+		color_err_printf(0, "carith: --range only works with -x.");
+		exit(EXIT_FAILURE);
+	}
+	if (g_failfast && (g_mode != MODE_TEST)) {
+		color_err_printf(0, "carith: --failfast only works with -T.");
+		exit(EXIT_FAILURE);
+	}
+	if (g_use_stdout && (g_mode == MODE_TEST)) {
+		color_err_printf(0, "carith: -T doesn't write anything, so --stdout makes no sense with it.");
+		exit(EXIT_FAILURE);
+	}
+
 	// police thread count
+	if (g_threads == 0) {
+		g_threads = detect_threads();
+	}
 	if (g_threads < 1) {
 		color_err_printf(0, "carith: need to use at least 1 thread.");
 		exit(EXIT_FAILURE);
 	}
-	if (g_threads > MAXTHREADS) {
-		color_err_printf(0, "carith: thread limit: %d.", MAXTHREADS);
+
+	// police segsize, the adaptive coders send no frequency table so they can go a lot smaller
+	if ((g_coder == CARITH_CODER_ADAPT) || (g_coder == CARITH_CODER_CM) || (g_coder == CARITH_CODER_AUTO)) {
+		if (g_segsize < 4096) {
+			color_err_printf(0, "carith: need to use segment size of at least 4096 (4k) with --coder %s.", carith_coder_name(g_coder));
+			exit(EXIT_FAILURE);
+		}
+	} else if (g_segsize < 32768) {
+		color_err_printf(0, "carith: need to use segment size of at least 32768 (32k), or 4096 (4k) with --coder adaptive, cm or auto.");
 		exit(EXIT_FAILURE);
 	}
-	if (g_threads > 1) {
-		if (g_verbose) color_printf("*acarith:*d enabling *h%d*d threads.\n", g_threads);
-	}
-
-	// police segsize
-	if (g_segsize < 32768) {
-		color_err_printf(0, "carith: need to use segment size of at least 32768 (32k).");
+	if (g_sharedtable && (g_coder != CARITH_CODER_AC32) && (g_coder != CARITH_CODER_AC32X) && (g_coder != CARITH_CODER_RC)) {
+		color_err_printf(0, "carith: --sharedtable needs --coder ac32, ac32x4 or rc.");
 		exit(EXIT_FAILURE);
 	}
 	if (g_segsize > 16777216) {
@@ -1052,17 +1947,25 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	gettimeofday(&g_start_time, NULL);
-
-	// init carith contexts
-	carith_error_t init_error;
-	for (i = 0; i < g_threads; ++i) {
-		init_error = carith_init_ctx(&ctx[i], g_segsize);
-		if (init_error != CARITH_ERR_NONE) {
-			color_err_printf(0, "carith_init_ctx retuned %s.\n", carith_strerror(init_error));
+	// "-" means stdin, and output to stdout to go with it
+	if ((optind < argc) && (strcmp(argv[optind], "-") == 0)) {
+		if ((g_mode == MODE_TELL) || g_range_set) {
+			color_err_printf(0, "carith: -t and --range need an archive file, not stdin.");
 			exit(EXIT_FAILURE);
 		}
+		if ((g_mode == MODE_COMPRESS) && g_sharedtable) {
+			color_err_printf(0, "carith: --sharedtable reads the input twice, so it can't compress stdin.");
+			exit(EXIT_FAILURE);
+		}
+		if (g_mode != MODE_TEST)
+			g_use_stdout = 1;
 	}
+	if (g_use_stdout) {
+		// stdout is for the data, so no chatter
+		g_verbose = 0;
+	}
+
+	gettimeofday(&g_start_time, NULL);
 
 	if (g_mode == MODE_COMPRESS) {
 		if (optind >= argc) {
@@ -1077,6 +1980,8 @@ int main(int argc, char **argv)
 		if (g_verbose && g_lzssonly && !g_uselzss32) color_printf("*acarith:*d LZSS4 encode file only, no arithmetic compression.\n");
 		if (g_verbose && g_lzssonly && g_uselzss32) color_printf("*acarith:*d LZSS32 encode file only, no arithmetic compression.\n");
 		if (g_verbose) color_printf("*acarith:*d ICMS mode: *h%s*d\n", (g_roulette ? "ENABLED" : "DISABLED"));
+		if (g_verbose) color_printf("*acarith:*d entropy coder: *h%s*d\n", carith_coder_name(g_coder));
+		if (g_verbose && (g_coder == CARITH_CODER_AUTO)) color_printf("*acarith:*d auto coder slack: *h%d*d thousandths\n", g_auto_slack);
 		g_in[0] = 0;
 		strcpy(g_in, argv[optind]);
 		verify_file_argument();
@@ -1086,8 +1991,23 @@ int main(int argc, char **argv)
 			color_err_printf(0, "carith: expected file argument.");
 			exit(EXIT_FAILURE);
 		}
-		if (g_verbose) color_printf("*acarith:*d keep mode: *h%s*d\n", (g_keep ? "YES" : "NO"));
-		if (g_verbose) color_printf("*acarith:*d extracting *h%s*d\n", argv[optind]);
+		g_in[0] = 0;
+		strcpy(g_in, argv[optind]);
+		if (g_range_set) {
+			// stdout is for the data, so no chatter
+			g_verbose = 0;
+			extract_range();
+		} else {
+			if (g_verbose) color_printf("*acarith:*d keep mode: *h%s*d\n", (g_keep ? "YES" : "NO"));
+			if (g_verbose) color_printf("*acarith:*d extracting *h%s*d\n", argv[optind]);
+			verify_file_argument();
+			extract();
+		}
+	} else if (g_mode == MODE_TEST) {
+		if (optind >= argc) {
+			color_err_printf(0, "carith: expected file argument.");
+			exit(EXIT_FAILURE);
+		}
 		g_in[0] = 0;
 		strcpy(g_in, argv[optind]);
 		verify_file_argument();
@@ -1108,12 +2028,6 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	// free
-	for (i = 0; i < g_threads; ++i) {
-		carith_free_ctx(&ctx[i]);
-	}
-	pthread_cond_destroy(&g_tally_cond);
-	pthread_mutex_destroy(&g_tally_mtx);
 	color_free();
 
 	gettimeofday(&g_end_time, NULL);
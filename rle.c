@@ -176,7 +176,8 @@ void rle_encode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t *a_outsiz
     return;
 }
 
-void rle_decode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t *a_outsize)
+// returns 0, or -1 if the stream is damaged: an illegal repeat, or more than a_outmax bytes of output
+int rle_decode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t a_outmax, size_t *a_outsize)
 {
     uint8_t RLE_ESCAPE = 0x55;
     const uint8_t RLE_INCREMENT = 0x3B;
@@ -187,6 +188,9 @@ void rle_decode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t *a_outsiz
     size_t i;
     enum { COLLECTING, FOUND_ESCAPE, FOUND_CHAR } l_state = COLLECTING;
 
+    *a_outsize = 0;
+    if (a_insize == 0)
+        return 0;
     do {
         uint8_t l_new = a_in[inptr++];
         if (inptr == a_insize) {
@@ -198,12 +202,16 @@ void rle_decode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t *a_outsiz
                     l_state = FOUND_ESCAPE;
                 } else {
                     // just a normal char, so write it out
+                    if (outptr >= a_outmax)
+                        return -1;
                     a_out[outptr++] = l_new;
                 }
                 break;
             case FOUND_ESCAPE:
                 if (l_new == RLE_ESCAPE) {
                     // found second escape character, so write it then rotate escape
+                    if (outptr >= a_outmax)
+                        return -1;
                     a_out[outptr++] = l_new;
                     RLE_ESCAPE += RLE_INCREMENT;
                     l_state = COLLECTING;
@@ -215,19 +223,20 @@ void rle_decode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t *a_outsiz
                 break;
             case FOUND_CHAR:
                 if (l_new > 0) {
+                    if (outptr + l_new > a_outmax)
+                        return -1;
                     for (i = 0; i < l_new; ++i) {
                         a_out[outptr++] = l_repeat;
                     }
                     RLE_ESCAPE += RLE_INCREMENT;
                     l_state = COLLECTING;
                 } else {
-                    // value of 0 is illegali in a repeat construct, so data stream must be corrupted
-                    fprintf(stderr, "rle_decode: Illegal character in stream, possible data corruption.\n");
-                    exit(EXIT_FAILURE);
+                    // value of 0 is illegal in a repeat construct, so data stream must be corrupted
+                    return -1;
                 }
                 break;
         }
     } while (l_eof == 0);
     *a_outsize = outptr;
-    return;
+    return 0;
 }
@@ -45,7 +45,7 @@ extern "C" {
 #include <stdlib.h>
 
 void rle_encode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t *a_outsize);
-void rle_decode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t *a_outsize);
+int  rle_decode(uint8_t *a_in, uint8_t *a_out, size_t a_insize, size_t a_outmax, size_t *a_outsize);
 
 #ifdef __cplusplus
 }
@@ -11,6 +11,7 @@
 #include <limits.h>
 
 #include "carith.h"
+#include "cbit.h"
 
 size_t g_segsize = 524288;
 carith_comp_ctx ctx;
@@ -32,6 +33,75 @@ void process()
 	memset(ctx.decomp, 0, g_segsize);
 }
 
+// full frequency table, every count a_width bits, as the AC coder writes one
+void write_full_table(const uint64_t *a_counts, uint16_t a_width)
+{
+	cbit_cursor_t l_cur = { 0, 7, ctx.freq_comp };
+	int i;
+
+	memset(ctx.freq_comp, 0, sizeof(ctx.freq_comp));
+	cbit_write(&l_cur, 0);
+	cbit_write_many(&l_cur, a_width, 5);
+	for (i = 0; i < 256; ++i)
+		cbit_write_many(&l_cur, a_counts[i], a_width);
+	ctx.freq_comp_len = l_cur.byte + 1;
+}
+
+// damaged AC segments must come back as CARITH_ERR_DAMAGED, or at worst as garbage, never take us down
+int damaged_table_test()
+{
+	uint64_t l_counts[256];
+	carith_error_t err;
+	int l_fail = 0;
+
+	memset(l_counts, 0, sizeof(l_counts));
+	memset(ctx.comp, 0, ctx.comp_size);
+
+	// counts that don't total the segment length
+	l_counts[0] = 1;
+	l_counts[1] = 0x7fffffff;
+	write_full_table(l_counts, 31);
+	ctx.scheme = scheme_ac;
+	ctx.plain_len = 65536;
+	ctx.comp_len = 8;
+	err = carith_extract(&ctx);
+	printf("damaged AC table, bad total: %s decomp %ld\n", carith_strerror(err), ctx.decomp_len);
+	if ((err != CARITH_ERR_DAMAGED) || (ctx.decomp_len != 0))
+		l_fail = 1;
+
+	// a believable table over a token stream far too short for it, which must not be read past its end
+	l_counts[1] = 65535;
+	write_full_table(l_counts, 16);
+	ctx.scheme = scheme_ac;
+	ctx.plain_len = 65536;
+	ctx.comp_len = 8;
+	err = carith_extract(&ctx);
+	printf("damaged AC table, short stream: %s decomp %ld\n", carith_strerror(err), ctx.decomp_len);
+	if (ctx.decomp_len > ctx.plain_len)
+		l_fail = 1;
+
+	// a shared table reference in a file without one
+	ctx.freq_comp[0] = CARITH_CODER_AC32 | CARITH_CODER_SHARED;
+	ctx.freq_comp[1] = 0;
+	ctx.freq_comp_len = 2;
+	ctx.scheme = scheme_ac | scheme_xcoder;
+	err = carith_extract(&ctx);
+	printf("missing shared table: %s decomp %ld\n", carith_strerror(err), ctx.decomp_len);
+	if (err != CARITH_ERR_DAMAGED)
+		l_fail = 1;
+
+	// a coder we've never heard of
+	ctx.freq_comp[0] = 0x7f;
+	ctx.scheme = scheme_ac | scheme_xcoder;
+	err = carith_extract(&ctx);
+	printf("unknown coder: %s decomp %ld\n", carith_strerror(err), ctx.decomp_len);
+	if (err != CARITH_ERR_DAMAGED)
+		l_fail = 1;
+
+	printf("damaged table test: %s\n", l_fail ? "FAILED" : "OK");
+	return l_fail;
+}
+
 void load_file(const char *a_path)
 {
 	int lf_fd;
@@ -107,6 +177,10 @@ int main(int argc, char **argv)
 	gettimeofday(&g_start_time, NULL);
 
 	carith_init_ctx(&ctx, g_segsize);
+	if (damaged_table_test())
+		return 1;
+	if (argc < 3)
+		return 0;
 	ctx.scheme = atoi(argv[2]);
 	printf("scheme %02X\n", ctx.scheme);
 	chdir(argv[1]);